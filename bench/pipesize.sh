@@ -0,0 +1,34 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-3-Clause
+
+# Measure the MB/s going through `producer | consumer` for several sizes of
+# the pipe buffer (MINISHELL_PIPESIZE), with stream and packet pipes.
+#
+# usage: ./pipesize.sh [size_mb] [pipe_sizes...]
+
+cd "$(dirname "$0")" || exit 1
+
+exec_name=../src/mini-shell
+size_mb=${1:-1024}
+shift
+pipe_sizes=${*:-64K 256K 1M}
+
+if ! [ -x "$exec_name" ]; then
+	echo "$exec_name not found! Run make in src/ first"
+	exit 1
+fi
+
+pipeline="dd if=/dev/zero bs=64K count=$((size_mb * 16)) status=none | wc -c"
+
+for direct in no yes; do
+	for pipe_size in $pipe_sizes; do
+		start=$(date +%s%N)
+		echo "$pipeline" | MINISHELL_PIPESIZE=$pipe_size \
+			MINISHELL_PIPE_DIRECT=$direct "$exec_name" >/dev/null
+		end=$(date +%s%N)
+
+		awk -v mb="$size_mb" -v ns=$((end - start)) \
+			-v m="pipesize=$pipe_size direct=$direct" \
+			'BEGIN { printf "%-28s %8.0f MB/s\n", m, mb / (ns / 1e9) }'
+	done
+done
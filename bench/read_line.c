@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Micro-benchmark for the line reader of mini-shell.
+ *
+ * usage: read_line {reader|legacy} < input
+ *
+ * "legacy" is the former fgets + realloc + strcat implementation, kept
+ * here only to compare against.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/reader.h"
+
+#define CHUNK_SIZE         1024
+
+
+static char *legacy_free_line;
+
+static char *legacy_read_line(void)
+{
+	char *line = NULL;
+	int line_length = 0;
+
+	char chunk[CHUNK_SIZE];
+	int chunk_length;
+
+	int endline = 0;
+
+	free(legacy_free_line);
+
+	while (!endline) {
+		if (fgets(chunk, CHUNK_SIZE, stdin) == NULL)
+			break;
+
+		chunk_length = strlen(chunk);
+		if (chunk[chunk_length - 1] == '\n') {
+			chunk[chunk_length - 1] = 0;
+			endline = 1;
+		}
+
+		line = realloc(line, line_length + CHUNK_SIZE);
+		if (line == NULL)
+			exit(EXIT_FAILURE);
+
+		line[line_length] = '\0';
+		strcat(line, chunk);
+
+		line_length += CHUNK_SIZE;
+	}
+
+	legacy_free_line = line;
+	return line;
+}
+
+int main(int argc, char *argv[])
+{
+	char *(*reader)(void) = read_line;
+	struct timespec start, end;
+	size_t nr_lines = 0, nr_bytes = 0;
+	char *line;
+
+	if (argc > 1 && strcmp(argv[1], "legacy") == 0)
+		reader = legacy_read_line;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while ((line = reader()) != NULL) {
+		nr_bytes += strlen(line) + 1;
+		nr_lines++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("%-7s %10zu lines %12zu bytes %12.0f ns/line %10.1f MB/s\n",
+		(reader == read_line) ? "reader" : "legacy", nr_lines, nr_bytes,
+		seconds * 1e9 / (nr_lines ? nr_lines : 1), nr_bytes / seconds / 1e6);
+
+	free(legacy_free_line);
+	reader_free();
+
+	return EXIT_SUCCESS;
+}
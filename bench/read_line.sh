@@ -0,0 +1,27 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-3-Clause
+
+# Measure the cost of read_line for lines from 10 B to 10 MB, compared to
+# the former strcat-based reader.
+#
+# usage: ./read_line.sh [total_bytes_per_size]
+
+cd "$(dirname "$0")" || exit 1
+
+total=${1:-20000000}
+bin=./read_line_bench
+
+gcc -O2 -Wall -I../src read_line.c ../src/reader.c -o "$bin" || exit 1
+
+input=$(mktemp)
+trap 'rm -f "$input" "$bin"' EXIT
+
+for size in 10 1000 100000 1000000 10000000; do
+	nr_lines=$((total / size))
+	[ "$nr_lines" -eq 0 ] && nr_lines=1
+	tr '\0' x </dev/zero | fold -w $((size - 1)) | head -n "$nr_lines" >"$input"
+
+	echo "line size $size B"
+	"$bin" reader <"$input"
+	"$bin" legacy <"$input"
+done
@@ -0,0 +1,147 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-3-Clause
+
+# Measure the overhead of mini-shell and of the reference shells (bash and
+# dash, like in tests/_test/run_test.sh), and write the results as JSON.
+#
+# usage: ./run_bench.sh [output.json]
+# SHELLS selects the shells (default "mini-shell bash dash"); BENCH_SCALE
+# multiplies the number of iterations of every benchmark (default 1).
+
+cd "$(dirname "$0")" || exit 1
+
+output=${1:-results.json}
+shells=${SHELLS:-mini-shell bash dash}
+scale=${BENCH_SCALE:-1}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+results=()
+
+# Get the path of the shell given as first argument (empty if missing).
+shell_path() {
+	if [ "$1" = "mini-shell" ]; then
+		[ -x ../src/mini-shell ] && echo ../src/mini-shell
+	else
+		command -v "$1"
+	fi
+}
+
+# Run a command with no output and print the nanoseconds it took.
+elapsed() {
+	local start end
+
+	start=$(date +%s%N)
+	"$@" >/dev/null 2>&1
+	end=$(date +%s%N)
+	echo $((end - start))
+}
+
+# Record a result: shell, benchmark, value, unit.
+record() {
+	printf "%-12s %-20s %14.2f %s\n" "$1" "$2" "$3" "$4"
+	results+=("$(printf '{"shell": "%s", "benchmark": "%s", "value": %.2f, "unit": "%s"}' \
+		"$1" "$2" "$3" "$4")")
+}
+
+# Print count / (ns / 1e9).
+per_sec() {
+	awk -v n="$1" -v ns="$2" 'BEGIN { printf "%.2f", n / (ns / 1e9) }'
+}
+
+# Print ns / 1e3 / count.
+usec_each() {
+	awk -v n="$1" -v ns="$2" 'BEGIN { printf "%.2f", ns / 1e3 / n }'
+}
+
+# Trivial external commands.
+bench_commands() {
+	local n=$((2000 * scale))
+
+	yes /bin/true | head -n "$n" >"$dir/commands"
+	record "$1" commands "$(per_sec "$n" "$(elapsed "$2" "$dir/commands")")" commands/sec
+}
+
+# Latency of every stage of pipelines of 1 to 64 stages.
+bench_pipelines() {
+	local n=$((100 * scale))
+	local stages line
+
+	for stages in 1 2 4 8 16 32 64; do
+		line="/bin/echo x"
+		for _ in $(seq $((stages - 1))); do
+			line="$line | cat"
+		done
+
+		yes "$line" | head -n "$n" >"$dir/pipeline"
+		record "$1" "pipeline_$stages" \
+			"$(usec_each $((n * stages)) "$(elapsed "$2" "$dir/pipeline")")" usec/stage
+	done
+}
+
+# Throughput of parallel chains of 16 jobs.
+bench_fanout() {
+	local n=$((50 * scale))
+	local line="/bin/true"
+
+	for _ in $(seq 15); do
+		line="$line & /bin/true"
+	done
+
+	# the other shells do not wait for the background jobs by themselves
+	[ "$1" != "mini-shell" ] && line="$line; wait"
+
+	yes "$line" | head -n "$n" >"$dir/fanout"
+	record "$1" fanout "$(per_sec $((n * 16)) "$(elapsed "$2" "$dir/fanout")")" jobs/sec
+}
+
+# Parsing of distinct tiny lines and of huge lines.
+bench_parse() {
+	local n=$((100000 * scale))
+	local nr_huge=$((4 * scale))
+
+	seq "$n" | sed 's/.*/VAR=value_&/' >"$dir/tiny"
+	record "$1" parse_tiny "$(per_sec "$n" "$(elapsed "$2" "$dir/tiny")")" lines/sec
+
+	for _ in $(seq "$nr_huge"); do
+		printf 'VAR='
+		head -c $((1024 * 1024)) /dev/zero | tr '\0' x
+		echo
+	done >"$dir/huge"
+	record "$1" parse_huge "$(per_sec "$nr_huge" "$(elapsed "$2" "$dir/huge")")" MB/sec
+}
+
+# Lines read from stdin (read_line for mini-shell).
+bench_read_line() {
+	local n=$((100000 * scale))
+
+	seq "$n" | sed 's/.*/VAR=value_&/' >"$dir/stdin"
+	record "$1" read_line "$(per_sec "$n" "$(elapsed "$2" <"$dir/stdin")")" lines/sec
+}
+
+for shell in $shells; do
+	path=$(shell_path "$shell")
+	if [ -z "$path" ]; then
+		echo "$shell not found, skipped"
+		continue
+	fi
+
+	bench_commands "$shell" "$path"
+	bench_pipelines "$shell" "$path"
+	bench_fanout "$shell" "$path"
+	bench_parse "$shell" "$path"
+	bench_read_line "$shell" "$path"
+done
+
+{
+	echo "["
+	for i in "${!results[@]}"; do
+		sep=","
+		[ "$i" -eq $((${#results[@]} - 1)) ] && sep=""
+		echo "	${results[$i]}$sep"
+	done
+	echo "]"
+} >"$output"
+
+echo "results written to $output"
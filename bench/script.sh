@@ -0,0 +1,39 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-3-Clause
+
+# Measure how many lines per second mini-shell goes through when a
+# generated script is fed on stdin and when it is run in script mode.
+# The lines are variable assignments, which run inside the shell.
+#
+# usage: ./script.sh [nr_lines]
+
+cd "$(dirname "$0")" || exit 1
+
+exec_name=../src/mini-shell
+nr_lines=${1:-1000000}
+
+if ! [ -x "$exec_name" ]; then
+	echo "$exec_name not found! Run make in src/ first"
+	exit 1
+fi
+
+script=$(mktemp)
+trap 'rm -f "$script"' EXIT
+
+seq "$nr_lines" | sed 's/.*/VAR=value_&/' >"$script"
+
+# Print the lines/sec of the mode given as first argument.
+report() {
+	awk -v n="$nr_lines" -v ns="$2" -v m="$1" \
+		'BEGIN { printf "%-8s %10.0f lines/sec\n", m, n / (ns / 1e9) }'
+}
+
+start=$(date +%s%N)
+"$exec_name" <"$script" >/dev/null
+end=$(date +%s%N)
+report stdin $((end - start))
+
+start=$(date +%s%N)
+"$exec_name" "$script" >/dev/null
+end=$(date +%s%N)
+report script $((end - start))
@@ -0,0 +1,45 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-3-Clause
+
+# Measure how many trivial external commands per second mini-shell runs
+# with the fork + exec backend and with the posix_spawn backend.
+#
+# usage: ./spawn.sh [nr_commands]
+# BENCH_ENV_KB inflates the environment of the shell (default 0).
+
+cd "$(dirname "$0")" || exit 1
+
+exec_name=../src/mini-shell
+nr_commands=${1:-2000}
+env_kb=${BENCH_ENV_KB:-0}
+
+if ! [ -x "$exec_name" ]; then
+	echo "$exec_name not found! Run make in src/ first"
+	exit 1
+fi
+
+input=$(mktemp)
+trap 'rm -f "$input"' EXIT
+
+for _ in $(seq "$nr_commands"); do
+	echo "true"
+done >"$input"
+echo "exit" >>"$input"
+
+if [ "$env_kb" -gt 0 ]; then
+	BENCH_FILLER=$(head -c $((env_kb * 1024)) /dev/zero | tr '\0' 'x')
+	export BENCH_FILLER
+fi
+
+# Print the commands/sec for the backend given as first argument.
+run_backend() {
+	local start end
+	start=$(date +%s%N)
+	MINISHELL_SPAWN=$1 "$exec_name" <"$input" >/dev/null
+	end=$(date +%s%N)
+	awk -v n="$nr_commands" -v ns=$((end - start)) -v b="$1" \
+		'BEGIN { printf "%-8s %10.0f commands/sec\n", b, n / (ns / 1e9) }'
+}
+
+run_backend fork
+run_backend spawn
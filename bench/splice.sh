@@ -0,0 +1,42 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-3-Clause
+
+# Measure the MB/s of `cat file | wc -c` and `dd if=file | cat > copy`
+# when the cat stages are started as processes (MINISHELL_SPLICE=no) and
+# when the shell moves the data itself with splice.
+#
+# usage: ./splice.sh [size_mb]
+
+cd "$(dirname "$0")" || exit 1
+
+exec_name=../src/mini-shell
+size_mb=${1:-512}
+
+if ! [ -x "$exec_name" ]; then
+	echo "$exec_name not found! Run make in src/ first"
+	exit 1
+fi
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+head -c "${size_mb}M" /dev/zero >"$dir/in"
+
+# Run the command line given as second argument and print its MB/s.
+run() {
+	local start end
+
+	start=$(date +%s%N)
+	echo "$2" | "$exec_name" >/dev/null
+	end=$(date +%s%N)
+
+	awk -v mb="$size_mb" -v ns=$((end - start)) -v m="$1" \
+		'BEGIN { printf "%-24s %8.0f MB/s\n", m, mb / (ns / 1e9) }'
+}
+
+for mode in no yes; do
+	export MINISHELL_SPLICE=$mode
+
+	run "source splice=$mode" "cat $dir/in | wc -c"
+	run "sink splice=$mode" "dd if=$dir/in bs=1M status=none | cat > $dir/out"
+done
@@ -0,0 +1,713 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "builtin.h"
+#include "cmd.h"
+#include "fdcache.h"
+#include "jobs.h"
+#include "meminfo.h"
+#include "parsecache.h"
+#include "pathcache.h"
+#include "rlimits.h"
+#include "utils.h"
+#include "vars.h"
+
+#define NR_SLOTS		64
+#define MAX_SEED		100000
+
+
+/**
+ * Write all the buffer to fd.
+ * Returns 0 on success, or -1 on failure (e.g. the reader of a pipe is gone).
+ */
+static int write_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t rc = write(fd, buf, len);
+
+		if (rc == -1 && errno == EINTR)
+			continue;
+
+		if (rc == -1)
+			return -1;
+
+		buf += rc;
+		len -= rc;
+	}
+
+	return 0;
+}
+
+/**
+ * Internal exit/quit command.
+ */
+static int builtin_exit(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	return SHELL_EXIT;
+}
+
+/**
+ * Internal change-directory command; without a directory, go to $HOME.
+ */
+static int builtin_cd(int argc, char **argv)
+{
+	const char *dir = (argc > 1) ? argv[1] : vars_get("HOME");
+
+	if (dir == NULL) {
+		fprintf(stderr, "cd: HOME not set\n");
+		return 1;
+	}
+
+	if (chdir(dir) == -1) {
+		fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+		return 1;
+	}
+
+	// the relative paths of the cached files may name other files now
+	fd_cache_flush();
+
+	return 0;
+}
+
+/**
+ * Internal hash command: show (no parameters) or flush (-r) the locations
+ * of the executables found in $PATH, or look the given commands up.
+ */
+static int builtin_hash(int argc, char **argv)
+{
+	if (argc == 1) {
+		path_cache_print();
+		fflush(stdout);
+		return 0;
+	}
+
+	int exit_code = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-r") == 0) {
+			path_cache_flush();
+		} else if (path_lookup(argv[i]) == NULL) {
+			fprintf(stderr, "hash: %s: not found\n", argv[i]);
+			exit_code = 1;
+		}
+	}
+
+	return exit_code;
+}
+
+/**
+ * Internal parsecache command: show the counters of the parse tree cache,
+ * or drop the cached trees (-r).
+ */
+static int builtin_parsecache(int argc, char **argv)
+{
+	if (argc > 1 && strcmp(argv[1], "-r") == 0) {
+		parse_cache_flush();
+		return 0;
+	}
+
+	parse_cache_print();
+	fflush(stdout);
+
+	return 0;
+}
+
+/**
+ * Internal meminfo command: show the memory of the shell and of its buffers.
+ */
+static int builtin_meminfo(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	meminfo_print();
+
+	return 0;
+}
+
+/**
+ * Internal jobs command: show the background jobs.
+ */
+static int builtin_jobs(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	jobs_print();
+
+	return 0;
+}
+
+/**
+ * Internal wait command: wait for all the background jobs, or for the given
+ * ones (%N or pid); the exit status is the one of the last job.
+ */
+static int builtin_wait(int argc, char **argv)
+{
+	if (argc == 1)
+		return jobs_wait(NULL);
+
+	int exit_code = 0;
+
+	for (int i = 1; i < argc; i++)
+		exit_code = jobs_wait(argv[i]);
+
+	return exit_code;
+}
+
+static void print_limit(const struct rlimit_info *info)
+{
+	rlim_t value = rlimits_get(info);
+
+	if (value == RLIM_INFINITY)
+		printf("unlimited\n");
+	else
+		printf("%llu\n", (unsigned long long)value);
+}
+
+/**
+ * Internal ulimit command: show (-a, or an option without a value) or set
+ * (e.g. -t 10, -v unlimited) the resource limits of the commands; without
+ * an option, it is about the file size (like in bash). The sizes are in
+ * kbytes, -c and -f included (bash counts them in 512-byte blocks in POSIX
+ * mode only).
+ */
+static int builtin_ulimit(int argc, char **argv)
+{
+	if (argc > 1 && strcmp(argv[1], "-a") == 0) {
+		int count;
+		const struct rlimit_info *all = rlimits_all(&count);
+
+		for (int i = 0; i < count; i++) {
+			printf("%-28s(-%c) ", all[i].description, all[i].option);
+			print_limit(&all[i]);
+		}
+
+		fflush(stdout);
+		return 0;
+	}
+
+	const struct rlimit_info *info = rlimits_find('f');
+	int next = 1;
+
+	if (argc > 1 && argv[1][0] == '-') {
+		info = (strlen(argv[1]) == 2) ? rlimits_find(argv[1][1]) : NULL;
+		if (info == NULL) {
+			fprintf(stderr, "ulimit: %s: invalid option\n", argv[1]);
+			fprintf(stderr, "ulimit: usage: ulimit [-a | -cdfnstuv] "
+				"[limit | unlimited]\n"
+				"the sizes are in kbytes, -c and -f too (as in bash "
+				"outside POSIX mode)\n");
+			return 2;
+		}
+		next = 2;
+	}
+
+	if (next == argc) {
+		print_limit(info);
+		fflush(stdout);
+		return 0;
+	}
+
+	const char *arg = argv[next];
+	rlim_t value = RLIM_INFINITY;
+
+	if (strcmp(arg, "unlimited") != 0) {
+		char *end;
+
+		errno = 0;
+		value = strtoull(arg, &end, 10);
+		if (*arg < '0' || *arg > '9' || *end != '\0' || errno != 0) {
+			fprintf(stderr, "ulimit: %s: invalid number\n", arg);
+			return 1;
+		}
+	}
+
+	int rc = rlimits_set(info, value);
+
+	if (rc == ERANGE) {
+		fprintf(stderr, "ulimit: %s: limit out of range\n", arg);
+		return 1;
+	}
+
+	if (rc != 0) {
+		fprintf(stderr, "ulimit: %s: cannot modify limit: %s\n",
+			info->description, strerror(rc));
+		return 1;
+	}
+
+	return 0;
+}
+
+static int builtin_true(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	return 0;
+}
+
+static int builtin_false(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	return 1;
+}
+
+/**
+ * Get the number of leading arguments of echo that are options (-n, -e, -E
+ * or several of them, e.g. -ne), like for /bin/echo.
+ */
+static int echo_options(int argc, char **argv, bool *newline, bool *escapes)
+{
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if (arg[0] != '-' || arg[1] == '\0' ||
+			arg[strspn(arg + 1, "neE") + 1] != '\0')
+			break;
+
+		for (arg++; *arg != '\0'; arg++) {
+			if (*arg == 'n')
+				*newline = false;
+			else
+				*escapes = (*arg == 'e');
+		}
+	}
+
+	return i - 1;
+}
+
+/**
+ * Check if the internal echo prints what /bin/echo would: the backslash
+ * sequences of -e and --help / --version are left to it.
+ */
+static bool echo_handles(int argc, char **argv)
+{
+	bool newline = true;
+	bool escapes = false;
+	int first = echo_options(argc, argv, &newline, &escapes) + 1;
+
+	if (argc == 2 && (strcmp(argv[1], "--help") == 0 ||
+		strcmp(argv[1], "--version") == 0))
+		return false;
+
+	for (int i = first; i < argc && escapes; i++) {
+		if (strchr(argv[i], '\\') != NULL)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Internal echo command: print the arguments separated by spaces; -n omits
+ * the trailing newline (-e and -E make no difference without backslashes).
+ */
+static int builtin_echo(int argc, char **argv)
+{
+	bool newline = true;
+	bool escapes = false;
+	int first = echo_options(argc, argv, &newline, &escapes) + 1;
+
+	size_t len = 1;
+
+	for (int i = first; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+
+	// the whole line is written at once, like the external echo does
+	char *line = malloc(len);
+
+	DIE(line == NULL, "malloc failed\n");
+
+	char *end = line;
+
+	for (int i = first; i < argc; i++) {
+		if (i != first)
+			*end++ = ' ';
+
+		size_t arg_len = strlen(argv[i]);
+
+		memcpy(end, argv[i], arg_len);
+		end += arg_len;
+	}
+
+	if (newline)
+		*end++ = '\n';
+
+	int rc = write_all(STDOUT_FILENO, line, end - line);
+
+	free(line);
+
+	return (rc == -1) ? 1 : 0;
+}
+
+/**
+ * Internal pwd command.
+ */
+static int builtin_pwd(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	char *cwd = getcwd(NULL, 0);
+
+	if (cwd == NULL) {
+		fprintf(stderr, "pwd: %s\n", strerror(errno));
+		return 1;
+	}
+
+	size_t len = strlen(cwd);
+
+	cwd[len] = '\n';
+	int rc = write_all(STDOUT_FILENO, cwd, len + 1);
+
+	free(cwd);
+
+	return (rc == -1) ? 1 : 0;
+}
+
+/**
+ * Get the byte a backslash sequence of a printf format stands for, from p
+ * (after the backslash).
+ * Returns the length of the sequence, 0 if the backslash is printed as it
+ * is, or -1 if it is not handled here (e.g. \c or \u).
+ */
+static int format_escape(const char *p, char *c)
+{
+	static const char names[] = "abefnrtv\\\"";
+	static const char bytes[] = "\a\b\033\f\n\r\t\v\\\"";
+	const char *name = (*p != '\0') ? strchr(names, *p) : NULL;
+	int value = 0;
+	int len = 0;
+
+	if (name != NULL) {
+		*c = bytes[name - names];
+		return 1;
+	}
+
+	// \NNN and \xHH
+	if (*p >= '0' && *p <= '7') {
+		while (len < 3 && p[len] >= '0' && p[len] <= '7')
+			value = value * 8 + p[len++] - '0';
+		*c = (char)value;
+		return len;
+	}
+
+	if (*p == 'x') {
+		while (len < 2 && isxdigit((unsigned char)p[len + 1])) {
+			char digit = tolower((unsigned char)p[++len]);
+
+			value = value * 16 +
+				(isdigit(digit) ? digit - '0' : digit - 'a' + 10);
+		}
+		*c = (char)value;
+		return (len == 0) ? -1 : len + 1;
+	}
+
+	if (*p == 'c' || *p == 'u' || *p == 'U')
+		return -1;
+
+	*c = '\\';
+	return 0;
+}
+
+/**
+ * Check if a numeric argument of printf is completely converted (up to
+ * end), like /usr/bin/printf wants; an empty one is 0.
+ */
+static bool is_number(const char *arg, const char *end)
+{
+	// a leading quote gives the code of the character after it
+	if (*arg == '\'' || *arg == '"')
+		return false;
+
+	return *arg == '\0' || (*end == '\0' && errno == 0);
+}
+
+/**
+ * Print a converted value to out, unless the format is only checked (out is
+ * NULL).
+ */
+static void format_value(FILE *out, const char *spec, ...)
+{
+	va_list ap;
+
+	if (out == NULL)
+		return;
+
+	va_start(ap, spec);
+	vfprintf(out, spec, ap);
+	va_end(ap);
+}
+
+/**
+ * Print the format once, taking the values of the conversions from args
+ * (missing values are empty strings or zero); with out NULL, only check
+ * that it prints what /usr/bin/printf would.
+ * Returns the number of used arguments, or -1 if the format or one of the
+ * values are left to /usr/bin/printf (e.g. %b, a width from *, a value that
+ * is not a number).
+ */
+static int format_once(FILE *out, const char *format, int nr_args, char **args)
+{
+	int used = 0;
+
+	for (const char *p = format; *p != '\0'; p++) {
+		if (*p == '\\') {
+			char c;
+			int len = format_escape(p + 1, &c);
+
+			if (len == -1)
+				return -1;
+
+			format_value(out, "%c", c);
+			p += len;
+			continue;
+		}
+
+		if (*p != '%') {
+			format_value(out, "%c", *p);
+			continue;
+		}
+
+		if (p[1] == '%') {
+			format_value(out, "%%");
+			p++;
+			continue;
+		}
+
+		// copy the flags, the width and the precision of the conversion
+		char spec[32] = "%";
+		size_t spec_len = 1;
+
+		while (p[1] != '\0' && strchr("-+ #0123456789.", p[1]) != NULL) {
+			if (spec_len == sizeof(spec) - 4)
+				return -1;
+			spec[spec_len++] = *++p;
+		}
+
+		char conversion = *++p;
+		const char *arg = (used < nr_args) ? args[used] : "";
+		long long value;
+		unsigned long long unsigned_value;
+		long double real_value;
+		char *end;
+
+		errno = 0;
+		switch (conversion) {
+		case 'd':
+		case 'i':
+			strcpy(spec + spec_len, "lld");
+			value = strtoll(arg, &end, 0);
+			if (!is_number(arg, end))
+				return -1;
+			format_value(out, spec, value);
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			spec[spec_len++] = 'l';
+			spec[spec_len++] = 'l';
+			spec[spec_len] = conversion;
+			unsigned_value = strtoull(arg, &end, 0);
+			if (!is_number(arg, end))
+				return -1;
+			format_value(out, spec, unsigned_value);
+			break;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+			// the values are long doubles, like in /usr/bin/printf
+			spec[spec_len++] = 'L';
+			spec[spec_len] = conversion;
+			real_value = strtold(arg, &end);
+			if (!is_number(arg, end))
+				return -1;
+			format_value(out, spec, real_value);
+			break;
+		case 'c':
+			spec[spec_len] = 'c';
+			format_value(out, spec, *arg);
+			break;
+		case 's':
+			spec[spec_len] = 's';
+			format_value(out, spec, arg);
+			break;
+		default:
+			// %b, %q, a width from * or an invalid conversion
+			return -1;
+		}
+
+		if (used < nr_args)
+			used++;
+	}
+
+	return used;
+}
+
+/**
+ * Print the format of printf (argv[1]) with its arguments, or only check it
+ * if out is NULL.
+ * Returns -1 if it is left to /usr/bin/printf (see format_once), or if
+ * some arguments are not used.
+ */
+static int format_all(FILE *out, int argc, char **argv)
+{
+	int next = 2;
+
+	do {
+		int used = format_once(out, argv[1], argc - next, argv + next);
+
+		if (used == -1)
+			return -1;
+
+		// the arguments that are not used are an error
+		if (used == 0)
+			return (next < argc) ? -1 : 0;
+
+		next += used;
+	} while (next < argc);
+
+	return 0;
+}
+
+/**
+ * Check if the internal printf prints what /usr/bin/printf would; its
+ * options, errors and the sequences it does not know are left to it.
+ */
+static bool printf_handles(int argc, char **argv)
+{
+	return argc >= 2 && argv[1][0] != '-' && format_all(NULL, argc, argv) == 0;
+}
+
+/**
+ * Internal printf command: the format is reused while there are arguments
+ * left, like in /usr/bin/printf.
+ */
+static int builtin_printf(int argc, char **argv)
+{
+	char *buf;
+	size_t len;
+	FILE *out = open_memstream(&buf, &len);
+
+	DIE(out == NULL, "open_memstream failed\n");
+
+	format_all(out, argc, argv);
+	fclose(out);
+
+	int rc = write_all(STDOUT_FILENO, buf, len);
+
+	free(buf);
+
+	return (rc == -1) ? 1 : 0;
+}
+
+static const struct builtin builtins[] = {
+	{ .name = "exit", .run = builtin_exit },
+	{ .name = "quit", .run = builtin_exit },
+	{ .name = "cd", .run = builtin_cd },
+	{ .name = "hash", .run = builtin_hash },
+	{ .name = "parsecache", .run = builtin_parsecache },
+	{ .name = "meminfo", .run = builtin_meminfo },
+	{ .name = "ulimit", .run = builtin_ulimit },
+	{ .name = "jobs", .run = builtin_jobs },
+	{ .name = "wait", .run = builtin_wait },
+	{ .name = "true", .run = builtin_true, .pure = true },
+	{ .name = "false", .run = builtin_false, .pure = true },
+	{ .name = "echo", .run = builtin_echo, .pure = true,
+		.handles = echo_handles },
+	{ .name = "pwd", .run = builtin_pwd, .pure = true },
+	{ .name = "printf", .run = builtin_printf, .pure = true,
+		.handles = printf_handles },
+};
+
+#define NR_BUILTINS	(sizeof(builtins) / sizeof(builtins[0]))
+
+/*
+ * Perfect hash of the names of the builtins: the seed is chosen when the
+ * table is first used, so that every name gets a slot of its own and a
+ * lookup is one hash and one strcmp.
+ */
+static const struct builtin *slots[NR_SLOTS];
+static unsigned int hash_seed;
+static bool slots_ready;
+
+
+static unsigned int hash_name(const char *name, unsigned int seed)
+{
+	unsigned int hash = 2166136261u ^ seed;
+
+	while (*name != '\0') {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619u;
+	}
+
+	return hash % NR_SLOTS;
+}
+
+/**
+ * Try to place all the builtins in the slots using seed.
+ * Returns false if two names collide.
+ */
+static bool fill_slots(unsigned int seed)
+{
+	memset(slots, 0, sizeof(slots));
+
+	for (size_t i = 0; i < NR_BUILTINS; i++) {
+		unsigned int slot = hash_name(builtins[i].name, seed);
+
+		if (slots[slot] != NULL)
+			return false;
+
+		slots[slot] = &builtins[i];
+	}
+
+	return true;
+}
+
+static void init_slots(void)
+{
+	unsigned int seed = 0;
+
+	while (!fill_slots(seed)) {
+		seed++;
+		DIE(seed == MAX_SEED, "no perfect hash for the builtins\n");
+	}
+
+	hash_seed = seed;
+	slots_ready = true;
+}
+
+const struct builtin *builtin_lookup(word_t *verb)
+{
+	// a verb made of several parts or of a variable is not a name
+	if (verb->next_part != NULL || verb->expand == true)
+		return NULL;
+
+	if (!slots_ready)
+		init_slots();
+
+	const struct builtin *b = slots[hash_name(verb->string, hash_seed)];
+
+	if (b == NULL || strcmp(b->name, verb->string) != 0)
+		return NULL;
+
+	return b;
+}
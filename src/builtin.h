@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _BUILTIN_H
+#define _BUILTIN_H
+
+#include "../util/parser/parser.h"
+
+/*
+ * Internal commands: they run in the process of the shell, with argv built
+ * like for an external command; the exit code is returned.
+ */
+struct builtin {
+	const char *name;
+	int (*run)(int argc, char **argv);
+
+	// has no side effects on the shell, so it does not need a process of
+	// its own, even as a stage of a pipeline or a parallel job
+	bool pure;
+
+	// checks if the internal command does what the external one with the
+	// same name would for these arguments (NULL if it always does); the
+	// external one runs instead when it does not
+	bool (*handles)(int argc, char **argv);
+};
+
+/**
+ * Find the internal command a verb names.
+ * Returns NULL if the verb is not the name of an internal command.
+ */
+const struct builtin *builtin_lookup(word_t *verb);
+
+#endif /* _BUILTIN_H */
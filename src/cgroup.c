@@ -0,0 +1,264 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cgroup.h"
+#include "stats.h"
+#include "utils.h"
+#include "vars.h"
+
+#define MAX_NAME		64
+#define MAX_STAT		4096
+
+struct cgroup {
+	enum cgroup_kind kind;
+	char name[MAX_NAME];
+	char *parent;
+	int parent_fd;
+	int fd;			/* -1 until the directory is created */
+	bool failed;
+};
+
+/* A limit of the leaves, and the controller it belongs to. */
+struct cgroup_setting {
+	const char *variable;
+	const char *file;
+	const char *controller;
+};
+
+static const struct cgroup_setting settings[] = {
+	{ "MINISHELL_CGROUP_CPU_MAX", "cpu.max", "cpu" },
+	{ "MINISHELL_CGROUP_MEMORY_MAX", "memory.max", "memory" },
+	{ "MINISHELL_CGROUP_CPUS", "cpuset.cpus", "cpuset" },
+};
+
+#define NR_SETTINGS	(sizeof(settings) / sizeof(settings[0]))
+
+static const char * const kind_names[] = {
+	[CGROUP_LINE] = "line",
+	[CGROUP_JOB] = "job",
+	[CGROUP_BRANCH] = "branch",
+};
+
+// the leaf the children are created in
+static struct cgroup *current;
+static unsigned int nr_leaves;
+
+
+struct cgroup *cgroup_create(enum cgroup_kind kind)
+{
+	const char *parent = vars_get("MINISHELL_CGROUP");
+
+	if (parent == NULL || *parent == '\0')
+		return NULL;
+
+	if (kind == CGROUP_BRANCH) {
+		const char *scope = vars_get("MINISHELL_CGROUP_SCOPE");
+
+		if (scope == NULL || strcmp(scope, "branch") != 0)
+			return NULL;
+	}
+
+	struct cgroup *cg = malloc(sizeof(*cg));
+
+	DIE(cg == NULL, "malloc failed\n");
+
+	cg->kind = kind;
+	snprintf(cg->name, sizeof(cg->name), "mini-shell-%d-%u", getpid(),
+		++nr_leaves);
+	cg->parent = strdup(parent);
+	DIE(cg->parent == NULL, "strdup failed\n");
+	cg->parent_fd = -1;
+	cg->fd = -1;
+	cg->failed = false;
+
+	return cg;
+}
+
+struct cgroup *cgroup_enter(struct cgroup *cg)
+{
+	struct cgroup *prev = current;
+
+	if (cg != NULL)
+		current = cg;
+
+	return prev;
+}
+
+void cgroup_leave(struct cgroup *prev)
+{
+	current = prev;
+}
+
+static int write_file(int dir_fd, const char *file, const char *value)
+{
+	int fd = openat(dir_fd, file, O_WRONLY | O_CLOEXEC);
+
+	if (fd == -1)
+		return -1;
+
+	ssize_t rc = write(fd, value, strlen(value));
+	int err = errno;
+
+	close(fd);
+	errno = err;
+
+	return (rc == -1) ? -1 : 0;
+}
+
+/**
+ * Read a (small) file of a cgroup into buf.
+ * Returns 0 on success, or -1 if it cannot be read.
+ */
+static int read_file(int dir_fd, const char *file, char *buf, size_t size)
+{
+	int fd = openat(dir_fd, file, O_RDONLY | O_CLOEXEC);
+
+	if (fd == -1)
+		return -1;
+
+	ssize_t len = read(fd, buf, size - 1);
+
+	close(fd);
+	if (len == -1)
+		return -1;
+
+	buf[len] = '\0';
+
+	return 0;
+}
+
+/**
+ * Get the value of a key of a flat keyed file (e.g. usage_usec of cpu.stat),
+ * or -1 if it is not there.
+ */
+static long long keyed_value(const char *buf, const char *key)
+{
+	size_t key_len = strlen(key);
+
+	for (const char *line = buf; *line != '\0';) {
+		if (strncmp(line, key, key_len) == 0 && line[key_len] == ' ')
+			return strtoll(line + key_len + 1, NULL, 10);
+
+		const char *end = strchr(line, '\n');
+
+		if (end == NULL)
+			break;
+
+		line = end + 1;
+	}
+
+	return -1;
+}
+
+static void apply_setting(struct cgroup *cg, const struct cgroup_setting *s)
+{
+	const char *value = vars_get(s->variable);
+
+	if (value == NULL || write_file(cg->fd, s->file, value) == 0)
+		return;
+
+	// the file of the limit only exists if the controller is enabled for
+	// the children of the parent
+	char enable[32];
+
+	snprintf(enable, sizeof(enable), "+%s", s->controller);
+	if (errno == ENOENT &&
+			write_file(cg->parent_fd, "cgroup.subtree_control", enable) == 0 &&
+			write_file(cg->fd, s->file, value) == 0)
+		return;
+
+	fprintf(stderr, "cgroup: %s: %s\n", s->file, strerror(errno));
+}
+
+/**
+ * Create the directory of a leaf and set its limits.
+ */
+static void setup_leaf(struct cgroup *cg)
+{
+	cg->parent_fd = open(cg->parent, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (cg->parent_fd == -1 || mkdirat(cg->parent_fd, cg->name, 0755) == -1) {
+		fprintf(stderr, "cgroup: %s: %s\n", cg->parent, strerror(errno));
+		cg->failed = true;
+		return;
+	}
+
+	cg->fd = openat(cg->parent_fd, cg->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	DIE(cg->fd == -1, "openat failed\n");
+
+	for (size_t i = 0; i < NR_SETTINGS; i++)
+		apply_setting(cg, &settings[i]);
+}
+
+int cgroup_fd(void)
+{
+	if (current == NULL || current->failed)
+		return -1;
+
+	if (current->fd == -1)
+		setup_leaf(current);
+
+	return current->fd;
+}
+
+void cgroup_join(void)
+{
+	DIE(write_file(current->fd, "cgroup.procs", "0") == -1,
+		"cgroup.procs write failed\n");
+}
+
+/**
+ * Report what the processes of a leaf used.
+ */
+static void report_usage(struct cgroup *cg)
+{
+	struct cgroup_usage usage;
+	char buf[MAX_STAT];
+
+	if (read_file(cg->fd, "cpu.stat", buf, sizeof(buf)) == -1)
+		buf[0] = '\0';
+
+	usage.usage_us = keyed_value(buf, "usage_usec");
+	usage.user_us = keyed_value(buf, "user_usec");
+	usage.sys_us = keyed_value(buf, "system_usec");
+
+	// the memory files only exist with the memory controller
+	usage.memory_peak = -1;
+	if (read_file(cg->fd, "memory.peak", buf, sizeof(buf)) == 0)
+		usage.memory_peak = strtoll(buf, NULL, 10);
+
+	if (read_file(cg->fd, "memory.events", buf, sizeof(buf)) == -1)
+		buf[0] = '\0';
+
+	usage.oom_kills = keyed_value(buf, "oom_kill");
+
+	stats_cgroup(cg->name, kind_names[cg->kind], &usage);
+}
+
+void cgroup_release(struct cgroup *cg)
+{
+	if (cg == NULL)
+		return;
+
+	if (cg->fd != -1) {
+		if (stats_fd != -1)
+			report_usage(cg);
+
+		// a process that outlived its command (e.g. a daemon) keeps
+		// the leaf busy; it is left behind then
+		close(cg->fd);
+		unlinkat(cg->parent_fd, cg->name, AT_REMOVEDIR);
+	}
+
+	if (cg->parent_fd != -1)
+		close(cg->parent_fd);
+
+	free(cg->parent);
+	free(cg);
+}
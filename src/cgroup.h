@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _CGROUP_H
+#define _CGROUP_H
+
+/*
+ * cgroup v2 placement of the commands: when MINISHELL_CGROUP names a cgroup
+ * v2 directory the shell may write to (e.g. a delegated subtree with no
+ * processes of its own), every command line and every background job runs
+ * in a leaf cgroup created under it; with MINISHELL_CGROUP_SCOPE=branch,
+ * every job of a parallel chain gets a leaf of its own too.
+ *
+ * The children are created straight in their leaf (clone3 with
+ * CLONE_INTO_CGROUP), so they never run outside it. The leaves get the
+ * limits given by
+ *	MINISHELL_CGROUP_CPU_MAX	cpu.max, e.g. "50000 100000"
+ *	MINISHELL_CGROUP_MEMORY_MAX	memory.max, e.g. 512M
+ *	MINISHELL_CGROUP_CPUS		cpuset.cpus, e.g. 0-3
+ * and what their processes used is reported as a "cgroup" event of the
+ * statistics (MINISHELL_STATS) when they are released.
+ */
+
+enum cgroup_kind {
+	CGROUP_LINE,		/* the commands of a command line */
+	CGROUP_JOB,		/* a background job */
+	CGROUP_BRANCH,		/* a job of a parallel chain */
+};
+
+struct cgroup;
+
+/**
+ * Get a new leaf for commands; the directory is only created when the
+ * first child is. Returns NULL if the commands of this kind are not placed
+ * in cgroups of their own.
+ */
+struct cgroup *cgroup_create(enum cgroup_kind kind);
+
+/**
+ * Create the next children in cg (nothing changes if it is NULL).
+ * Returns the leaf they were created in before, to be given to
+ * cgroup_leave.
+ */
+struct cgroup *cgroup_enter(struct cgroup *cg);
+
+void cgroup_leave(struct cgroup *prev);
+
+/**
+ * Get the descriptor of the leaf the children are created in, or -1 if they
+ * stay in the cgroup of the shell (or the leaf could not be created; the
+ * error is reported).
+ */
+int cgroup_fd(void);
+
+/**
+ * Move the current (child) process to the leaf, when it could not be
+ * created in it.
+ */
+void cgroup_join(void);
+
+/**
+ * Report what the processes of a leaf used and remove it (NULL is ignored);
+ * they must have terminated.
+ */
+void cgroup_release(struct cgroup *cg);
+
+#endif /* _CGROUP_H */
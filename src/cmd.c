@@ -1,250 +1,406 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#define _GNU_SOURCE
+
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
+#include <errno.h>
+#include <signal.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
 
+#include "builtin.h"
+#include "cgroup.h"
 #include "cmd.h"
+#include "jobs.h"
+#include "launch.h"
+#include "pathcache.h"
+#include "placement.h"
+#include "plan.h"
+#include "reaper.h"
+#include "rlimits.h"
+#include "stats.h"
+#include "trace.h"
 #include "utils.h"
+#include "vars.h"
+#include "zerocopy.h"
 
 #define READ		0
 #define WRITE		1
 
 
-void redirect_input(word_t *in)
+/**
+ * Install the files of the redirections of a simple command, opened by the
+ * shell (see plan_open_redirects), in the current (child) process.
+ */
+static void perform_redirections(const plan_node_t *n, const int *fds)
 {
-	// get filename
-	char *filename = get_word(in);
-
-	// open the file
-	int fd = open(filename, O_RDONLY);
-
-	// check if the file was opened successfully
-	DIE(fd == -1, "error opening file\n");
+	for (int i = 0; i < n->nr_redirects; i++) {
+		DIE(dup2(fds[i], n->redirects[i].fd) == -1, "dup2 failed\n");
+		close(fds[i]);
+	}
+}
 
-	// we don't need the filename anymore, so we can free the memory
-	free(filename);
+/**
+ * Perform a redirection in the shell, saving the previous descriptor in
+ * saved[r->fd] (if not already saved).
+ * Returns 0 on success, or -1 if the file could not be opened.
+ */
+static int redirect_in_shell(const struct plan_redirect *r, int *saved)
+{
+	int fd = plan_open_redirect(r);
 
-	// redirect stdin to the file
-	int rc = dup2(fd, STDIN_FILENO);
+	if (fd == -1)
+		return -1;
 
-	// check if the redirection was successful
-	DIE(rc == -1, "dup2 failed\n");
+	if (saved[r->fd] == -1) {
+		saved[r->fd] = fcntl(r->fd, F_DUPFD_CLOEXEC, 10);
+		DIE(saved[r->fd] == -1, "fcntl failed\n");
+	}
 
-	// close the file
-	rc = close(fd);
+	DIE(dup2(fd, r->fd) == -1, "dup2 failed\n");
+	close(fd);
 
-	fflush(stdin);
+	return 0;
 }
 
-static void redirect_output(word_t *out, int io_flags)
+/**
+ * Put back the standard descriptors saved by redirect_in_shell.
+ */
+static void restore_redirections(int *saved)
 {
-	// get filename
-	char *filename = get_word(out);
-
-	// identify the mode in which we have to open the file
-	int fd;
-
-	if (io_flags == IO_OUT_APPEND) {
-		// open the file in append mode
-		fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
-	} else {
-		// open file in regular mode (no append)
-		fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-	}
-
-	// check if the file was opened successfully
-	DIE(fd == -1, "error opening file\n");
-
-	// we don't need the filename anymore, so we can free the memory
-	free(filename);
+	fflush(stdout);
+	fflush(stderr);
 
-	// redirect stdout to the file
-	int rc = dup2(fd, STDOUT_FILENO);
+	for (int fd = STDIN_FILENO; fd <= STDERR_FILENO; fd++) {
+		if (saved[fd] == -1)
+			continue;
 
-	// check if the redirection was successful
-	DIE(rc == -1, "dup2 failed\n");
+		DIE(dup2(saved[fd], fd) == -1, "dup2 failed\n");
+		close(saved[fd]);
+		saved[fd] = -1;
+	}
+}
 
-	// close the file
-	rc = close(fd);
-	fflush(stdout);
+/**
+ * Check if a node is an internal command that can run in the shell even
+ * where a process of its own would otherwise be created for it.
+ */
+static bool is_pure_builtin(const plan_node_t *n)
+{
+	return n->op == PLAN_SIMPLE && n->kind == SIMPLE_BUILTIN &&
+		n->builtin->pure && !n->timed;
 }
 
-static void redirect_error(word_t *err, int io_flags)
+/**
+ * Put a new child in the process group pgid (a new one if it is 0, the one
+ * of the shell if it is -1); both the child and the shell do it, so that the
+ * group exists before either of them goes on.
+ */
+static void join_group(pid_t pid, pid_t pgid)
 {
-	// get filename
-	char *filename = get_word(err);
-
-	// identify the mode in which we have to open the file
-	int fd;
-
-	if (io_flags == IO_ERR_APPEND) {
-		// open the file in append mode
-		fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
-	} else {
-		// open file in regular mode (no append)
-		fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-	}
+	if (pgid != -1)
+		setpgid(pid, pgid);
+}
 
-	// check if the file was opened successfully
-	DIE(fd == -1, "error opening file\n");
+/* The context of fork_file: what the child installs before the exec. */
+struct fork_context {
+	const plan_node_t *n;
+	const int *fds;		/* the files of the redirections of n */
+	int in_fd;
+	int out_fd;
+	int close_fd;
+	pid_t pgid;
+};
 
-	// we don't need the filename anymore, so we can free the memory
-	free(filename);
+/**
+ * Fork a child that loads the executable at path (see launch_fn); arg is a
+ * struct fork_context. The child reports a failed exec through a pipe that
+ * the exec closes, so that the shell, which found path, can tell.
+ */
+static int fork_file(pid_t *pid, const char *path, char **argv, void *arg)
+{
+	struct fork_context *ctx = arg;
+	int errors[2];
 
-	// redirect stderr to the file
-	int rc = dup2(fd, STDERR_FILENO);
+	DIE(pipe2(errors, O_CLOEXEC) == -1, "pipe2 failed\n");
 
-	// check if the redirection was successful
-	DIE(rc == -1, "dup2 failed\n");
+	*pid = reaper_fork();
 
-	// close the file
-	rc = close(fd);
-	fflush(stderr);
-}
+	//  check if we are in the child process
+	if (*pid == 0) {
+		join_group(0, ctx->pgid);
+		placement_apply();
+
+		// read the input from the previous stage, instead of stdin
+		if (ctx->in_fd != -1) {
+			DIE(dup2(ctx->in_fd, STDIN_FILENO) == -1, "dup2 failed\n");
+			close(ctx->in_fd);
+		}
 
-static void redirect_both_out_and_err(simple_command_t *s)
-{
-	// get filename for stdout
-	char *filename_out = get_word(s->out);
+		// write the output to the next stage, instead of stdout
+		if (ctx->out_fd != -1) {
+			DIE(dup2(ctx->out_fd, STDOUT_FILENO) == -1, "dup2 failed\n");
+			close(ctx->out_fd);
+		}
 
-	// open the output file in append mode
-	int fd_out = open(filename_out, O_WRONLY | O_CREAT | O_APPEND, 0644);
-	// check if the file was opened successfully
-	DIE(fd_out == -1, "failed to open output file\n");
+		if (ctx->close_fd != -1)
+			close(ctx->close_fd);
 
-	// we don't need the filename anymore, so we can free the memory
-	free(filename_out);
+		//2c. Perform redirections in child
+		perform_redirections(ctx->n, ctx->fds);
+		rlimits_apply();
 
+		// 3c. Load executable in child
+		exec_file(path, argv);
 
-	// get filename for stderr
-	char *filename_err = get_word(s->err);
+		int err = errno;
 
-	// open the error file
-	int fd_err = open(filename_err, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-	// check if the file was opened successfully
-	DIE(fd_err == -1, "failed to open error file\n");
+		DIE(write(errors[WRITE], &err, sizeof(err)) == -1, "write failed\n");
+		_exit(EXIT_NOT_EXECUTABLE);
+	}
 
-	// we don't need the filename anymore, so we can free the memory
-	free(filename_err);
+	close(errors[WRITE]);
 
-	// redirect stdout and stderr to the files
-	int rc_out = dup2(fd_out, STDOUT_FILENO);
-	// check if the output redirection was successful
-	DIE(rc_out == -1, "dup2 failed\n");
+	int err = 0;
+	ssize_t rc;
 
-	int rc_err = dup2(fd_err, STDERR_FILENO);
-	// check if the error redirection was successful
-	DIE(rc_err == -1, "dup2 failed\n");
+	do {
+		rc = read(errors[READ], &err, sizeof(err));
+	} while (rc == -1 && errno == EINTR);
 
-	// close files and free memory
-	close(fd_out);
-	close(fd_err);
+	close(errors[READ]);
 
-	fflush(stdout);
-	fflush(stderr);
-}
+	// the child is not tracked yet, it is collected right here
+	if (*pid != -1 && rc == sizeof(err)) {
+		while (waitpid(*pid, NULL, 0) == -1 && errno == EINTR)
+			;
+		*pid = -1;
+		return err;
+	}
 
+	return 0;
+}
 
-static void perform_redirections(simple_command_t *s)
+/**
+ * Start the external command of a plan node in a forked child, like
+ * spawn_external_command does with posix_spawn (see launch.h): the files of
+ * the redirections are opened and the executable is found by the shell, the
+ * child only installs them.
+ * Returns the pid of the command, or -1 if it could not be started; in that
+ * case *status is set, unless the fork failed.
+ */
+static pid_t fork_external_command(const plan_node_t *n, int in_fd, int out_fd,
+		int close_fd, pid_t pgid, int *status)
 {
-	if (s->in != NULL)
-		redirect_input(s->in);
-
-	if (s->out != NULL) {
-		if (s->err == NULL) {
-			// only redirect output
-			redirect_output(s->out, s->io_flags);
-			return;
-		}
+	int fds[MAX_REDIRECTIONS];
 
-		//if we are here, it means that we have to redirect both stdout and stderr
-		redirect_both_out_and_err(s);
-		return;
+	if (plan_open_redirects(n, fds) == -1) {
+		*status = EXIT_FAILURE;
+		return -1;
 	}
 
-	if (s->err != NULL) {
-		// we only need to redirect error
-		redirect_error(s->err, s->io_flags);
-		return;
+	struct fork_context ctx = {
+		.n = n,
+		.fds = fds,
+		.in_fd = in_fd,
+		.out_fd = out_fd,
+		.close_fd = close_fd,
+		.pgid = pgid,
+	};
+	char **argv = plan_get_argv(n);
+	pid_t pid = -1;
+	int rc = launch_path(&pid, argv, fork_file, &ctx);
+
+	if (rc != 0) {
+		errno = rc;
+		*status = exec_failed(n, fds, argv[0]);
 	}
+
+	plan_put_argv(n, argv);
+
+	for (int i = 0; i < n->nr_redirects; i++)
+		close(fds[i]);
+
+	if (pid != -1)
+		join_group(pid, pgid);
+
+	return pid;
 }
 
 /**
- * Internal change-directory command.
+ * Give the terminal to the process group of a command with a timeout, which
+ * runs in the foreground in a group of its own, if the shell has it (e.g. so
+ * that the command can read it and gets Ctrl-C).
+ * Returns true if take_terminal must be called when the command is done.
  */
-static bool shell_cd(word_t *dir)
+static bool give_terminal(pid_t pgid)
 {
-	// get the directory name
-	char *dir_name = get_word(dir);
+	if (!isatty(STDIN_FILENO) || tcgetpgrp(STDIN_FILENO) != getpgrp())
+		return false;
+
+	if (tcsetpgrp(STDIN_FILENO, pgid) == -1)
+		return false;
 
-	// execute the cd command
-	int return_value = chdir(dir_name);
+	// it may have been stopped by reading the terminal before it had it
+	kill(-pgid, SIGCONT);
 
-	free(dir_name);
-	return return_value;
+	return true;
 }
 
-static bool complete_cd_command(simple_command_t *s)
+/**
+ * Take the terminal back from the group of a command (see give_terminal).
+ */
+static void take_terminal(void)
 {
-	perform_redirections(s);
-
-	return shell_cd(s->params);
+	// the shell is in the background until then, so it would get SIGTTOU
+	sigset_t ttou;
+	sigset_t old;
+
+	sigemptyset(&ttou);
+	sigaddset(&ttou, SIGTTOU);
+	sigprocmask(SIG_BLOCK, &ttou, &old);
+	tcsetpgrp(STDIN_FILENO, getpgrp());
+	sigprocmask(SIG_SETMASK, &old, NULL);
 }
 
 /**
- * Internal exit/quit command.
+ * Start tracking a child that runs n; a command with a timeout is in a
+ * process group of its own, killed when the time is up.
  */
-static int shell_exit(void)
+static void track_command(pid_t pid, const plan_node_t *n, long long start)
 {
-	return SHELL_EXIT;
+	reaper_track(pid, reaper_new_group(), n->scmd->verb->string);
+
+	if (n->timeout_ns != 0)
+		reaper_deadline(pid, pid, start + n->timeout_ns);
 }
 
-static int execute_external_command(simple_command_t *s)
+/**
+ * Run the external command with the name of an internal one, which does not
+ * handle its arguments (see struct builtin), with its output to out_fd if it
+ * is not -1.
+ */
+static int run_builtin_externally(const plan_node_t *n, int out_fd)
 {
-	pid_t pid = fork();
+	long long start = stats_now();
+	int status = EXIT_FAILURE;
+	pid_t pid = fork_external_command(n, -1, out_fd, -1, -1, &status);
 
-	// check if the fork failed
 	if (pid == -1)
-		return 0;
+		return status;
 
-	//  check if we are in the child process
-	if (pid == 0) {
-		//2c. Perform redirections in child
-		perform_redirections(s);
+	track_command(pid, n, start);
 
-		// 3c. Load executable in child
-		int argc;
-		char **argv = get_argv(s, &argc);
+	return WEXITSTATUS(reaper_wait(pid));
+}
 
-		if (execvp(argv[0], argv) == -1) {
-			// execution failed
-			exit(0);
-		}
+/**
+ * Run an internal command in the shell, writing to out_fd (-1 for the
+ * standard output of the shell); the redirections of the command only last
+ * while it runs.
+ */
+static int run_builtin(const plan_node_t *n, int out_fd)
+{
+	int saved[3] = {-1, -1, -1};
+	int rc = 0;
+	char **argv = plan_get_argv(n);
+	int argc = 0;
+
+	while (argv[argc] != NULL)
+		argc++;
+
+	// before the redirections, which the external command performs again
+	if (n->builtin->handles != NULL && !n->builtin->handles(argc, argv)) {
+		plan_put_argv(n, argv);
+		return run_builtin_externally(n, out_fd);
+	}
 
-		// free memory
-		for (int i = 0; i < argc; i++)
-			free(argv[i]);
+	if (out_fd != -1) {
+		saved[STDOUT_FILENO] = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+		DIE(saved[STDOUT_FILENO] == -1, "fcntl failed\n");
+		DIE(dup2(out_fd, STDOUT_FILENO) == -1, "dup2 failed\n");
+	}
 
-		free(argv);
+	for (int i = 0; i < n->nr_redirects && rc == 0; i++)
+		rc = redirect_in_shell(&n->redirects[i], saved);
 
-	} else {
-		// we are in the parent process
+	int exit_code = EXIT_FAILURE;
 
-		// 2. Wait for child
-		int status;
+	if (rc == 0) {
+		// a reader that went away must not kill the shell; the
+		// builtin just gets EPIPE
+		struct sigaction ignore = { .sa_handler = SIG_IGN };
+		struct sigaction old;
+
+		sigaction(SIGPIPE, &ignore, &old);
+		exit_code = n->builtin->run(argc, argv);
+		sigaction(SIGPIPE, &old, NULL);
+	}
 
-		waitpid(pid, &status, 0);
+	plan_put_argv(n, argv);
+	restore_redirections(saved);
+
+	return exit_code;
+}
+
+static int execute_external_command(const plan_node_t *n)
+{
+	pid_t pgid = (n->timeout_ns != 0) ? 0 : -1;
+	long long start = stats_now();
+	int status;
+
+	// fast path: no shell logic is needed in the child, so the command
+	// can be started without duplicating the shell
+	if (spawn_is_possible(n->scmd)) {
+		TRACE_BEGIN("spawn");
+		pid_t pid = spawn_external_command(n, -1, -1, -1, pgid, &status);
+
+		TRACE_END("spawn");
+		stats_add(STATS_SPAWN, start);
+		if (pid == -1)
+			return status;
+
+		track_command(pid, n, start);
+
+		bool terminal = (pgid == 0) && give_terminal(pid);
+
+		status = reaper_wait(pid);
+		if (terminal)
+			take_terminal();
 
-		// 3. Return exit status
 		return WEXITSTATUS(status);
 	}
-	return 0;
+
+	TRACE_BEGIN("fork");
+	status = -1;
+	pid_t pid = fork_external_command(n, -1, -1, -1, pgid, &status);
+
+	TRACE_END("fork");
+
+	// check if the fork failed
+	if (pid == -1)
+		return (status == -1) ? 0 : status;
+
+	stats_add(STATS_SPAWN, start);
+
+	// 2. Wait for child
+	track_command(pid, n, start);
+
+	bool terminal = (pgid == 0) && give_terminal(pid);
+
+	status = reaper_wait(pid);
+	if (terminal)
+		take_terminal();
+
+	// 3. Return exit status
+	return WEXITSTATUS(status);
 }
 
 static int assign_environment_variable(simple_command_t *s)
@@ -257,246 +413,738 @@ static int assign_environment_variable(simple_command_t *s)
 	const char *var_name = s->verb->string;
 	char *var_value = get_word(s->verb->next_part->next_part);
 
-	int return_value = setenv(var_name, var_value, 1);
+	vars_set(var_name, var_value);
+
+	// the cached locations of the executables depend on PATH
+	if (strcmp(var_name, "PATH") == 0)
+		path_cache_flush();
 
 	free(var_value);
-	return return_value;
+	return 0;
 }
 
 
 /**
- * Parse a simple command (internal, environment variable assignment,
+ * Run a simple command (internal, environment variable assignment,
  * external command).
  */
-static int parse_simple(simple_command_t *s, int level, command_t *father)
+static int run_simple(const plan_node_t *n)
 {
-	/* TODO: Sanity checks. */
-	if (!s)
-		return 0;
+	switch (n->kind) {
+	case SIMPLE_BUILTIN:
+		return run_builtin(n, -1);
 
-	// check if the command is builtin
-	if (strcmp(s->verb->string, "exit") == 0)
-		return shell_exit();
+	case SIMPLE_ASSIGNMENT:
+		return assign_environment_variable(n->scmd);
 
-	if (strcmp(s->verb->string, "quit") == 0)
-		return shell_exit();
+	default:
+		return execute_external_command(n);
+	}
+}
 
-	if (strcmp(s->verb->string, "cd") == 0)
-		return complete_cd_command(s);
+static double timeval_seconds(struct timeval tv)
+{
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void print_time(const char *label, double seconds)
+{
+	int minutes = (int)(seconds / 60);
 
-	// check if the command is an environment variable assignment
-	if (s->verb->next_part != NULL) {
-		return assign_environment_variable(s);
+	fprintf(stderr, "%s\t%dm%.3fs\n", label, minutes, seconds - minutes * 60);
+}
+
+/**
+ * Run a simple command prefixed by time and report, like bash, the elapsed
+ * time and the processor time used by the shell and its children meanwhile.
+ */
+static int run_timed(const plan_node_t *n)
+{
+	struct rusage self[2], children[2];
+	long long start = stats_now();
+
+	getrusage(RUSAGE_SELF, &self[0]);
+	getrusage(RUSAGE_CHILDREN, &children[0]);
+
+	int exit_code = run_simple(n);
+
+	getrusage(RUSAGE_SELF, &self[1]);
+	getrusage(RUSAGE_CHILDREN, &children[1]);
+
+	double user = timeval_seconds(self[1].ru_utime) -
+		timeval_seconds(self[0].ru_utime) +
+		timeval_seconds(children[1].ru_utime) -
+		timeval_seconds(children[0].ru_utime);
+	double sys = timeval_seconds(self[1].ru_stime) -
+		timeval_seconds(self[0].ru_stime) +
+		timeval_seconds(children[1].ru_stime) -
+		timeval_seconds(children[0].ru_stime);
+
+	fputc('\n', stderr);
+	print_time("real", (stats_now() - start) / 1e9);
+	print_time("user", user);
+	print_time("sys", sys);
+
+	return exit_code;
+}
+
+static int run_plan(plan_t *plan, int begin, int end);
+
+/**
+ * Check if the nodes between begin and end are a single external command
+ * (that is not timed).
+ */
+static bool is_external_command(plan_t *plan, int begin, int end)
+{
+	plan_node_t *n = &plan->nodes[begin];
+
+	return end == begin + 1 && n->op == PLAN_SIMPLE &&
+		n->kind == SIMPLE_EXTERNAL && !n->timed;
+}
+
+/**
+ * Get the name of the first command between begin and end, which names the
+ * process that runs them in the statistics.
+ */
+static const char *command_name(plan_t *plan, int begin, int end)
+{
+	for (int i = begin; i < end; i++) {
+		if (plan->nodes[i].op == PLAN_SIMPLE)
+			return plan->nodes[i].scmd->verb->string;
 	}
 
-	/* TODO: If external command:
-	 *   1. Fork new process
-	 *     2c. Perform redirections in child
-	 *     3c. Load executable in child
-	 *   2. Wait for child
-	 *   3. Return exit status
-	 */
+	return "";
+}
+
+/**
+ * Get the timeout of the part of a plan between begin and end, if it is a
+ * single simple command (0 if there is none).
+ */
+static long long command_timeout(plan_t *plan, int begin, int end)
+{
+	plan_node_t *n = &plan->nodes[begin];
 
-	// if we reached this point, it means that this is an external command
-	return execute_external_command(s);
+	return (end == begin + 1 && n->op == PLAN_SIMPLE) ? n->timeout_ns : 0;
 }
 
 /**
- * Process two commands in parallel, by creating two children.
+ * Start the part of a plan between begin and end in a new process, reading
+ * from in_fd and writing to out_fd (-1 for the standard input and output of
+ * the shell); unused_fd is the other end of the pipe the command writes to
+ * (-1 if there is none).
+ * The command joins the process group pgid (see join_group) and is tracked
+ * as a member of group.
+ * Returns the pid of the command, or -1 if it could not be started; *status
+ * is set if the command was considered terminated without being started.
  */
-static bool run_in_parallel(command_t *cmd1, command_t *cmd2, int level,
-		command_t *father)
+static pid_t start_command(plan_t *plan, int begin, int end, int in_fd,
+		int out_fd, int unused_fd, pid_t pgid, int group, int *status)
 {
-	// the logic is similar to the one used in the run_on_pipe function,
-	// but the commands are executed independently, not in pipe
+	plan_node_t *n = &plan->nodes[begin];
+	const char *name = command_name(plan, begin, end);
+	long long start = stats_now();
+	pid_t pid;
+
+	if (is_external_command(plan, begin, end)) {
+		if (spawn_is_possible(n->scmd)) {
+			TRACE_BEGIN("spawn");
+			pid = spawn_external_command(n, in_fd, out_fd, unused_fd,
+					pgid, status);
+			TRACE_END("spawn");
+		} else {
+			TRACE_BEGIN("fork");
+			pid = fork_external_command(n, in_fd, out_fd, unused_fd,
+					pgid, status);
+			TRACE_END("fork");
+		}
 
-	// fork the first process
-	pid_t first_pid = fork();
+		stats_add(STATS_SPAWN, start);
+		if (pid != -1)
+			reaper_track(pid, group, name);
 
-	// check if the fork failed
-	if (first_pid == -1)
-		return false;
+		return pid;
+	}
+
+	TRACE_BEGIN("fork");
+	pid = reaper_fork();
 
 	//  check if we are in the child process
-	if (first_pid == 0) {
-		// execute the first command using the dedicated function
-		exit(parse_command(cmd1, level + 1, father));
+	if (pid == 0) {
+		join_group(0, pgid);
+		placement_apply();
+
+		// read the input from the previous stage, instead of stdin
+		if (in_fd != -1) {
+			DIE(dup2(in_fd, STDIN_FILENO) == -1, "dup2 failed\n");
+			close(in_fd);
+		}
+
+		// write the output to the next stage, instead of stdout
+		if (out_fd != -1) {
+			DIE(dup2(out_fd, STDOUT_FILENO) == -1, "dup2 failed\n");
+			close(out_fd);
+			close(unused_fd);
+		}
+
+		// execute the part of the plan in the child
+		exit(run_plan(plan, begin, end));
 	}
 
-	// fork the second process
-	pid_t second_pid = fork();
+	TRACE_END("fork");
+	stats_add(STATS_SPAWN, start);
+	if (pid != -1) {
+		join_group(pid, pgid);
+		reaper_track(pid, group, name);
+	}
 
-	// check if the fork failed
-	if (second_pid == -1)
-		return false;
+	return pid;
+}
 
-	//  check if we are in the child process
-	if (second_pid == 0) {
-		// execute the second command using the dedicated function
-		exit(parse_command(cmd2, level + 1, father));
+/**
+ * Get the maximum number of commands run_in_parallel keeps running at once:
+ * $MINISHELL_JOBS, or the number of online processors if it is "auto".
+ * There is no limit by default, since parallel commands may depend on
+ * each other (e.g. one waits for what another writes).
+ */
+static int max_parallel_jobs(void)
+{
+	const char *value = vars_get("MINISHELL_JOBS");
+
+	if (value == NULL)
+		return INT_MAX;
+
+	if (strcmp(value, "auto") == 0) {
+		long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		return (nr_cpus > 0) ? (int)nr_cpus : 1;
 	}
 
-	// wait for the two processes to finish
-	int first_status, second_status;
+	return (atoi(value) > 0) ? atoi(value) : INT_MAX;
+}
+
+/**
+ * Run all the jobs of a parallel chain (cmd1 & cmd2 & ... & cmdN), whose
+ * node is at index, keeping at most max_parallel_jobs() of them running at
+ * the same time.
+ */
+static int run_in_parallel(plan_t *plan, int index)
+{
+	// a new job is started as soon as any running one terminates
+	int nr_jobs = plan->nodes[index].count;
+	int max_jobs = max_parallel_jobs();
+
+	TRACE_BEGIN("parallel");
 
-	waitpid(first_pid, &first_status, 0);
-	waitpid(second_pid, &second_status, 0);
+	// the nodes of the i-th job are between begins[i] and ends[i]
+	int *begins = malloc(nr_jobs * sizeof(*begins));
 
-	// both processes must have terminated with success in order
-	// for the parallel command to be successful
+	DIE(begins == NULL, "malloc failed\n");
 
-	if (WEXITSTATUS(first_status) != 0)
-		return false;
+	int *ends = malloc(nr_jobs * sizeof(*ends));
 
-	if (WEXITSTATUS(second_status) != 0)
-		return false;
+	DIE(ends == NULL, "malloc failed\n");
 
-	// if we reached this point, it means that both processes
-	// terminated with success
-	return true;
+	pid_t *pids = malloc(nr_jobs * sizeof(*pids));
+
+	DIE(pids == NULL, "malloc failed\n");
+
+	int *exit_codes = malloc(nr_jobs * sizeof(*exit_codes));
+
+	DIE(exit_codes == NULL, "malloc failed\n");
+
+	struct cgroup **cgroups = calloc(nr_jobs, sizeof(*cgroups));
+
+	DIE(cgroups == NULL, "calloc failed\n");
+
+	for (int i = 0, job = index + 1; i < nr_jobs; i++) {
+		begins[i] = job + 1;
+		ends[i] = plan->nodes[job].next;
+		job = ends[i];
+	}
+
+	int group = reaper_new_group();
+	int nr_started = 0;
+	int nr_running = 0;
+
+	while (nr_started < nr_jobs || nr_running > 0) {
+		// start new jobs while there are free slots
+		while (nr_started < nr_jobs && nr_running < max_jobs) {
+			int i = nr_started++;
+			int status = -1;
+			plan_node_t *first = &plan->nodes[begins[i]];
+
+			// an internal command without side effects runs in the
+			// shell and does not take a slot, unless opening its
+			// redirections could wait for the jobs after it (e.g. a
+			// FIFO they read)
+			if (ends[i] == begins[i] + 1 && is_pure_builtin(first) &&
+				(first->nr_redirects == 0 || i == nr_jobs - 1)) {
+				pids[i] = -1;
+				exit_codes[i] = run_builtin(first, -1);
+				continue;
+			}
+
+			long long timeout = command_timeout(plan, begins[i], ends[i]);
+			struct cgroup *prev;
+
+			// the jobs share the terminal, so a job with a timeout
+			// only has a group of its own (killed at once) when the
+			// shell is not interactive
+			pid_t pgid = (timeout != 0 && !isatty(STDIN_FILENO)) ? 0 : -1;
+
+			cgroups[i] = cgroup_create(CGROUP_BRANCH);
+			prev = cgroup_enter(cgroups[i]);
+			placement_select(PLACEMENT_JOB, i);
+			pids[i] = start_command(plan, begins[i], ends[i], -1, -1, -1,
+					pgid, group, &status);
+			placement_select(PLACEMENT_NONE, 0);
+			cgroup_leave(prev);
+			if (pids[i] == -1) {
+				// the fork failed, or the command was not found
+				exit_codes[i] = (status == -1) ? EXIT_FAILURE : status;
+				continue;
+			}
+
+			if (timeout != 0)
+				reaper_deadline(pids[i], (pgid == 0) ? pids[i] : 0,
+						stats_now() + timeout);
+
+			nr_running++;
+		}
+
+		if (nr_running == 0)
+			break;
+
+		// wait for any of the jobs to terminate
+		int status;
+		pid_t pid = reaper_wait_group(group, &status);
+
+		if (pid == -1)
+			break;
+
+		for (int i = 0; i < nr_started; i++) {
+			if (pids[i] == pid) {
+				exit_codes[i] = WEXITSTATUS(status);
+				pids[i] = -1;
+				cgroup_release(cgroups[i]);
+				cgroups[i] = NULL;
+				nr_running--;
+				break;
+			}
+		}
+	}
+
+	// the chain is successful only if all the jobs are; otherwise its
+	// exit code is the one of the first job that failed
+	int exit_code = 0;
+
+	for (int i = 0; i < nr_jobs; i++) {
+		if (exit_codes[i] != 0) {
+			exit_code = exit_codes[i];
+			break;
+		}
+	}
+
+	free(begins);
+	free(ends);
+	free(pids);
+	free(exit_codes);
+
+	// the leaves of the jobs that could not be started
+	for (int i = 0; i < nr_jobs; i++)
+		cgroup_release(cgroups[i]);
+
+	free(cgroups);
+
+	TRACE_END("parallel");
+
+	return exit_code;
 }
 
 /**
- * Run commands by creating an anonymous pipe (cmd1 | cmd2).
+ * Get the size of the pipe buffers: $MINISHELL_PIPESIZE bytes (with an
+ * optional K or M suffix), or 0 to keep the default of the kernel.
  */
-static bool run_on_pipe(command_t *cmd1, command_t *cmd2, int level,
-		command_t *father)
+static int pipe_size(void)
 {
-	// inspiration from this video: https://youtu.be/Mqb2dVRe0uo?feature=shared
+	const char *value = vars_get("MINISHELL_PIPESIZE");
 
-	// declare filedescriptors array
-	// pipefds[0] = the reading end of the pipe
-	// pipefds[1] = the writing end of the pipe
-	int pipefds[2];
+	if (value == NULL)
+		return 0;
+
+	char *end;
+	long size = strtol(value, &end, 10);
+
+	if (*end == 'K' || *end == 'k')
+		size *= 1024;
+	else if (*end == 'M' || *end == 'm')
+		size *= 1024 * 1024;
+
+	return (size > 0 && size <= INT_MAX) ? (int)size : 0;
+}
+
+/**
+ * Create a pipe between two stages of a pipeline.
+ *
+ * The pipes must not leak into the other stages (dup2 in the children
+ * clears the close-on-exec flag). Their buffers can be enlarged with
+ * MINISHELL_PIPESIZE, so that the stages switch less often between filling
+ * and draining them, and MINISHELL_PIPE_DIRECT=yes makes them packet pipes
+ * (every write is read as a separate packet).
+ */
+static int make_pipe(int *pipefds)
+{
+	const char *direct = vars_get("MINISHELL_PIPE_DIRECT");
+	int flags = O_CLOEXEC;
 
-	// check if the pipe was created successfully
-	if (pipe(pipefds) == -1)
-		return false; // pipe failed
+	if (direct != NULL && strcmp(direct, "yes") == 0)
+		flags |= O_DIRECT;
 
+	if (pipe2(pipefds, flags) == -1)
+		return -1;
+
+	// the size may be over /proc/sys/fs/pipe-max-size for an unprivileged
+	// user; the pipe just keeps its default size then
+	int size = pipe_size();
+
+	if (size != 0)
+		fcntl(pipefds[WRITE], F_SETPIPE_SZ, size);
+
+	return 0;
+}
+
+/**
+ * Check if the i-th stage of a pipeline runs in the shell: it is the stage
+ * copied by the shell, or an internal command if shell_builtins is set.
+ */
+static bool stage_in_shell(const plan_node_t *stage, int i, int copy_stage,
+		bool shell_builtins)
+{
+	return i == copy_stage || (shell_builtins && is_pure_builtin(stage));
+}
+
+/**
+ * Run all the commands of a pipeline (cmd1 | cmd2 | ... | cmdN), whose node
+ * is at index.
+ */
+static int run_on_pipe(plan_t *plan, int index)
+{
 	/*
-	* the output of the first command will no loger be displayed at stdout,
-	* but it will be written to the pipe. The second command will read its input
-	* from the pipe, instead of stdin and this input will be the output from the
-	* first command
-	*/
+	 * the stages are the simple command nodes that follow the pipeline
+	 * node; all the N children (connected by N - 1 pipes) are created
+	 * from this process
+	 */
+	int nr_stages = plan->nodes[index].count;
+	plan_node_t *stages = &plan->nodes[index + 1];
 
-	// create the two processes
+	TRACE_BEGIN("pipeline");
 
-	// fork the first process
-	pid_t first_pid = fork();
+	pid_t *pids = malloc(nr_stages * sizeof(*pids));
 
-	// check if the fork failed
-	if (first_pid == -1)
-		return false;
+	DIE(pids == NULL, "malloc failed\n");
+
+	// the pipe ends used by the stages that run in the shell
+	int *shell_fds = malloc(nr_stages * sizeof(*shell_fds));
+
+	DIE(shell_fds == NULL, "malloc failed\n");
+
+	/*
+	 * at most one trivial cat stage is satisfied by the shell itself; a
+	 * sink runs for as long as the pipeline does, so the internal commands
+	 * cannot run in the shell before it and get processes of their own
+	 */
+	int copy_stage = -1;
+	enum zerocopy_role copy_role = ZEROCOPY_NONE;
+
+	for (int i = 0; i < nr_stages && copy_stage == -1; i++) {
+		copy_role = zerocopy_role(stages[i].cmd, i == 0, i == nr_stages - 1);
+		if (copy_role != ZEROCOPY_NONE)
+			copy_stage = i;
+	}
+
+	bool shell_builtins = (copy_role != ZEROCOPY_SINK);
+
+	/*
+	 * a pipeline with a timeout (the shortest one of its stages) is a
+	 * process group, killed at once when the time is up; the shell must
+	 * not be busy with a stage of its own then
+	 */
+	long long timeout = 0;
+
+	for (int i = 0; i < nr_stages; i++) {
+		long long t = stages[i].timeout_ns;
+
+		if (t != 0 && (timeout == 0 || t < timeout))
+			timeout = t;
+	}
+
+	if (timeout != 0) {
+		copy_stage = -1;
+		shell_builtins = false;
+	}
+
+	long long deadline = stats_now() + timeout;
+	pid_t pgid = (timeout != 0) ? 0 : -1;
+
+	// reading end of the pipe that connects the previous stage to this one
+	int prev_read = -1;
+	int group = reaper_new_group();
+	int nr_started = 0;
+	int last_status = 0;
+
+	for (int i = 0; i < nr_stages; i++) {
+		// pipefds[0] = the reading end of the pipe
+		// pipefds[1] = the writing end of the pipe
+		int pipefds[2] = {-1, -1};
+		bool last = (i == nr_stages - 1);
+
+		// the last stage writes to the standard output of the shell
+		if (!last && make_pipe(pipefds) == -1)
+			break; // pipe failed
+
+		// the sink reads what the previous stage writes
+		if (i == copy_stage && copy_role == ZEROCOPY_SINK) {
+			shell_fds[nr_started] = prev_read;
+			pids[nr_started++] = -1;
+			prev_read = -1;
+			continue;
+		}
 
-	//  check if we are in the child process
-	if (first_pid == 0) {
 		/*
-		* we need to redirect the standard output of the first command
-		* to the writing end of the pipe
-		*/
-		int rc = dup2(pipefds[1], STDOUT_FILENO);
-		// check if the redirection was successful
-		DIE(rc == -1, "dup2 failed\n");
+		 * an internal command without side effects (or a source) runs
+		 * in the shell, once all the other stages are started (so that
+		 * its reader already runs when it writes to the pipe); it does
+		 * not read its input, so the previous stage simply gets EPIPE
+		 */
+		if (stage_in_shell(&stages[i], i, copy_stage, shell_builtins)) {
+			shell_fds[nr_started] = pipefds[WRITE];
+			pids[nr_started++] = -1;
+
+			if (prev_read != -1)
+				close(prev_read);
+
+			prev_read = pipefds[READ];
+			continue;
+		}
+
+		int status = -1;
+
+		placement_select(PLACEMENT_STAGE, i);
+		pid_t pid = start_command(plan, index + 1 + i, index + 2 + i, prev_read,
+				pipefds[WRITE], pipefds[READ], pgid, group, &status);
+
+		placement_select(PLACEMENT_NONE, 0);
+
+		// check if the fork failed
+		if (pid == -1 && status == -1) {
+			if (!last) {
+				close(pipefds[READ]);
+				close(pipefds[WRITE]);
+			}
+			break;
+		}
+
+		// a stage that could not be spawned counts as terminated with
+		// status; the next stages run anyway and simply get EOF
+		if (pid == -1)
+			last_status = status;
+
+		// the first stage leads the group of the pipeline
+		if (pid != -1 && pgid == 0)
+			pgid = pid;
+
+		pids[nr_started++] = pid;
 
 		/*
-		* dup2 has created a new filedescriptor for STDOUT, so now
-		* we have two filedescriptors => we can close the old one
+		* the parent does not use the pipe ends that were handed to the
+		* child; they must be closed here so that every stage gets EOF
+		* as soon as the stage before it terminates
 		*/
-		close(pipefds[1]);
+		if (prev_read != -1)
+			close(prev_read);
 
-		// we do not use the reading end of the pipe, so we can close it
-		close(pipefds[0]);
+		prev_read = -1;
+		if (!last) {
+			close(pipefds[WRITE]);
+			prev_read = pipefds[READ];
+		}
+	}
+
+	if (prev_read != -1)
+		close(prev_read);
 
-		// execute the first command using the dedicated function
-		exit(parse_command(cmd1, level + 1, father));
+	for (int i = 0; i < nr_started && timeout != 0; i++) {
+		if (pids[i] != -1)
+			reaper_deadline(pids[i], pgid, deadline);
 	}
 
-	// fork the second process
-	pid_t second_pid = fork();
+	bool terminal = (timeout != 0 && pgid > 0) && give_terminal(pgid);
 
-	// check if the fork failed
-	if (second_pid == -1)
-		return false;
+	for (int i = 0; i < nr_started; i++) {
+		if (!stage_in_shell(&stages[i], i, copy_stage, shell_builtins))
+			continue;
 
-	//  check if we are in the child process
-	if (second_pid == 0) {
-		// the second command will read its input from the pipe, instead of stdin
-		int rc = dup2(pipefds[0], STDIN_FILENO);
-		// check if the redirection was successful
-		DIE(rc == -1, "dup2 failed\n");
+		// the pipeline is not complete, nobody needs the output
+		int status = EXIT_FAILURE;
 
-		/*
-		* dup2 has created a new filedescriptor for stdin, so now
-		* we have two filedescriptors => we can close the old one
-		*/
-		close(pipefds[0]);
+		if (nr_started == nr_stages && i == copy_stage)
+			status = zerocopy_run(&stages[i], copy_role, shell_fds[i]);
+		else if (nr_started == nr_stages)
+			status = run_builtin(&stages[i], shell_fds[i]);
 
-		// we do not use the writing end of the pipe, so we can close it
-		close(pipefds[1]);
+		if (i == nr_stages - 1)
+			last_status = status;
 
-		// execute the second command using the dedicated function
-		exit(parse_command(cmd2, level + 1, father));
+		if (shell_fds[i] != -1)
+			close(shell_fds[i]);
 	}
 
-	/*
-	* the parent process still has the two filedescriptors open, so we
-	* need to close them so that the second command knows when to stop
-	* expecting input
-	*/
-	close(pipefds[0]);
-	close(pipefds[1]);
-
-	// wait for the two processes to finish
-	int status;
+	// wait for all the stages, in the order they terminate; the exit
+	// status is the one of the last stage
+	int status = 0;
+	pid_t last_pid = (nr_started > 0) ? pids[nr_started - 1] : -1;
+	int exit_code = 0;
+	pid_t pid;
 
-	waitpid(first_pid, NULL, 0);
-	waitpid(second_pid, &status, 0);
+	while ((pid = reaper_wait_group(group, &status)) != -1) {
+		if (pid == last_pid)
+			exit_code = WEXITSTATUS(status);
+	}
 
-	return WEXITSTATUS(status);
+	if (terminal)
+		take_terminal();
+
+	// the last stage was never started
+	if (nr_started != nr_stages)
+		exit_code = EXIT_FAILURE;
+	else if (pids[nr_stages - 1] == -1)
+		exit_code = last_status;
+
+	free(pids);
+	free(shell_fds);
+
+	TRACE_END("pipeline");
+
+	return exit_code;
 }
 
 /**
- * Parse and execute a command.
+ * Start the background command whose node is at index and add it to the
+ * job table, without waiting for it; like in a shell without job control,
+ * it reads from /dev/null.
  */
-int parse_command(command_t *c, int level, command_t *father)
+static int run_in_background(plan_t *plan, int index)
 {
-	int exit_code;
+	plan_node_t *n = &plan->nodes[index];
+	long long timeout = command_timeout(plan, index + 1, n->next);
+	int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
 
-	if (c->op == OP_NONE) {
-		return parse_simple(c->scmd, level, father);
-	}
+	DIE(null_fd == -1, "open failed\n");
 
-	switch (c->op) {
-	case OP_SEQUENTIAL:
-		parse_command(c->cmd1, level + 1, c);
-	 	exit_code = parse_command(c->cmd2, level + 1, c);
-		break;
+	int status = -1;
+	struct cgroup *cg = cgroup_create(CGROUP_JOB);
+	struct cgroup *prev = cgroup_enter(cg);
+	pid_t pid = start_command(plan, index + 1, n->next, null_fd, -1, -1, 0,
+			reaper_new_group(), &status);
 
-	case OP_PARALLEL:
-		exit_code = run_in_parallel(c->cmd1, c->cmd2, level + 1, c);
-		break;
+	cgroup_leave(prev);
+	close(null_fd);
 
-	case OP_CONDITIONAL_NZERO:
-		exit_code = parse_command(c->cmd1, level + 1, c);
-		if (exit_code != 0)
-			exit_code = parse_command(c->cmd2, level + 1, c);
+	if (pid == -1) {
+		cgroup_release(cg);
+		return (status == -1) ? EXIT_FAILURE : status;
+	}
 
-		break;
+	if (timeout != 0)
+		reaper_deadline(pid, pid, stats_now() + timeout);
 
-	case OP_CONDITIONAL_ZERO:
-		exit_code = parse_command(c->cmd1, level + 1, c);
-		if (exit_code == 0)
-			exit_code = parse_command(c->cmd2, level + 1, c);
-		break;
+	char *text = jobs_describe(n->cmd->cmd1);
 
-	case OP_PIPE:
-		exit_code = run_on_pipe(c->cmd1, c->cmd2, level + 1, c);
-		break;
+	jobs_add(pid, text, cg);
+	free(text);
 
-	default:
-		return SHELL_EXIT;
+	return 0;
+}
+
+/**
+ * Run the nodes of a plan between begin and end.
+ * Returns the exit code of the last command that ran.
+ */
+static int run_plan(plan_t *plan, int begin, int end)
+{
+	int exit_code = 0;
+
+	for (int i = begin; i < end;) {
+		plan_node_t *n = &plan->nodes[i];
+
+		switch (n->op) {
+		case PLAN_SIMPLE:
+			exit_code = n->timed ? run_timed(n) : run_simple(n);
+			i++;
+			break;
+
+		case PLAN_PIPELINE:
+			exit_code = run_on_pipe(plan, i);
+			i = n->next;
+			break;
+
+		case PLAN_PARALLEL:
+			exit_code = run_in_parallel(plan, i);
+			i = n->next;
+			break;
+
+		case PLAN_BACKGROUND:
+			exit_code = run_in_background(plan, i);
+			i = n->next;
+			break;
+
+		case PLAN_JUMP_ZERO:
+			i = (exit_code == 0) ? n->next : i + 1;
+			break;
+
+		case PLAN_JUMP_NZERO:
+			i = (exit_code != 0) ? n->next : i + 1;
+			break;
+
+		default:
+			return SHELL_EXIT;
+		}
+
+		// exit stops everything that follows it
+		if (exit_code == SHELL_EXIT)
+			break;
 	}
 
 	return exit_code;
 }
+
+/**
+ * Parse and execute a command.
+ */
+int parse_command(command_t *c, int level, command_t *father)
+{
+	(void)level;
+	(void)father;
+
+	// the plan of a cached tree is kept with it
+	plan_t *plan = c->aux;
+
+	TRACE_BEGIN("command");
+
+	if (plan == NULL)
+		plan = plan_compile(c);
+
+	struct cgroup *cg = cgroup_create(CGROUP_LINE);
+	struct cgroup *prev = cgroup_enter(cg);
+	int exit_code = run_plan(plan, 0, plan->nr_nodes);
+
+	cgroup_leave(prev);
+	cgroup_release(cg);
+
+	if (plan != c->aux)
+		plan_free(plan);
+
+	TRACE_END("command");
+
+	return exit_code;
+}
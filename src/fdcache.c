@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fdcache.h"
+#include "vars.h"
+
+#define MAX_CACHED_FDS		64
+
+// the cached descriptors are kept out of the way of the redirections
+#define MIN_CACHED_FD		10
+
+struct cached_fd {
+	char *path;
+	int fd;
+	int flags;
+	dev_t dev;
+	ino_t ino;
+	unsigned long last_use;
+};
+
+static struct cached_fd entries[MAX_CACHED_FDS];
+static int nr_entries;
+static unsigned long clock_ticks;
+
+
+/**
+ * Get the number of files the cache keeps, 0 if it is disabled.
+ */
+static int cache_size(void)
+{
+	const char *value = vars_get("MINISHELL_FDCACHE");
+
+	if (value == NULL)
+		return 0;
+
+	int size = atoi(value);
+
+	if (size < 0)
+		return 0;
+
+	return (size > MAX_CACHED_FDS) ? MAX_CACHED_FDS : size;
+}
+
+/**
+ * Check if the descriptors opened with flags can be shared: every write
+ * goes to the end of the file, wherever the other writers are.
+ */
+static int cacheable(int flags)
+{
+	return (flags & O_APPEND) && !(flags & O_TRUNC);
+}
+
+static void evict(int i)
+{
+	close(entries[i].fd);
+	free(entries[i].path);
+	entries[i] = entries[--nr_entries];
+}
+
+/**
+ * Close the least recently used files until at most size are left.
+ */
+static void shrink(int size)
+{
+	while (nr_entries > size) {
+		int oldest = 0;
+
+		for (int i = 1; i < nr_entries; i++) {
+			if (entries[i].last_use < entries[oldest].last_use)
+				oldest = i;
+		}
+
+		evict(oldest);
+	}
+}
+
+int fd_cache_get(const char *path, int flags)
+{
+	struct stat st;
+
+	shrink(cache_size());
+
+	if (nr_entries == 0 || !cacheable(flags))
+		return -1;
+
+	for (int i = 0; i < nr_entries; i++) {
+		struct cached_fd *e = &entries[i];
+
+		if (e->flags != flags || strcmp(e->path, path) != 0)
+			continue;
+
+		// the path may name another file now (e.g. the log was rotated
+		// with mv log log.1): only a lookup of the path can tell, but it
+		// is still cheaper than the open it saves
+		if (stat(path, &st) == -1 || st.st_dev != e->dev ||
+		    st.st_ino != e->ino) {
+			evict(i);
+			return -1;
+		}
+
+		e->last_use = ++clock_ticks;
+
+		return fcntl(e->fd, F_DUPFD_CLOEXEC, 0);
+	}
+
+	return -1;
+}
+
+void fd_cache_put(const char *path, int fd, int flags)
+{
+	struct stat st;
+	int size = cache_size();
+
+	if (size == 0 || !cacheable(flags) || fstat(fd, &st) == -1 ||
+	    !S_ISREG(st.st_mode))
+		return;
+
+	// make room by closing the least recently used file
+	shrink(size - 1);
+
+	char *copy = strdup(path);
+
+	if (copy == NULL)
+		return;
+
+	int cached = fcntl(fd, F_DUPFD_CLOEXEC, MIN_CACHED_FD);
+
+	if (cached == -1) {
+		free(copy);
+		return;
+	}
+
+	entries[nr_entries++] = (struct cached_fd) {
+		.path = copy,
+		.fd = cached,
+		.flags = flags,
+		.dev = st.st_dev,
+		.ino = st.st_ino,
+		.last_use = ++clock_ticks,
+	};
+}
+
+void fd_cache_flush(void)
+{
+	shrink(0);
+}
@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _FDCACHE_H
+#define _FDCACHE_H
+
+/*
+ * Cache of the files the commands append to (cmd >> log, cmd &>> log), so
+ * that a file that is redirected to again and again (e.g. by a loop that
+ * logs) is not opened again every time: the open descriptors are kept by
+ * the shell, keyed by the path and the open flags of the file, and a new
+ * descriptor of the same open file is handed out instead.
+ *
+ * The path is still looked up (stat) on every use, so that a file that was
+ * removed, renamed (e.g. rotated) or replaced is dropped and opened again;
+ * the cache is flushed when the current directory changes.
+ *
+ * MINISHELL_FDCACHE=N enables the cache, with at most N files; lowering N
+ * closes the files over the limit.
+ */
+
+/**
+ * Get a new descriptor (close-on-exec) of the file at path, opened with
+ * flags, if it is cached.
+ * Returns the descriptor, or -1 if it is not cached.
+ */
+int fd_cache_get(const char *path, int flags);
+
+/**
+ * Offer a descriptor of the file at path, that was just opened with flags,
+ * to the cache; the caller keeps its descriptor.
+ */
+void fd_cache_put(const char *path, int fd, int flags);
+
+/**
+ * Close all the cached descriptors (e.g. when the current directory changes).
+ */
+void fd_cache_flush(void);
+
+#endif /* _FDCACHE_H */
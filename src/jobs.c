@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/wait.h>
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "jobs.h"
+#include "reaper.h"
+#include "utils.h"
+
+// the terminated jobs whose status is kept when they are not reported
+#define MAX_DONE_JOBS		256
+
+struct job {
+	int id;
+	pid_t pid;
+	char *text;
+	struct cgroup *cgroup;
+	bool done;
+	int status;
+};
+
+static struct job *jobs;
+static int nr_jobs;
+static int max_jobs;
+
+
+int jobs_add(pid_t pid, const char *text, struct cgroup *cg)
+{
+	if (nr_jobs == max_jobs) {
+		max_jobs = (max_jobs == 0) ? 16 : 2 * max_jobs;
+		jobs = realloc(jobs, max_jobs * sizeof(*jobs));
+		DIE(jobs == NULL, "realloc failed\n");
+	}
+
+	// like in bash, the new job gets the number after the last one
+	int id = (nr_jobs > 0) ? jobs[nr_jobs - 1].id + 1 : 1;
+
+	jobs[nr_jobs].id = id;
+	jobs[nr_jobs].pid = pid;
+	jobs[nr_jobs].cgroup = cg;
+	jobs[nr_jobs].done = false;
+	jobs[nr_jobs].text = strdup(text);
+	DIE(jobs[nr_jobs].text == NULL, "strdup failed\n");
+	nr_jobs++;
+
+	if (isatty(STDIN_FILENO))
+		fprintf(stderr, "[%d] %d\n", id, pid);
+
+	return id;
+}
+
+static void describe_words(word_t *w, FILE *out)
+{
+	for (; w != NULL; w = w->next_word) {
+		fputc(' ', out);
+
+		for (word_t *part = w; part != NULL; part = part->next_part) {
+			if (part->expand == true)
+				fprintf(out, "$%s", part->string);
+			else
+				fputs(part->string, out);
+		}
+	}
+}
+
+static void describe(command_t *c, FILE *out)
+{
+	static const char * const operators[] = {
+		[OP_SEQUENTIAL] = ";",
+		[OP_PARALLEL] = "&",
+		[OP_CONDITIONAL_ZERO] = "&&",
+		[OP_CONDITIONAL_NZERO] = "||",
+		[OP_PIPE] = "|",
+		[OP_BACKGROUND] = "&",
+	};
+
+	if (c->op == OP_NONE) {
+		simple_command_t *s = c->scmd;
+
+		describe_words(s->verb, out);
+		describe_words(s->params, out);
+
+		if (s->in != NULL) {
+			fputs(" <", out);
+			describe_words(s->in, out);
+		}
+
+		if (s->out != NULL) {
+			fputs((s->io_flags & IO_OUT_APPEND) ? " >>" : " >", out);
+			describe_words(s->out, out);
+		}
+
+		if (s->err != NULL) {
+			fputs((s->io_flags & IO_ERR_APPEND) ? " 2>>" : " 2>", out);
+			describe_words(s->err, out);
+		}
+		return;
+	}
+
+	describe(c->cmd1, out);
+	fprintf(out, " %s", operators[c->op]);
+
+	if (c->cmd2 != NULL)
+		describe(c->cmd2, out);
+}
+
+char *jobs_describe(command_t *c)
+{
+	char *text;
+	size_t len;
+	FILE *out = open_memstream(&text, &len);
+
+	DIE(out == NULL, "open_memstream failed\n");
+
+	describe(c, out);
+	fclose(out);
+
+	// the words are written with a space before them
+	memmove(text, text + (len > 0), len);
+
+	return text;
+}
+
+static void print_job(const struct job *j, const char *state)
+{
+	printf("[%d] %-24s%s\n", j->id, state, j->text);
+}
+
+/**
+ * Print a terminated job, with its wait status.
+ */
+static void print_done(const struct job *j, int status)
+{
+	char state[32];
+
+	if (WIFSIGNALED(status))
+		snprintf(state, sizeof(state), "%s", strsignal(WTERMSIG(status)));
+	else if (WEXITSTATUS(status) != 0)
+		snprintf(state, sizeof(state), "Exit %d", WEXITSTATUS(status));
+	else
+		snprintf(state, sizeof(state), "Done");
+
+	print_job(j, state);
+}
+
+static int exit_status(int status)
+{
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+
+	return WEXITSTATUS(status);
+}
+
+static void remove_job(int i)
+{
+	free(jobs[i].text);
+	memmove(&jobs[i], &jobs[i + 1], (nr_jobs - i - 1) * sizeof(*jobs));
+	nr_jobs--;
+}
+
+/**
+ * Collect the status of a job if it terminated.
+ * Returns true if it did.
+ */
+static bool job_done(struct job *j)
+{
+	if (!j->done && reaper_try_wait(j->pid, &j->status)) {
+		j->done = true;
+		cgroup_release(j->cgroup);
+		j->cgroup = NULL;
+	}
+
+	return j->done;
+}
+
+void jobs_reap(bool report)
+{
+	int nr_done = 0;
+
+	for (int i = 0; i < nr_jobs;) {
+		// without a report, the status is kept for jobs and wait
+		if (!job_done(&jobs[i]) || !report) {
+			nr_done += jobs[i].done;
+			i++;
+			continue;
+		}
+
+		print_done(&jobs[i], jobs[i].status);
+		remove_job(i);
+	}
+
+	// like bash, only the statuses of the last jobs are kept, so that a
+	// script that starts jobs all the time does not grow the table
+	for (int i = 0; nr_done > MAX_DONE_JOBS; i++) {
+		if (jobs[i].done) {
+			remove_job(i--);
+			nr_done--;
+		}
+	}
+
+	if (report)
+		fflush(stdout);
+}
+
+void jobs_print(void)
+{
+	for (int i = 0; i < nr_jobs;) {
+		if (!job_done(&jobs[i])) {
+			print_job(&jobs[i], "Running");
+			i++;
+			continue;
+		}
+
+		print_done(&jobs[i], jobs[i].status);
+		remove_job(i);
+	}
+
+	fflush(stdout);
+}
+
+/**
+ * Find a job by its number (%N) or by its pid.
+ * Returns its index, or -1 if there is no such job.
+ */
+static int find_job(const char *spec)
+{
+	bool by_id = (spec[0] == '%');
+	char *end;
+	long value = strtol(spec + by_id, &end, 10);
+
+	if (*end != '\0' || end == spec + by_id)
+		return -1;
+
+	for (int i = 0; i < nr_jobs; i++) {
+		if (by_id ? jobs[i].id == value : jobs[i].pid == value)
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * Wait for the job at index i and remove it from the table.
+ * Returns its wait status.
+ */
+static int wait_job(int i)
+{
+	if (!jobs[i].done) {
+		jobs[i].status = reaper_wait(jobs[i].pid);
+		cgroup_release(jobs[i].cgroup);
+	}
+
+	int status = jobs[i].status;
+
+	remove_job(i);
+
+	return status;
+}
+
+int jobs_wait(const char *spec)
+{
+	if (spec == NULL) {
+		while (nr_jobs > 0)
+			wait_job(0);
+
+		return 0;
+	}
+
+	int i = find_job(spec);
+
+	if (i == -1) {
+		fprintf(stderr, "wait: %s: no such job\n", spec);
+		return 127;
+	}
+
+	return exit_status(wait_job(i));
+}
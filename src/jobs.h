@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _JOBS_H
+#define _JOBS_H
+
+#include <sys/types.h>
+
+#include "../util/parser/parser.h"
+#include "cgroup.h"
+
+/*
+ * The table of the background jobs (cmd &): every job is a child of the
+ * shell in a process group of its own, numbered like in bash ([1], [2], ...).
+ * The jobs that terminated are collected without blocking, before every
+ * prompt, or by the wait builtin; their status is kept until it is reported
+ * (by jobs, or before an interactive prompt) or waited for, for the last 256
+ * of them.
+ */
+
+/**
+ * Add a job that was just started; text describes it (it is copied) and cg
+ * is the leaf it runs in (NULL if none), released when the job terminates.
+ * Returns the number of the job.
+ */
+int jobs_add(pid_t pid, const char *text, struct cgroup *cg);
+
+/**
+ * Get the text of a command, as it is shown in the job table.
+ * Release it with free.
+ */
+char *jobs_describe(command_t *c);
+
+/**
+ * Collect the jobs that terminated; if report is set, report them and drop
+ * them from the table.
+ */
+void jobs_reap(bool report);
+
+/**
+ * Print the jobs (the jobs builtin).
+ */
+void jobs_print(void);
+
+/**
+ * Wait for a job (its number as %N, or its pid), or for all of them if spec
+ * is NULL.
+ * Returns the exit status of the job, or 127 if there is no such job.
+ */
+int jobs_wait(const char *spec);
+
+#endif /* _JOBS_H */
@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cgroup.h"
+#include "launch.h"
+#include "pathcache.h"
+#include "placement.h"
+#include "rlimits.h"
+#include "utils.h"
+#include "vars.h"
+
+
+bool spawn_is_possible(simple_command_t *s)
+{
+	const char *backend = vars_get("MINISHELL_SPAWN");
+
+	(void)s;
+
+	// every external command can be spawned, unless we are told otherwise
+	if (backend != NULL && strcmp(backend, "fork") == 0)
+		return false;
+
+	// posix_spawn cannot set the limits or the CPUs of the child, nor
+	// create it in a cgroup
+	if (rlimits_count() > 0 || placement_pending() || cgroup_fd() != -1)
+		return false;
+
+	return true;
+}
+
+// the shell that runs the scripts without a #! line
+#define SCRIPT_SHELL		"/bin/sh"
+
+/**
+ * Build the arguments that run the script at path with SCRIPT_SHELL:
+ * SCRIPT_SHELL path argv[1] ...
+ * The array must be freed; its strings are the ones of argv.
+ */
+static char **script_argv(const char *path, char **argv)
+{
+	int argc = 0;
+
+	while (argv[argc] != NULL)
+		argc++;
+
+	char **sh_argv = malloc((argc + 2) * sizeof(*sh_argv));
+
+	DIE(sh_argv == NULL, "malloc failed\n");
+
+	sh_argv[0] = (char *)SCRIPT_SHELL;
+	sh_argv[1] = (char *)path;
+	memcpy(sh_argv + 2, argv + 1, argc * sizeof(*sh_argv));
+
+	return sh_argv;
+}
+
+void exec_file(const char *path, char **argv)
+{
+	execve(path, argv, vars_environ());
+
+	if (errno == ENOEXEC) {
+		char **sh_argv = script_argv(path, argv);
+
+		execve(SCRIPT_SHELL, sh_argv, vars_environ());
+		free(sh_argv);
+
+		errno = ENOEXEC;
+	}
+}
+
+/* The context of spawn_file. */
+struct spawn_context {
+	posix_spawn_file_actions_t *actions;
+	posix_spawnattr_t *attr;
+};
+
+/**
+ * Spawn the executable at path, or SCRIPT_SHELL for it if the kernel
+ * cannot load it (see exec_file); arg is a struct spawn_context.
+ * Returns 0 on success, or the posix_spawn error code.
+ */
+static int spawn_file(pid_t *pid, const char *path, char **argv, void *arg)
+{
+	struct spawn_context *ctx = arg;
+	int rc = posix_spawn(pid, path, ctx->actions, ctx->attr, argv,
+			vars_environ());
+
+	if (rc == ENOEXEC) {
+		char **sh_argv = script_argv(path, argv);
+
+		if (posix_spawn(pid, SCRIPT_SHELL, ctx->actions, ctx->attr,
+				sh_argv, vars_environ()) == 0)
+			rc = 0;
+		free(sh_argv);
+	}
+
+	return rc;
+}
+
+int exec_failed(const plan_node_t *n, const int *fds, const char *name)
+{
+	int err = errno;
+	int fd = STDERR_FILENO;
+
+	// the command would have written to its own error output
+	for (int i = 0; i < n->nr_redirects; i++) {
+		if (n->redirects[i].fd == STDERR_FILENO)
+			fd = fds[i];
+	}
+
+	fflush(stderr);
+	dprintf(fd, "Execution failed for '%s'\n", name);
+
+	return (err == ENOENT) ? EXIT_NOT_FOUND : EXIT_NOT_EXECUTABLE;
+}
+
+int launch_path(pid_t *pid, char **argv, launch_fn start, void *arg)
+{
+	const char *path = path_lookup(argv[0]);
+
+	if (path == NULL)
+		return ENOENT;
+
+	int rc = start(pid, path, argv, arg);
+
+	// the cached executable went away, search $PATH once more
+	if (rc == ENOENT && strchr(argv[0], '/') == NULL) {
+		path_cache_forget(argv[0]);
+
+		path = path_lookup(argv[0]);
+		if (path == NULL)
+			return ENOENT;
+
+		rc = start(pid, path, argv, arg);
+	}
+
+	return rc;
+}
+
+/**
+ * Open the files of the redirections of a simple command in the shell and
+ * add the actions which install them in the spawned command.
+ * The opened descriptors are stored in fds.
+ * Returns 0 on success, or -1 if a file could not be opened.
+ */
+static int add_redirect_actions(posix_spawn_file_actions_t *actions,
+		const plan_node_t *n, int *fds)
+{
+	if (plan_open_redirects(n, fds) == -1)
+		return -1;
+
+	for (int i = 0; i < n->nr_redirects; i++) {
+		int rc = posix_spawn_file_actions_adddup2(actions, fds[i],
+				n->redirects[i].fd);
+
+		DIE(rc != 0, "posix_spawn_file_actions_adddup2 failed\n");
+	}
+
+	return 0;
+}
+
+pid_t spawn_external_command(const plan_node_t *n, int in_fd, int out_fd,
+		int close_fd, pid_t pgid, int *status)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	int rc = posix_spawn_file_actions_init(&actions);
+
+	DIE(rc != 0, "posix_spawn_file_actions_init failed\n");
+
+	rc = posix_spawnattr_init(&attr);
+	DIE(rc != 0, "posix_spawnattr_init failed\n");
+
+	if (pgid != -1) {
+		rc = posix_spawnattr_setpgroup(&attr, pgid);
+		DIE(rc != 0, "posix_spawnattr_setpgroup failed\n");
+		rc = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+		DIE(rc != 0, "posix_spawnattr_setflags failed\n");
+	}
+
+	// connect the command to the pipes first, exactly like the forked
+	// pipeline stages do before perform_redirections
+	if (in_fd != -1) {
+		rc = posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+		DIE(rc != 0, "posix_spawn_file_actions_adddup2 failed\n");
+		rc = posix_spawn_file_actions_addclose(&actions, in_fd);
+		DIE(rc != 0, "posix_spawn_file_actions_addclose failed\n");
+	}
+
+	if (out_fd != -1) {
+		rc = posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+		DIE(rc != 0, "posix_spawn_file_actions_adddup2 failed\n");
+		rc = posix_spawn_file_actions_addclose(&actions, out_fd);
+		DIE(rc != 0, "posix_spawn_file_actions_addclose failed\n");
+	}
+
+	if (close_fd != -1) {
+		rc = posix_spawn_file_actions_addclose(&actions, close_fd);
+		DIE(rc != 0, "posix_spawn_file_actions_addclose failed\n");
+	}
+
+	// the files are opened here so that a failed redirection can be told
+	// apart from a failed exec
+	int fds[MAX_REDIRECTIONS];
+	pid_t pid = -1;
+
+	if (add_redirect_actions(&actions, n, fds) == -1) {
+		// the redirection failed, like the forked child does on DIE
+		*status = EXIT_FAILURE;
+	} else {
+		struct spawn_context ctx = { &actions, &attr };
+		char **argv = plan_get_argv(n);
+
+		rc = launch_path(&pid, argv, spawn_file, &ctx);
+		if (rc != 0) {
+			pid = -1;
+			errno = rc;
+			*status = exec_failed(n, fds, argv[0]);
+		}
+
+		plan_put_argv(n, argv);
+
+		for (int i = 0; i < n->nr_redirects; i++)
+			close(fds[i]);
+	}
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	return pid;
+}
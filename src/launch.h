@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _LAUNCH_H
+#define _LAUNCH_H
+
+#include <sys/types.h>
+
+#include "../util/parser/parser.h"
+#include "plan.h"
+
+/* Exit statuses of the commands that could not be executed. */
+#define EXIT_NOT_EXECUTABLE	126
+#define EXIT_NOT_FOUND		127
+
+/**
+ * Check if an external command can be started with posix_spawn, instead of
+ * fork + exec (it needs no shell logic to run in the child).
+ *
+ * The fork backend can be forced by setting MINISHELL_SPAWN=fork; it is
+ * also used when resource limits are set for the commands, or when they are
+ * placed on CPUs or in cgroups.
+ */
+bool spawn_is_possible(simple_command_t *s);
+
+/**
+ * Load the executable at path in the current process; a file the kernel
+ * cannot load (a script without a #! line) is run by /bin/sh, like execvp
+ * does. Returns only on failure, with errno set.
+ */
+void exec_file(const char *path, char **argv);
+
+/**
+ * A way to start the executable at path with the arguments argv (e.g. with
+ * posix_spawn, or fork + exec_file), for launch_path; arg is its context.
+ * Returns 0 on success (*pid is -1 if no process could be created), or the
+ * error code of the executable that could not be loaded.
+ */
+typedef int (*launch_fn)(pid_t *pid, const char *path, char **argv,
+		void *arg);
+
+/**
+ * Start the executable argv[0] names with start: it is found by the shell in
+ * $PATH (see path_lookup), and searched for once more if the cached location
+ * went away.
+ * Returns 0 on success, or the error code of start (ENOENT if there is no
+ * such executable).
+ */
+int launch_path(pid_t *pid, char **argv, launch_fn start, void *arg);
+
+/**
+ * Report that the command of n could not be executed, to its error output
+ * (fds are the files of its redirections, see plan_open_redirects), and
+ * return the exit status it is considered to have (errno describes the
+ * failure).
+ */
+int exec_failed(const plan_node_t *n, const int *fds, const char *name);
+
+/**
+ * Start the external command of a plan node with posix_spawn.
+ *
+ * in_fd and out_fd (-1 if not used) become the standard input and output of
+ * the command before its own redirections are performed; close_fd (-1 if
+ * not used) is closed in the command. The command joins the process group
+ * pgid (a new one if it is 0, the one of the shell if it is -1).
+ *
+ * Returns the pid of the command, or -1 if it could not be started; in that
+ * case *status is the exit status the command is considered to have.
+ */
+pid_t spawn_external_command(const plan_node_t *n, int in_fd, int out_fd,
+		int close_fd, pid_t pgid, int *status);
+
+#endif /* _LAUNCH_H */
@@ -1,62 +1,110 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "../util/parser/parser.h"
 #include "cmd.h"
+#include "jobs.h"
+#include "meminfo.h"
+#include "parseahead.h"
+#include "parsecache.h"
+#include "pathcache.h"
+#include "plan.h"
+#include "reader.h"
+#include "reaper.h"
+#include "server.h"
+#include "stats.h"
+#include "trace.h"
 #include "utils.h"
+#include "vars.h"
 
 #define PROMPT             "> "
-#define CHUNK_SIZE         1024
+#define STREAM_LINE_LENGTH (64 * 1024)
 
 
-void parse_error(const char *str, const int where)
+// print the plans of the commands instead of running them
+static bool explain;
+
+/**
+ * Parse a command line, measuring the time it takes.
+ */
+static command_t *parse_timed(const char *line, size_t length)
 {
-	fprintf(stderr, "Parse error near %d: %s\n", where, str);
+	long long start = stats_now();
+	command_t *root = NULL;
+
+	TRACE_BEGIN("parse");
+
+	// a long line would not be cached anyway; it is lexed where it is,
+	// instead of being copied whole for the parser first
+	if (length > STREAM_LINE_LENGTH) {
+		parse_stream_buffer(line, length);
+		parse_stream_line(&root);
+		parse_stream_end();
+	} else {
+		parse_cached(line, length, &root);
+	}
+
+	TRACE_END("parse");
+	stats_add(STATS_PARSE, start);
+
+	return root;
 }
 
 /**
- * Readline from mini-shell.
+ * Parse the next line of the stream, measuring the time it takes.
+ * Returns false at the end of the stream.
  */
-static char *read_line(void)
+static bool parse_stream_timed(command_t **root)
 {
-	char *line = NULL;
-	int line_length = 0;
+	long long start = stats_now();
 
-	char chunk[CHUNK_SIZE];
-	int chunk_length;
+	TRACE_BEGIN("parse");
+	int rc = parse_stream_line(root);
 
-	char *rc;
+	TRACE_END("parse");
+	stats_add(STATS_PARSE, start);
 
-	int endline = 0;
+	return rc != -1;
+}
 
-	while (!endline) {
-		rc = fgets(chunk, CHUNK_SIZE, stdin);
-		if (rc == NULL)
-			break;
+/**
+ * Run the tree of a command line (or print its plan).
+ */
+static int run_tree(command_t *root)
+{
+	if (!explain) {
+		int exit_code = parse_command(root, 0, NULL);
 
-		chunk_length = strlen(chunk);
-		if (chunk[chunk_length - 1] == '\n') {
-			if (chunk_length > 1 && chunk[chunk_length - 2] == '\r')
-				/* Windows */
-				chunk[chunk_length - 2] = 0;
-			else
-				chunk[chunk_length - 1] = 0;
-			endline = 1;
-		}
+		if (stats_fd != -1)
+			stats_line();
 
-		line = realloc(line, line_length + CHUNK_SIZE);
-		DIE(line == NULL, "Error allocating command line");
+		return exit_code;
+	}
 
-		line[line_length] = '\0';
-		strcat(line, chunk);
+	plan_t *plan = plan_compile(root);
 
-		line_length += CHUNK_SIZE;
-	}
+	plan_print(plan, stdout);
+	plan_free(plan);
+	fflush(stdout);
+
+	return 0;
+}
+
+void parse_error(const char *str, const int where)
+{
+	// the error of a line parsed ahead is reported when it would run
+	if (parse_ahead_error(str, where))
+		return;
 
-	return line;
+	fprintf(stderr, "Parse error near %d: %s\n", where, str);
 }
 
 static void start_shell(void)
@@ -66,31 +114,222 @@ static void start_shell(void)
 
 	int ret;
 
+	// like bash, only an interactive shell reports the finished jobs
+	bool interactive = isatty(STDIN_FILENO);
+
 	for (;;) {
+		jobs_reap(interactive);
+
 		printf(PROMPT);
 		fflush(stdout);
 		ret = 0;
 
-		root = NULL;
 		line = read_line();
 		if (line == NULL)
 			return;
-		parse_line(line, &root);
+		size_t length = strlen(line);
+
+		root = parse_timed(line, length);
 
 		if (root != NULL)
-			ret = parse_command(root, 0, NULL);
+			ret = run_tree(root);
 
 		free_parse_memory();
-		free(line);
+		meminfo_line_done(length);
 
 		if (ret == SHELL_EXIT)
 			break;
 	}
 }
 
-int main(void)
+/**
+ * Run the lines of a script or of -c that are parsed ahead.
+ * Returns the exit code of the last command.
+ */
+static int run_ahead(int fd, const char *buffer, size_t size)
 {
-	start_shell();
+	int exit_code = 0;
+	command_t *root;
+
+	parse_ahead_start(fd, buffer, size);
+
+	while (parse_ahead_next(&root)) {
+		int ret = 0;
+
+		jobs_reap(false);
+
+		if (root != NULL)
+			ret = run_tree(root);
+
+		free(root);
+		meminfo_line_done(0);
+
+		if (ret == SHELL_EXIT)
+			break;
+
+		exit_code = ret;
+	}
+
+	parse_ahead_stop();
+
+	return exit_code;
+}
+
+/**
+ * Run all the lines of a buffer (a script or the -c argument), without
+ * prompting; the lines are parsed straight from the buffer.
+ * Returns the exit code of the last command.
+ */
+static int run_buffer(const char *buffer, size_t size)
+{
+	if (parse_ahead_depth() > 0)
+		return run_ahead(-1, buffer, size);
+
+	const char *end = buffer + size;
+	int exit_code = 0;
+
+	while (buffer < end) {
+		const char *newline = memchr(buffer, '\n', end - buffer);
+		size_t length = (newline != NULL) ? (size_t)(newline - buffer) : (size_t)(end - buffer);
+		const char *next = buffer + length + 1;
+
+		/* Windows */
+		if (length > 0 && buffer[length - 1] == '\r')
+			length--;
+
+		command_t *root = parse_timed(buffer, length);
+		int ret = 0;
+
+		jobs_reap(false);
+
+		if (root != NULL)
+			ret = run_tree(root);
+
+		free_parse_memory();
+		meminfo_line_done(length);
+
+		if (ret == SHELL_EXIT)
+			break;
+
+		exit_code = ret;
+		buffer = next;
+	}
+
+	return exit_code;
+}
+
+/**
+ * Run the lines of a script that cannot be mapped (e.g. a pipe): they are
+ * read and parsed in chunks, and every line runs as soon as it is read.
+ * Returns the exit code of the last command.
+ */
+static int run_stream(int fd)
+{
+	if (parse_ahead_depth() > 0)
+		return run_ahead(fd, NULL, 0);
+
+	int exit_code = 0;
+	command_t *root = NULL;
+
+	parse_stream_fd(fd);
+
+	while (parse_stream_timed(&root)) {
+		int ret = 0;
+
+		jobs_reap(false);
+
+		if (root != NULL)
+			ret = run_tree(root);
+
+		free_parse_memory();
+		meminfo_line_done(0);
+		root = NULL;
+
+		if (ret == SHELL_EXIT)
+			break;
+
+		exit_code = ret;
+	}
+
+	parse_stream_end();
+
+	return exit_code;
+}
+
+/**
+ * Run the commands from a script file; regular files are mapped in memory
+ * instead of being read, the others are streamed.
+ */
+static int run_script(const char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd == -1) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	struct stat st;
+	int exit_code;
+
+	DIE(fstat(fd, &st) == -1, "fstat failed");
+
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		char *buffer = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		DIE(buffer == MAP_FAILED, "mmap failed");
+		close(fd);
+
+		madvise(buffer, st.st_size, MADV_SEQUENTIAL);
+		exit_code = run_buffer(buffer, st.st_size);
+
+		munmap(buffer, st.st_size);
+	} else {
+		exit_code = run_stream(fd);
+		close(fd);
+	}
+
+	return exit_code;
+}
+
+int main(int argc, char *argv[])
+{
+	int exit_code = EXIT_SUCCESS;
+
+	meminfo_init();
+	stats_init();
+	trace_init();
+
+	if (argc > 1 && strcmp(argv[1], "--explain") == 0) {
+		explain = true;
+		argv++;
+		argc--;
+	}
+
+	if (argc > 2 && strcmp(argv[1], "--server") == 0) {
+		// mini-shell --server socket
+		exit_code = run_server(argv[2]);
+	} else if (argc > 2 && strcmp(argv[1], "-c") == 0) {
+		// mini-shell -c 'commands'
+		exit_code = run_buffer(argv[2], strlen(argv[2]));
+	} else if (argc > 1 && argv[1][0] != '-') {
+		// mini-shell script
+		exit_code = run_script(argv[1]);
+	} else if (argc > 1) {
+		fprintf(stderr,
+			"usage: %s [--explain] [-c commands | script | --server socket]\n",
+			argv[0]);
+		exit_code = EXIT_FAILURE;
+	} else {
+		start_shell();
+	}
+
+	parse_cache_free();
+	path_cache_free();
+	reaper_free();
+	vars_free();
+	release_parse_memory();
+	reader_free();
 
-	return EXIT_SUCCESS;
+	return exit_code;
 }
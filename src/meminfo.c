@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/resource.h>
+
+#include <malloc.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "../util/parser/parser.h"
+#include "meminfo.h"
+#include "reader.h"
+
+// the blocks above this are mapped on their own, and unmapped when freed
+#define MMAP_THRESHOLD		(256 * 1024)
+
+// the heap is trimmed after a line this long, or once the buffers shrank
+// by this much
+#define TRIM_LENGTH		(1024 * 1024)
+#define TRIM_SHRINK		(1024 * 1024)
+
+static size_t parser_peak;
+static size_t kept_size;
+
+
+void meminfo_init(void)
+{
+	// with a fixed threshold, freeing a multi-MB buffer does not raise it
+	// (glibc does that by default), so the next big buffers still come
+	// from their own mappings instead of fragmenting the heap
+	mallopt(M_MMAP_THRESHOLD, MMAP_THRESHOLD);
+}
+
+void meminfo_line_done(size_t length)
+{
+	size_t parser = parse_memory_size();
+	size_t kept = parser + reader_buffer_size();
+
+	if (parser > parser_peak)
+		parser_peak = parser;
+
+	if (length >= TRIM_LENGTH || kept + TRIM_SHRINK <= kept_size)
+		malloc_trim(0);
+
+	kept_size = kept;
+}
+
+/**
+ * Get the resident memory of the shell, in KiB.
+ */
+static long current_rss(void)
+{
+	FILE *f = fopen("/proc/self/statm", "re");
+	long size, resident;
+
+	if (f == NULL)
+		return -1;
+
+	if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+		resident = -1;
+
+	fclose(f);
+
+	return (resident == -1) ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void meminfo_print(void)
+{
+	struct rusage ru;
+	size_t parser = parse_memory_size();
+
+	getrusage(RUSAGE_SELF, &ru);
+	if (parser > parser_peak)
+		parser_peak = parser;
+
+	printf("rss %ld kB peak %ld kB\n", current_rss(), ru.ru_maxrss);
+	printf("parser %zu bytes peak %zu bytes\n", parser, parser_peak);
+	printf("reader %zu bytes peak %zu bytes\n", reader_buffer_size(),
+		reader_buffer_peak());
+	fflush(stdout);
+}
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _MEMINFO_H
+#define _MEMINFO_H
+
+#include <stddef.h>
+
+/*
+ * Memory of long-running shells: the buffers of the reader and of the parser
+ * shrink back to what the last lines needed (see reader.c and parser.y), and
+ * the heap is given back to the system after the lines that made it grow,
+ * so that a session keeps a flat footprint whatever lines it ran.
+ */
+
+/**
+ * Set up the allocator, before anything is allocated.
+ */
+void meminfo_init(void);
+
+/**
+ * Account for a line of length characters (0 if it is not known) that ran
+ * and whose tree was freed.
+ */
+void meminfo_line_done(size_t length);
+
+/**
+ * Print the current and peak resident memory of the shell and the sizes of
+ * the buffers of the parser and of the reader.
+ */
+void meminfo_print(void);
+
+#endif /* _MEMINFO_H */
@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "parseahead.h"
+#include "parsecache.h"
+#include "stats.h"
+#include "utils.h"
+#include "vars.h"
+
+#define MAX_DEPTH		1024
+#define MAX_ERROR		64
+
+/* A line that was parsed ahead. */
+struct ahead_line {
+	command_t *root;
+	long long parse_ns;
+	bool error;
+	int where;
+	char message[MAX_ERROR];
+};
+
+// a ring of the lines that were parsed but not taken yet
+static struct ahead_line *ring;
+static int depth;
+static int first;
+static int count;
+static bool input_done;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t not_full = PTHREAD_COND_INITIALIZER;
+
+static pthread_t thread;
+static bool running;
+
+// what the thread parses, with its own parser context
+static parser_ctx_t *ctx;
+static int input_fd;
+static const char *input_buffer;
+static size_t input_size;
+
+// the line being parsed, in the parse-ahead thread
+static __thread struct ahead_line *parsing;
+
+
+int parse_ahead_depth(void)
+{
+	const char *value = vars_get("MINISHELL_PARSEAHEAD");
+
+	if (value == NULL || atoi(value) <= 0)
+		return 0;
+
+	return (atoi(value) > MAX_DEPTH) ? MAX_DEPTH : atoi(value);
+}
+
+static void unlock(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Add a parsed line to the ring, waiting while it is full.
+ */
+static void push_line(const struct ahead_line *line)
+{
+	pthread_mutex_lock(&lock);
+
+	// the thread may be cancelled while it waits
+	pthread_cleanup_push(unlock, NULL);
+	while (count == depth)
+		pthread_cond_wait(&not_full, &lock);
+	pthread_cleanup_pop(0);
+
+	ring[(first + count) % depth] = *line;
+	count++;
+	pthread_cond_signal(&not_empty);
+	pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Stop the stream of the thread (e.g. when it is cancelled): it belongs to
+ * it, like the state of the scanner.
+ */
+static void end_parsing(void *arg)
+{
+	(void)arg;
+
+	parse_stream_end();
+	release_parse_thread();
+}
+
+static void *parse_lines(void *arg)
+{
+	(void)arg;
+
+	if (input_fd != -1)
+		parse_stream_fd(input_fd);
+	else
+		parse_stream_buffer(input_buffer, input_size);
+
+	pthread_cleanup_push(end_parsing, NULL);
+	for (;;) {
+		struct ahead_line line = { .root = NULL };
+		command_t *root = NULL;
+		long long start = stats_now();
+
+		parsing = &line;
+		int rc = parse_stream_line_r(ctx, &root);
+
+		parsing = NULL;
+		if (rc == -1)
+			break;
+
+		if (root != NULL)
+			line.root = parse_tree_copy(root);
+
+		free_parse_memory_r(ctx);
+		line.parse_ns = stats_now() - start;
+		push_line(&line);
+	}
+	pthread_cleanup_pop(1);
+
+	pthread_mutex_lock(&lock);
+	input_done = true;
+	pthread_cond_signal(&not_empty);
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+void parse_ahead_start(int fd, const char *buffer, size_t size)
+{
+	depth = parse_ahead_depth();
+	ring = malloc(depth * sizeof(*ring));
+	DIE(ring == NULL, "malloc failed\n");
+	first = 0;
+	count = 0;
+	input_done = false;
+
+	ctx = parser_ctx_new();
+	DIE(ctx == NULL, "parser_ctx_new failed\n");
+	input_fd = fd;
+	input_buffer = buffer;
+	input_size = size;
+
+	DIE(pthread_create(&thread, NULL, parse_lines, NULL) != 0,
+		"pthread_create failed\n");
+	running = true;
+}
+
+bool parse_ahead_next(command_t **root)
+{
+	pthread_mutex_lock(&lock);
+	while (count == 0 && !input_done)
+		pthread_cond_wait(&not_empty, &lock);
+
+	if (count == 0) {
+		pthread_mutex_unlock(&lock);
+		return false;
+	}
+
+	struct ahead_line line = ring[first];
+
+	first = (first + 1) % depth;
+	count--;
+	pthread_cond_signal(&not_full);
+	pthread_mutex_unlock(&lock);
+
+	// what the line cost is accounted for when it runs
+	stats_add(STATS_PARSE, stats_now() - line.parse_ns);
+
+	if (line.error)
+		parse_error(line.message, line.where);
+
+	*root = line.root;
+
+	return true;
+}
+
+void parse_ahead_stop(void)
+{
+	if (!running)
+		return;
+
+	// the thread may be waiting for the input (e.g. a pipe) or for room
+	// in the ring
+	pthread_cancel(thread);
+	pthread_join(thread, NULL);
+	running = false;
+
+	for (int i = 0; i < count; i++)
+		free(ring[(first + i) % depth].root);
+
+	free(ring);
+	ring = NULL;
+	parser_ctx_free(ctx);
+	ctx = NULL;
+}
+
+bool parse_ahead_running(void)
+{
+	return running;
+}
+
+bool parse_ahead_error(const char *str, int where)
+{
+	if (parsing == NULL)
+		return false;
+
+	parsing->error = true;
+	parsing->where = where;
+	snprintf(parsing->message, sizeof(parsing->message), "%s", str);
+
+	return true;
+}
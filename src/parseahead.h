@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PARSEAHEAD_H
+#define _PARSEAHEAD_H
+
+#include <stddef.h>
+
+#include "../util/parser/parser.h"
+
+/*
+ * Parse-ahead of the scripts and of -c (MINISHELL_PARSEAHEAD=N): a thread
+ * reads and parses the lines, up to N of them ahead of the one that runs,
+ * so that parsing is not on the critical path. The thread parses with its
+ * own parser context; the trees are copied out of it for the shell, and the
+ * parse errors are reported when their line would run.
+ */
+
+/**
+ * Get the number of lines that may be parsed ahead, 0 if parse-ahead is
+ * disabled.
+ */
+int parse_ahead_depth(void);
+
+/**
+ * Start parsing the lines of a file descriptor or of a buffer (fd is -1
+ * then) ahead; they must stay available until parse_ahead_stop.
+ */
+void parse_ahead_start(int fd, const char *buffer, size_t size);
+
+/**
+ * Get the tree of the next line (NULL if it is empty or could not be
+ * parsed), released with free.
+ * Returns false at the end of the input.
+ */
+bool parse_ahead_next(command_t **root);
+
+/**
+ * Stop parsing ahead (the lines that were not taken are dropped).
+ */
+void parse_ahead_stop(void);
+
+/**
+ * Check if the lines are being parsed by another thread.
+ */
+bool parse_ahead_running(void);
+
+/**
+ * Keep a parse error of the line being parsed ahead, to report it when the
+ * line is taken.
+ * Returns false if the error was not found by the parse-ahead thread.
+ */
+bool parse_ahead_error(const char *str, int where);
+
+#endif /* _PARSEAHEAD_H */
@@ -0,0 +1,377 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "parsecache.h"
+#include "plan.h"
+#include "utils.h"
+#include "vars.h"
+
+#define NR_BUCKETS		256
+#define NR_SEEN			1024
+#define DEFAULT_CAPACITY	128
+
+// longer lines rarely repeat, they would only fill the cache
+#define MAX_CACHED_LENGTH	4096
+
+#define ALIGN(size)		(((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+struct cache_entry {
+	uint64_t hash;
+	size_t length;
+	const char *line;
+	command_t *root;
+
+	struct cache_entry *bucket_next;
+
+	// the most recently used entry is the first one
+	struct cache_entry *lru_prev;
+	struct cache_entry *lru_next;
+};
+
+static struct cache_entry *buckets[NR_BUCKETS];
+static struct cache_entry *lru_first;
+static struct cache_entry *lru_last;
+static int nr_entries;
+
+/*
+ * The tree returned last may still run when the cache is flushed (e.g. by
+ * parsecache -r); it is released with the next lookup.
+ */
+static struct cache_entry *in_use;
+static struct cache_entry *retired;
+
+/*
+ * Hashes of the lines that missed once: a line is only copied in the cache
+ * the second time it is seen, so that scripts made of distinct lines do not
+ * pay for copying trees that would never be used again.
+ */
+static uint64_t seen[NR_SEEN];
+
+static unsigned long nr_hits;
+static unsigned long nr_misses;
+
+
+static uint64_t hash_line(const char *line, size_t length)
+{
+	uint64_t hash = 14695981039346656037ull;
+
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char)line[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+/**
+ * Get the maximum number of cached lines ($MINISHELL_PARSECACHE, which may
+ * be set in the shell).
+ */
+static int cache_capacity(void)
+{
+	const char *value = vars_get("MINISHELL_PARSECACHE");
+
+	if (value == NULL)
+		return DEFAULT_CAPACITY;
+
+	return (atoi(value) > 0) ? atoi(value) : 0;
+}
+
+static void lru_unlink(struct cache_entry *e)
+{
+	if (e->lru_prev != NULL)
+		e->lru_prev->lru_next = e->lru_next;
+	else
+		lru_first = e->lru_next;
+
+	if (e->lru_next != NULL)
+		e->lru_next->lru_prev = e->lru_prev;
+	else
+		lru_last = e->lru_prev;
+}
+
+static void lru_push_front(struct cache_entry *e)
+{
+	e->lru_prev = NULL;
+	e->lru_next = lru_first;
+
+	if (lru_first != NULL)
+		lru_first->lru_prev = e;
+	else
+		lru_last = e;
+
+	lru_first = e;
+}
+
+static struct cache_entry *find_entry(const char *line, size_t length,
+		uint64_t hash)
+{
+	for (struct cache_entry *e = buckets[hash % NR_BUCKETS]; e != NULL;
+		e = e->bucket_next) {
+		if (e->hash == hash && e->length == length &&
+			memcmp(e->line, line, length) == 0)
+			return e;
+	}
+
+	return NULL;
+}
+
+/**
+ * Release an entry, with the plan of its tree.
+ */
+static void free_entry(struct cache_entry *e)
+{
+	if (e == NULL)
+		return;
+
+	plan_free(e->root->aux);
+	free(e);
+}
+
+static void remove_entry(struct cache_entry *e)
+{
+	struct cache_entry **p = &buckets[e->hash % NR_BUCKETS];
+
+	while (*p != e)
+		p = &(*p)->bucket_next;
+
+	*p = e->bucket_next;
+
+	lru_unlink(e);
+	nr_entries--;
+
+	if (e == in_use)
+		retired = e;
+	else
+		free_entry(e);
+}
+
+/**
+ * Get the size a copy of a list of words (with all their parts) takes.
+ */
+static size_t words_size(word_t *w)
+{
+	size_t size = 0;
+
+	for (; w != NULL; w = w->next_word) {
+		for (word_t *part = w; part != NULL; part = part->next_part) {
+			size += ALIGN(sizeof(word_t));
+			size += ALIGN(strlen(part->string) + 1);
+		}
+	}
+
+	return size;
+}
+
+static size_t tree_size(command_t *c)
+{
+	size_t size = ALIGN(sizeof(command_t));
+
+	// a background command has a single operand
+	if (c->op != OP_NONE)
+		return size + tree_size(c->cmd1) +
+			((c->cmd2 != NULL) ? tree_size(c->cmd2) : 0);
+
+	simple_command_t *s = c->scmd;
+
+	size += ALIGN(sizeof(simple_command_t));
+	size += words_size(s->verb) + words_size(s->params);
+	size += words_size(s->in) + words_size(s->out) + words_size(s->err);
+
+	return size;
+}
+
+/**
+ * Take size bytes from the block being filled.
+ */
+static void *take(char **block, size_t size)
+{
+	void *p = *block;
+
+	*block += ALIGN(size);
+
+	return p;
+}
+
+static word_t *copy_parts(word_t *part, char **block)
+{
+	if (part == NULL)
+		return NULL;
+
+	word_t *copy = take(block, sizeof(*copy));
+	size_t length = strlen(part->string) + 1;
+	char *string = take(block, length);
+
+	memcpy(string, part->string, length);
+	copy->string = string;
+	copy->expand = part->expand;
+	copy->next_word = NULL;
+	copy->next_part = copy_parts(part->next_part, block);
+
+	return copy;
+}
+
+static word_t *copy_words(word_t *w, char **block)
+{
+	word_t *first = NULL;
+	word_t **last = &first;
+
+	for (; w != NULL; w = w->next_word) {
+		*last = copy_parts(w, block);
+		last = &(*last)->next_word;
+	}
+
+	return first;
+}
+
+static command_t *copy_tree(command_t *c, command_t *up, char **block)
+{
+	command_t *copy = take(block, sizeof(*copy));
+
+	copy->up = up;
+	copy->op = c->op;
+	copy->aux = NULL;
+	copy->scmd = NULL;
+	copy->cmd1 = NULL;
+	copy->cmd2 = NULL;
+
+	if (c->op != OP_NONE) {
+		copy->cmd1 = copy_tree(c->cmd1, copy, block);
+		if (c->cmd2 != NULL)
+			copy->cmd2 = copy_tree(c->cmd2, copy, block);
+		return copy;
+	}
+
+	simple_command_t *s = take(block, sizeof(*s));
+
+	s->verb = copy_words(c->scmd->verb, block);
+	s->params = copy_words(c->scmd->params, block);
+	s->in = copy_words(c->scmd->in, block);
+	s->out = copy_words(c->scmd->out, block);
+	s->err = copy_words(c->scmd->err, block);
+	s->io_flags = c->scmd->io_flags;
+	s->up = copy;
+	s->aux = NULL;
+	copy->scmd = s;
+
+	return copy;
+}
+
+command_t *parse_tree_copy(command_t *root)
+{
+	char *block = malloc(tree_size(root));
+
+	DIE(block == NULL, "malloc failed\n");
+
+	// the root is the first thing in the block
+	return copy_tree(root, NULL, &block);
+}
+
+/**
+ * Copy a parse tree and its line in a new entry.
+ */
+static struct cache_entry *new_entry(const char *line, size_t length,
+		uint64_t hash, command_t *root)
+{
+	size_t size = ALIGN(sizeof(struct cache_entry)) + ALIGN(length) +
+		tree_size(root);
+	struct cache_entry *e = malloc(size);
+
+	DIE(e == NULL, "malloc failed\n");
+
+	char *block = (char *)e + ALIGN(sizeof(*e));
+	char *line_copy = take(&block, length);
+
+	memcpy(line_copy, line, length);
+	e->line = line_copy;
+	e->length = length;
+	e->hash = hash;
+	e->root = copy_tree(root, NULL, &block);
+
+	// the tree does not change anymore, its plan is compiled only once
+	e->root->aux = plan_compile(e->root);
+
+	return e;
+}
+
+bool parse_cached(const char *line, size_t length, command_t **root)
+{
+	int capacity = cache_capacity();
+
+	// the previous tree does not run anymore
+	free_entry(retired);
+	retired = NULL;
+	in_use = NULL;
+
+	// the capacity may have been lowered since the last line
+	while (nr_entries > capacity)
+		remove_entry(lru_last);
+
+	if (capacity == 0 || length == 0 || length > MAX_CACHED_LENGTH)
+		return parse_line_n(line, length, root);
+
+	uint64_t hash = hash_line(line, length);
+	struct cache_entry *e = find_entry(line, length, hash);
+
+	if (e != NULL) {
+		nr_hits++;
+		lru_unlink(e);
+		lru_push_front(e);
+		in_use = e;
+		*root = e->root;
+		return true;
+	}
+
+	nr_misses++;
+
+	// the errors must be reported every time, so only the lines that
+	// were parsed and are not empty are cached
+	bool parsed = parse_line_n(line, length, root);
+
+	if (!parsed || *root == NULL)
+		return parsed;
+
+	if (seen[hash % NR_SEEN] != hash) {
+		seen[hash % NR_SEEN] = hash;
+		return true;
+	}
+
+	while (nr_entries >= capacity)
+		remove_entry(lru_last);
+
+	e = new_entry(line, length, hash, *root);
+
+	e->bucket_next = buckets[hash % NR_BUCKETS];
+	buckets[hash % NR_BUCKETS] = e;
+	lru_push_front(e);
+	nr_entries++;
+
+	in_use = e;
+	*root = e->root;
+
+	return true;
+}
+
+void parse_cache_print(void)
+{
+	printf("hits %lu misses %lu lines %d/%d\n", nr_hits, nr_misses,
+		nr_entries, cache_capacity());
+}
+
+void parse_cache_flush(void)
+{
+	while (lru_first != NULL)
+		remove_entry(lru_first);
+}
+
+void parse_cache_free(void)
+{
+	parse_cache_flush();
+
+	free_entry(retired);
+	retired = NULL;
+	in_use = NULL;
+}
@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PARSECACHE_H
+#define _PARSECACHE_H
+
+#include <stddef.h>
+
+#include "../util/parser/parser.h"
+
+/*
+ * Cache of the parse trees of the most recently used command lines, so that
+ * a line that was already seen is not lexed and parsed again: a tree is
+ * copied in a single block when it is cached (the second time the line is
+ * seen) and shared, unchanged, by all the runs of the line (variables are
+ * still expanded when it runs).
+ *
+ * MINISHELL_PARSECACHE=N sets the number of lines kept (0 disables it).
+ */
+
+/**
+ * Get the parse tree of the first length characters of line, like
+ * parse_line_n does; free_parse_memory must still be called after running
+ * the tree.
+ * Returns false if there was an error parsing the line.
+ */
+bool parse_cached(const char *line, size_t length, command_t **root);
+
+/**
+ * Copy a parse tree in a single allocation, released with free; the copy
+ * does not depend on the memory of the parser.
+ */
+command_t *parse_tree_copy(command_t *root);
+
+/**
+ * Print the hit and miss counters and the number of cached lines.
+ */
+void parse_cache_print(void);
+
+/**
+ * Drop all the cached trees (the counters are kept).
+ */
+void parse_cache_flush(void);
+
+/**
+ * Release all the memory used by the cache.
+ */
+void parse_cache_free(void);
+
+#endif /* _PARSECACHE_H */
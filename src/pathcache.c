@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "pathcache.h"
+#include "utils.h"
+#include "vars.h"
+
+#define NR_BUCKETS		64
+#define DEFAULT_PATH		"/bin:/usr/bin"
+
+struct path_entry {
+	char *name;
+	char *path;
+	unsigned int hits;
+	struct path_entry *next;
+};
+
+static struct path_entry *buckets[NR_BUCKETS];
+static int nr_entries;
+
+// last location found through a relative directory of $PATH
+static char *uncached_path;
+
+
+static unsigned int hash_name(const char *name)
+{
+	unsigned int hash = 5381;
+
+	while (*name != '\0')
+		hash = hash * 33 + (unsigned char)*name++;
+
+	return hash % NR_BUCKETS;
+}
+
+/**
+ * Check if path is an executable regular file.
+ */
+static bool is_executable(const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) == -1 || !S_ISREG(st.st_mode))
+		return false;
+
+	return access(path, X_OK) == 0;
+}
+
+/**
+ * Search the directories from $PATH for an executable named name.
+ * Returns the allocated absolute path and sets *cacheable to false if it was
+ * found through a relative directory (its meaning changes with cd).
+ */
+static char *search_path(const char *name, bool *cacheable)
+{
+	const char *dirs = vars_get("PATH");
+	size_t name_length = strlen(name);
+
+	if (dirs == NULL)
+		dirs = DEFAULT_PATH;
+
+	while (true) {
+		const char *end = strchr(dirs, ':');
+		size_t dir_length = (end != NULL) ? (size_t)(end - dirs) : strlen(dirs);
+
+		// an empty directory means the current directory
+		char *path = malloc(dir_length + name_length + 3);
+
+		DIE(path == NULL, "malloc failed\n");
+
+		if (dir_length == 0) {
+			strcpy(path, "./");
+		} else {
+			memcpy(path, dirs, dir_length);
+			path[dir_length] = '/';
+			path[dir_length + 1] = '\0';
+		}
+		strcat(path, name);
+
+		if (is_executable(path)) {
+			*cacheable = (path[0] == '/');
+			return path;
+		}
+
+		free(path);
+
+		if (end == NULL)
+			return NULL;
+
+		dirs = end + 1;
+	}
+}
+
+const char *path_lookup(const char *name)
+{
+	// paths are not searched for, just like execvp does
+	if (strchr(name, '/') != NULL)
+		return name;
+
+	unsigned int bucket = hash_name(name);
+
+	for (struct path_entry *e = buckets[bucket]; e != NULL; e = e->next) {
+		if (strcmp(e->name, name) == 0) {
+			e->hits++;
+			return e->path;
+		}
+	}
+
+	// first lookup of this command
+	bool cacheable;
+	char *path = search_path(name, &cacheable);
+
+	if (path == NULL)
+		return NULL;
+
+	// results from relative directories are not kept, they are only
+	// valid until the next lookup
+	if (!cacheable) {
+		free(uncached_path);
+		uncached_path = path;
+		return path;
+	}
+
+	struct path_entry *e = malloc(sizeof(*e));
+
+	DIE(e == NULL, "malloc failed\n");
+
+	e->name = strdup(name);
+	DIE(e->name == NULL, "strdup failed\n");
+	e->path = path;
+	e->hits = 1;
+	e->next = buckets[bucket];
+	buckets[bucket] = e;
+	nr_entries++;
+
+	return e->path;
+}
+
+void path_cache_forget(const char *name)
+{
+	struct path_entry **link = &buckets[hash_name(name)];
+
+	while (*link != NULL) {
+		struct path_entry *e = *link;
+
+		if (strcmp(e->name, name) == 0) {
+			*link = e->next;
+			free(e->name);
+			free(e->path);
+			free(e);
+			nr_entries--;
+			return;
+		}
+
+		link = &e->next;
+	}
+}
+
+void path_cache_flush(void)
+{
+	for (int i = 0; i < NR_BUCKETS; i++) {
+		while (buckets[i] != NULL) {
+			struct path_entry *e = buckets[i];
+
+			buckets[i] = e->next;
+			free(e->name);
+			free(e->path);
+			free(e);
+		}
+	}
+
+	nr_entries = 0;
+}
+
+void path_cache_print(void)
+{
+	if (nr_entries == 0) {
+		printf("hash: hash table empty\n");
+		return;
+	}
+
+	printf("hits\tcommand\n");
+	for (int i = 0; i < NR_BUCKETS; i++) {
+		for (struct path_entry *e = buckets[i]; e != NULL; e = e->next)
+			printf("%4u\t%s\n", e->hits, e->path);
+	}
+}
+
+void path_cache_free(void)
+{
+	path_cache_flush();
+
+	free(uncached_path);
+	uncached_path = NULL;
+}
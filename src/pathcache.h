@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PATHCACHE_H
+#define _PATHCACHE_H
+
+/**
+ * Find the executable a command name refers to, searching the directories
+ * from $PATH; the results are remembered until a flush.
+ * Names that contain a '/' are returned as they are.
+ * Returns NULL if no executable was found.
+ */
+const char *path_lookup(const char *name);
+
+/**
+ * Forget the cached location of a single command (e.g. after it went away).
+ */
+void path_cache_forget(const char *name);
+
+/**
+ * Forget all the cached locations (called when PATH changes).
+ */
+void path_cache_flush(void);
+
+/**
+ * Print the cached locations and their hit counts, like the hash builtin
+ * of bash does.
+ */
+void path_cache_print(void);
+
+/**
+ * Release all the memory used by the cache.
+ */
+void path_cache_free(void);
+
+#endif /* _PATHCACHE_H */
@@ -0,0 +1,305 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <sys/syscall.h>
+
+#include <linux/mempolicy.h>
+
+#include <sched.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "placement.h"
+#include "utils.h"
+#include "vars.h"
+
+#define MAX_DOMAINS		64
+#define MAX_NODES		64
+#define MAX_LIST		4096
+
+enum policy {
+	POLICY_NONE,
+	POLICY_COMPACT,
+	POLICY_SPREAD,
+	POLICY_LIST,
+};
+
+/*
+ * The cache domains and the NUMA nodes of the machine, read from sysfs once:
+ * every CPU is in exactly one domain.
+ */
+static cpu_set_t domains[MAX_DOMAINS];
+static int nr_domains;
+static cpu_set_t nodes[MAX_NODES];
+static int nr_nodes;
+static bool topology_ready;
+
+// the policy parsed from the last value of MINISHELL_PLACEMENT
+static char *policy_value;
+static enum policy policy;
+static cpu_set_t policy_cpus;
+
+// the CPUs chosen for the next children
+static bool pending;
+static cpu_set_t chosen;
+
+
+/**
+ * Parse a CPU list (e.g. 0-3,8) into set.
+ * Returns 0 on success, or -1 if it is not a valid list.
+ */
+static int parse_cpu_list(const char *list, cpu_set_t *set)
+{
+	CPU_ZERO(set);
+
+	for (const char *p = list; *p != '\0' && *p != '\n';) {
+		char *end;
+		long first = strtol(p, &end, 10);
+		long last = first;
+
+		if (end == p || first < 0)
+			return -1;
+
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+				return -1;
+		}
+
+		if (last >= CPU_SETSIZE)
+			return -1;
+
+		for (long cpu = first; cpu <= last; cpu++)
+			CPU_SET(cpu, set);
+
+		p = end;
+		if (*p == ',')
+			p++;
+		else if (*p != '\0' && *p != '\n')
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Read a CPU list from a file of sysfs.
+ * Returns 0 on success, or -1 if the file cannot be read.
+ */
+static int read_cpu_list(const char *path, cpu_set_t *set)
+{
+	FILE *f = fopen(path, "re");
+
+	if (f == NULL)
+		return -1;
+
+	char list[MAX_LIST];
+	int rc = (fgets(list, sizeof(list), f) != NULL) ? parse_cpu_list(list, set) : -1;
+
+	fclose(f);
+
+	return rc;
+}
+
+static void read_topology(void)
+{
+	char path[128];
+	cpu_set_t online;
+
+	topology_ready = true;
+
+	for (nr_nodes = 0; nr_nodes < MAX_NODES; nr_nodes++) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+			nr_nodes);
+		if (read_cpu_list(path, &nodes[nr_nodes]) == -1)
+			break;
+	}
+
+	if (read_cpu_list("/sys/devices/system/cpu/online", &online) == -1)
+		DIE(sched_getaffinity(0, sizeof(online), &online) == -1,
+			"sched_getaffinity failed\n");
+
+	// group the online CPUs by the L3 cache they share
+	for (int cpu = 0; cpu < CPU_SETSIZE && nr_domains < MAX_DOMAINS; cpu++) {
+		if (!CPU_ISSET(cpu, &online))
+			continue;
+
+		bool known = false;
+
+		for (int i = 0; i < nr_domains && !known; i++)
+			known = CPU_ISSET(cpu, &domains[i]);
+
+		if (known)
+			continue;
+
+		cpu_set_t *domain = &domains[nr_domains];
+
+		snprintf(path, sizeof(path),
+			"/sys/devices/system/cpu/cpu%d/cache/index3/shared_cpu_list", cpu);
+		if (read_cpu_list(path, domain) == -1) {
+			// without an L3 cache, the domain is the NUMA node
+			CPU_ZERO(domain);
+			for (int i = 0; i < nr_nodes; i++) {
+				if (CPU_ISSET(cpu, &nodes[i]))
+					*domain = nodes[i];
+			}
+		}
+
+		CPU_SET(cpu, domain);
+		CPU_AND(domain, domain, &online);
+		nr_domains++;
+	}
+}
+
+/**
+ * Parse MINISHELL_PLACEMENT, if it changed since the last time.
+ */
+static void update_policy(void)
+{
+	const char *value = vars_get("MINISHELL_PLACEMENT");
+
+	if (value == NULL) {
+		policy = POLICY_NONE;
+		return;
+	}
+
+	if (policy_value != NULL && strcmp(value, policy_value) == 0)
+		return;
+
+	free(policy_value);
+	policy_value = strdup(value);
+	DIE(policy_value == NULL, "strdup failed\n");
+
+	if (strcmp(value, "compact") == 0) {
+		policy = POLICY_COMPACT;
+	} else if (strcmp(value, "spread") == 0) {
+		policy = POLICY_SPREAD;
+	} else if (parse_cpu_list(value, &policy_cpus) == 0 &&
+			CPU_COUNT(&policy_cpus) > 0) {
+		policy = POLICY_LIST;
+	} else {
+		fprintf(stderr, "placement: %s: invalid policy\n", value);
+		policy = POLICY_NONE;
+	}
+}
+
+/**
+ * Get the n-th CPU of a set (n is taken modulo the size of the set).
+ */
+static int nth_cpu(const cpu_set_t *set, int n)
+{
+	n %= CPU_COUNT(set);
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, set) && n-- == 0)
+			return cpu;
+	}
+
+	return -1;
+}
+
+void placement_select(enum placement_kind kind, int index)
+{
+	pending = false;
+	if (kind == PLACEMENT_NONE)
+		return;
+
+	update_policy();
+	if (policy == POLICY_NONE)
+		return;
+
+	if (policy == POLICY_LIST) {
+		CPU_ZERO(&chosen);
+		CPU_SET(nth_cpu(&policy_cpus, index), &chosen);
+		pending = true;
+		return;
+	}
+
+	if (!topology_ready)
+		read_topology();
+
+	// only the part of the domains this shell may run on (e.g. a job of
+	// a chain that runs a pipeline) counts
+	cpu_set_t allowed;
+	cpu_set_t usable[MAX_DOMAINS];
+	int nr_usable = 0;
+	int nr_cpus = 0;
+
+	DIE(sched_getaffinity(0, sizeof(allowed), &allowed) == -1,
+		"sched_getaffinity failed\n");
+
+	for (int i = 0; i < nr_domains; i++) {
+		CPU_AND(&usable[nr_usable], &domains[i], &allowed);
+		if (CPU_COUNT(&usable[nr_usable]) > 0)
+			nr_cpus += CPU_COUNT(&usable[nr_usable++]);
+	}
+
+	if (nr_usable == 0)
+		return;
+
+	// spread: a job per domain, in turn
+	if (kind == PLACEMENT_JOB && policy == POLICY_SPREAD) {
+		chosen = usable[index % nr_usable];
+		pending = true;
+		return;
+	}
+
+	// compact: a domain is only used once the ones before it are full
+	int slot = index % nr_cpus;
+	int i = 0;
+
+	while (slot >= CPU_COUNT(&usable[i]))
+		slot -= CPU_COUNT(&usable[i++]);
+
+	chosen = usable[i];
+	pending = true;
+}
+
+bool placement_pending(void)
+{
+	return pending;
+}
+
+/**
+ * Prefer the NUMA node of the first chosen CPU for the memory of the current
+ * process.
+ */
+static void prefer_local_node(void)
+{
+	int cpu = nth_cpu(&chosen, 0);
+
+	for (int i = 0; i < nr_nodes && i < (int)(8 * sizeof(unsigned long)); i++) {
+		if (!CPU_ISSET(cpu, &nodes[i]))
+			continue;
+
+		unsigned long mask = 1UL << i;
+
+		syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, 8 * sizeof(mask));
+		return;
+	}
+}
+
+void placement_apply(void)
+{
+	if (!pending)
+		return;
+
+	// the children of this process inherit the placement
+	pending = false;
+
+	// CPUs the command may not use (e.g. because of a cpuset) just leave
+	// it where it is
+	sched_setaffinity(0, sizeof(chosen), &chosen);
+
+	const char *memory = vars_get("MINISHELL_PLACEMENT_MEMORY");
+
+	if (memory != NULL && strcmp(memory, "local") == 0) {
+		if (!topology_ready)
+			read_topology();
+
+		prefer_local_node();
+	}
+}
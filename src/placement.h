@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PLACEMENT_H
+#define _PLACEMENT_H
+
+#include "../util/parser/parser.h"
+
+/*
+ * CPU placement of the stages of the pipelines and of the jobs of the
+ * parallel chains, set by MINISHELL_PLACEMENT:
+ *	compact		the stages and the jobs are packed into as few cache
+ *			domains (CPUs that share an L3 cache, or a NUMA node)
+ *			as possible
+ *	spread		the adjacent stages of a pipeline still share a
+ *			domain, but the jobs of a chain go to different ones
+ *	a CPU list	e.g. 0-3,8: the i-th stage or job runs on the i-th CPU
+ *			of the list
+ * The affinity is installed in the child (sched_setaffinity), before it
+ * runs the command; with MINISHELL_PLACEMENT_MEMORY=local, the memory of
+ * the command is preferably allocated on the NUMA node of its CPUs too.
+ * Only the CPUs the shell may run on are used.
+ */
+
+enum placement_kind {
+	PLACEMENT_NONE,
+	PLACEMENT_STAGE,	/* a stage of a pipeline */
+	PLACEMENT_JOB,		/* a job of a parallel chain */
+};
+
+/**
+ * Choose the CPUs of the next children: the ones of the index-th stage or
+ * job (nothing if no placement is set, or for PLACEMENT_NONE).
+ */
+void placement_select(enum placement_kind kind, int index);
+
+/**
+ * Check if CPUs were chosen for the next children.
+ */
+bool placement_pending(void);
+
+/**
+ * Install the chosen CPUs (and memory policy) in the current (child)
+ * process; nothing is chosen for its own children then.
+ */
+void placement_apply(void);
+
+#endif /* _PLACEMENT_H */
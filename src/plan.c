@@ -0,0 +1,531 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "fdcache.h"
+#include "plan.h"
+#include "stats.h"
+#include "utils.h"
+
+
+/**
+ * Count the operands of a chain of op operators (the nodes of the op
+ * subtree that have a different operator).
+ */
+static int count_operands(command_t *c, operator_t op)
+{
+	if (c->op != op)
+		return 1;
+
+	return count_operands(c->cmd1, op) + count_operands(c->cmd2, op);
+}
+
+/**
+ * Check if all the words of a list are literals made of a single part, so
+ * that they can be used as they are in argv.
+ */
+static bool literal_words(word_t *w)
+{
+	for (; w != NULL; w = w->next_word) {
+		if (w->expand == true || w->next_part != NULL)
+			return false;
+	}
+
+	return true;
+}
+
+static int count_words(word_t *w)
+{
+	int count = 0;
+
+	for (; w != NULL; w = w->next_word)
+		count++;
+
+	return count;
+}
+
+/**
+ * Get the number of argv slots the simple command needs in the plan.
+ */
+static int argv_slots(simple_command_t *s)
+{
+	if (!literal_words(s->verb) || !literal_words(s->params))
+		return 0;
+
+	return 1 + count_words(s->params) + 1;
+}
+
+static void count_plan(command_t *c, int *nr_nodes, int *nr_slots);
+
+/**
+ * Count the nodes of the operands of a chain of op operators (and of their
+ * job nodes, for a parallel chain).
+ */
+static void count_operand_nodes(command_t *c, operator_t op, int *nr_nodes,
+		int *nr_slots)
+{
+	if (c->op == op) {
+		count_operand_nodes(c->cmd1, op, nr_nodes, nr_slots);
+		count_operand_nodes(c->cmd2, op, nr_nodes, nr_slots);
+		return;
+	}
+
+	if (op == OP_PARALLEL)
+		*nr_nodes += 1;
+
+	count_plan(c, nr_nodes, nr_slots);
+}
+
+/**
+ * Count the nodes and the argv slots the plan of a tree needs.
+ */
+static void count_plan(command_t *c, int *nr_nodes, int *nr_slots)
+{
+	switch (c->op) {
+	case OP_NONE:
+		*nr_nodes += 1;
+		*nr_slots += argv_slots(c->scmd);
+		break;
+
+	case OP_SEQUENTIAL:
+		count_plan(c->cmd1, nr_nodes, nr_slots);
+		count_plan(c->cmd2, nr_nodes, nr_slots);
+		break;
+
+	case OP_CONDITIONAL_ZERO:
+	case OP_CONDITIONAL_NZERO:
+		// the jump between the two commands
+		*nr_nodes += 1;
+		count_plan(c->cmd1, nr_nodes, nr_slots);
+		count_plan(c->cmd2, nr_nodes, nr_slots);
+		break;
+
+	case OP_PIPE:
+	case OP_PARALLEL:
+		*nr_nodes += 1;
+		count_operand_nodes(c, c->op, nr_nodes, nr_slots);
+		break;
+
+	case OP_BACKGROUND:
+		*nr_nodes += 1;
+		count_plan(c->cmd1, nr_nodes, nr_slots);
+		break;
+
+	default:
+		break;
+	}
+}
+
+struct compiler {
+	plan_t *plan;
+	int pos;
+	char **slots;
+};
+
+static int add_node(struct compiler *cc, plan_op_t op)
+{
+	plan_node_t *n = &cc->plan->nodes[cc->pos];
+
+	memset(n, 0, sizeof(*n));
+	n->op = op;
+
+	return cc->pos++;
+}
+
+static void add_redirect(plan_node_t *n, int fd, word_t *file, int flags)
+{
+	struct plan_redirect *r = &n->redirects[n->nr_redirects++];
+
+	r->fd = fd;
+	r->file = file;
+	r->flags = flags;
+}
+
+/**
+ * Decode the redirections of a simple command; when both stdout and
+ * stderr are redirected (e.g. &>), stdout is appended to, so that both
+ * outputs are kept in the same file.
+ */
+static void classify_redirects(plan_node_t *n, simple_command_t *s)
+{
+	int out_mode = (s->io_flags & IO_OUT_APPEND) ? O_APPEND : O_TRUNC;
+	int err_mode = (s->io_flags & IO_ERR_APPEND) ? O_APPEND : O_TRUNC;
+
+	if (s->in != NULL)
+		add_redirect(n, 0, s->in, O_RDONLY);
+
+	if (s->out != NULL && s->err != NULL) {
+		out_mode = O_APPEND;
+		err_mode = O_TRUNC;
+	}
+
+	if (s->out != NULL)
+		add_redirect(n, 1, s->out, O_WRONLY | O_CREAT | out_mode);
+
+	if (s->err != NULL)
+		add_redirect(n, 2, s->err, O_WRONLY | O_CREAT | err_mode);
+}
+
+static bool is_literal(word_t *w, const char *string)
+{
+	return w->next_part == NULL && w->expand == false &&
+		strcmp(w->string, string) == 0;
+}
+
+/**
+ * Parse the duration of a timeout.
+ * Returns false if it is not one.
+ */
+static bool parse_duration(word_t *w, long long *ns)
+{
+	if (w->next_part != NULL || w->expand == true)
+		return false;
+
+	char *end;
+	double seconds = strtod(w->string, &end);
+
+	// inf and nan are read by strtod too
+	if (end == w->string || !isfinite(seconds) || seconds < 0)
+		return false;
+
+	switch (*end) {
+	case 'd':
+		seconds *= 24;
+		/* fall through */
+	case 'h':
+		seconds *= 60;
+		/* fall through */
+	case 'm':
+		seconds *= 60;
+		/* fall through */
+	case 's':
+		end++;
+		break;
+	}
+
+	if (*end != '\0' || seconds * 1e9 >= (double)LLONG_MAX)
+		return false;
+
+	*ns = (long long)(seconds * 1e9);
+
+	return true;
+}
+
+/**
+ * Take the time and timeout N prefixes off a simple command; the node keeps
+ * what they ask for and the command that is left.
+ */
+static simple_command_t *strip_prefixes(plan_node_t *n, simple_command_t *s)
+{
+	word_t *verb = s->verb;
+	word_t *params = s->params;
+	long long timeout;
+
+	for (;;) {
+		if (params != NULL && is_literal(verb, "time")) {
+			n->timed = true;
+			verb = params;
+			params = params->next_word;
+		} else if (params != NULL && params->next_word != NULL &&
+				is_literal(verb, "timeout") &&
+				parse_duration(params, &timeout)) {
+			n->timeout_ns = timeout;
+			verb = params->next_word;
+			params = verb->next_word;
+		} else {
+			break;
+		}
+	}
+
+	if (verb == s->verb)
+		return s;
+
+	n->bare_scmd = *s;
+	n->bare_scmd.verb = verb;
+	n->bare_scmd.params = params;
+
+	return &n->bare_scmd;
+}
+
+static void compile_simple(struct compiler *cc, command_t *c)
+{
+	plan_node_t *n = &cc->plan->nodes[add_node(cc, PLAN_SIMPLE)];
+	simple_command_t *s = strip_prefixes(n, c->scmd);
+
+	n->cmd = c;
+	n->scmd = s;
+	n->builtin = builtin_lookup(s->verb);
+
+	if (n->builtin != NULL)
+		n->kind = SIMPLE_BUILTIN;
+	else if (s->verb->next_part != NULL)
+		n->kind = SIMPLE_ASSIGNMENT;
+	else
+		n->kind = SIMPLE_EXTERNAL;
+
+	classify_redirects(n, s);
+
+	if (argv_slots(s) == 0)
+		return;
+
+	// the literal words are used straight from the tree
+	n->argv = cc->slots;
+	n->argv[n->argc++] = (char *)s->verb->string;
+
+	for (word_t *w = s->params; w != NULL; w = w->next_word)
+		n->argv[n->argc++] = (char *)w->string;
+
+	n->argv[n->argc] = NULL;
+	cc->slots += n->argc + 1;
+}
+
+static void compile(struct compiler *cc, command_t *c);
+
+/**
+ * Compile the operands of a chain of op operators, from left to right; every
+ * job of a parallel chain is preceded by its job node.
+ */
+static void compile_operands(struct compiler *cc, command_t *c, operator_t op)
+{
+	if (c->op == op) {
+		compile_operands(cc, c->cmd1, op);
+		compile_operands(cc, c->cmd2, op);
+		return;
+	}
+
+	if (op != OP_PARALLEL) {
+		compile(cc, c);
+		return;
+	}
+
+	int job = add_node(cc, PLAN_JOB);
+
+	compile(cc, c);
+	cc->plan->nodes[job].next = cc->pos;
+}
+
+static void compile(struct compiler *cc, command_t *c)
+{
+	int i;
+
+	switch (c->op) {
+	case OP_NONE:
+		compile_simple(cc, c);
+		break;
+
+	case OP_SEQUENTIAL:
+		compile(cc, c->cmd1);
+		compile(cc, c->cmd2);
+		break;
+
+	case OP_CONDITIONAL_ZERO:
+	case OP_CONDITIONAL_NZERO:
+		compile(cc, c->cmd1);
+
+		// && skips the second command if the first one failed
+		i = add_node(cc, (c->op == OP_CONDITIONAL_ZERO) ?
+				PLAN_JUMP_NZERO : PLAN_JUMP_ZERO);
+		compile(cc, c->cmd2);
+		cc->plan->nodes[i].next = cc->pos;
+		break;
+
+	case OP_PIPE:
+	case OP_PARALLEL:
+		i = add_node(cc, (c->op == OP_PIPE) ? PLAN_PIPELINE : PLAN_PARALLEL);
+		cc->plan->nodes[i].count = count_operands(c, c->op);
+		compile_operands(cc, c, c->op);
+		cc->plan->nodes[i].next = cc->pos;
+		break;
+
+	case OP_BACKGROUND:
+		i = add_node(cc, PLAN_BACKGROUND);
+		cc->plan->nodes[i].cmd = c;
+		compile(cc, c->cmd1);
+		cc->plan->nodes[i].next = cc->pos;
+		break;
+
+	default:
+		break;
+	}
+}
+
+plan_t *plan_compile(command_t *root)
+{
+	int nr_nodes = 0;
+	int nr_slots = 0;
+
+	count_plan(root, &nr_nodes, &nr_slots);
+
+	plan_t *plan = malloc(sizeof(*plan) + nr_nodes * sizeof(plan_node_t) +
+			nr_slots * sizeof(char *));
+
+	DIE(plan == NULL, "malloc failed\n");
+
+	plan->nr_nodes = nr_nodes;
+	plan->nodes = (plan_node_t *)(plan + 1);
+
+	struct compiler cc = {
+		.plan = plan,
+		.pos = 0,
+		.slots = (char **)(plan->nodes + nr_nodes),
+	};
+
+	compile(&cc, root);
+
+	return plan;
+}
+
+void plan_free(plan_t *plan)
+{
+	free(plan);
+}
+
+char **plan_get_argv(const plan_node_t *n)
+{
+	if (n->argv != NULL)
+		return n->argv;
+
+	long long start = stats_now();
+	int argc;
+	char **argv = get_argv(n->scmd, &argc);
+
+	stats_add(STATS_EXPAND, start);
+
+	return argv;
+}
+
+void plan_put_argv(const plan_node_t *n, char **argv)
+{
+	if (argv != n->argv)
+		free(argv);
+}
+
+int plan_open_redirect(const struct plan_redirect *r)
+{
+	long long start = stats_now();
+	char *filename = get_word(r->file);
+
+	stats_add(STATS_EXPAND, start);
+
+	// the descriptor must not leak into the other children of the shell;
+	// dup2 to its target clears the close-on-exec flag
+	int fd = fd_cache_get(filename, r->flags);
+
+	if (fd == -1) {
+		fd = open(filename, r->flags | O_CLOEXEC, 0644);
+		if (fd != -1)
+			fd_cache_put(filename, fd, r->flags);
+	}
+
+	if (fd == -1)
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+
+	free(filename);
+
+	return fd;
+}
+
+int plan_open_redirects(const plan_node_t *n, int *fds)
+{
+	for (int i = 0; i < n->nr_redirects; i++) {
+		fds[i] = plan_open_redirect(&n->redirects[i]);
+		if (fds[i] != -1)
+			continue;
+
+		while (i > 0)
+			close(fds[--i]);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static void print_word(word_t *w, FILE *out)
+{
+	fputc(' ', out);
+
+	for (word_t *part = w; part != NULL; part = part->next_part) {
+		if (part->expand == true)
+			fprintf(out, "${%s}", part->string);
+		else
+			fputs(part->string, out);
+	}
+}
+
+static void print_words(word_t *w, FILE *out)
+{
+	for (; w != NULL; w = w->next_word)
+		print_word(w, out);
+}
+
+static void print_simple(plan_node_t *n, FILE *out)
+{
+	static const char * const kinds[] = {
+		[SIMPLE_EXTERNAL] = "external",
+		[SIMPLE_BUILTIN] = "builtin",
+		[SIMPLE_ASSIGNMENT] = "assignment",
+	};
+
+	fprintf(out, "simple %s%s%s", kinds[n->kind],
+		(n->argv != NULL) ? " literal" : "", n->timed ? " timed" : "");
+
+	if (n->timeout_ns != 0)
+		fprintf(out, " timeout %.3fs", n->timeout_ns / 1e9);
+
+	print_word(n->scmd->verb, out);
+	print_words(n->scmd->params, out);
+
+	for (int i = 0; i < n->nr_redirects; i++) {
+		struct plan_redirect *r = &n->redirects[i];
+
+		if (r->fd == 0)
+			fprintf(out, " <");
+		else
+			fprintf(out, " %s%s", (r->fd == 2) ? "2>" : ">",
+				(r->flags & O_APPEND) ? ">" : "");
+
+		print_words(r->file, out);
+	}
+}
+
+void plan_print(plan_t *plan, FILE *out)
+{
+	for (int i = 0; i < plan->nr_nodes; i++) {
+		plan_node_t *n = &plan->nodes[i];
+
+		fprintf(out, "%4d  ", i);
+
+		switch (n->op) {
+		case PLAN_SIMPLE:
+			print_simple(n, out);
+			break;
+		case PLAN_PIPELINE:
+			fprintf(out, "pipeline %d stages, next %d", n->count, n->next);
+			break;
+		case PLAN_PARALLEL:
+			fprintf(out, "parallel %d jobs, next %d", n->count, n->next);
+			break;
+		case PLAN_JOB:
+			fprintf(out, "job, next %d", n->next);
+			break;
+		case PLAN_JUMP_ZERO:
+			fprintf(out, "jump to %d if zero", n->next);
+			break;
+		case PLAN_JUMP_NZERO:
+			fprintf(out, "jump to %d if not zero", n->next);
+			break;
+		case PLAN_BACKGROUND:
+			fprintf(out, "background, next %d", n->next);
+			break;
+		}
+
+		fputc('\n', out);
+	}
+}
@@ -0,0 +1,123 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PLAN_H
+#define _PLAN_H
+
+#include <stdio.h>
+
+#include "../util/parser/parser.h"
+#include "builtin.h"
+
+/*
+ * A command plan is a parse tree lowered into a flat array of nodes, which
+ * the executor runs in order instead of walking the tree:
+ *	a ; b		a, b
+ *	a && b		a, JUMP_NZERO past b, b
+ *	a || b		a, JUMP_ZERO past b, b
+ *	a | b | c	PIPELINE (3 stages), a, b, c
+ *	a & b		PARALLEL (2 jobs), JOB, a, JOB, b
+ *	a &		BACKGROUND, a
+ *
+ * Everything that does not depend on the environment is decided when the
+ * plan is compiled: the kind of every simple command, its argv (when all its
+ * words are literals) and the open modes of its redirections. A simple
+ * command prefixed by time or by timeout N (seconds, or N followed by s, m,
+ * h or d) is compiled as the command itself, marked timed or given a
+ * timeout.
+ */
+
+typedef enum {
+	PLAN_SIMPLE,		/* run a simple command */
+	PLAN_PIPELINE,		/* the next count nodes are the stages */
+	PLAN_PARALLEL,		/* followed by count jobs */
+	PLAN_JOB,		/* a job of a parallel chain, up to next */
+	PLAN_JUMP_ZERO,		/* go to next if the last exit code is 0 */
+	PLAN_JUMP_NZERO,	/* go to next if the last exit code is not 0 */
+	PLAN_BACKGROUND,	/* start the nodes up to next, without waiting */
+} plan_op_t;
+
+typedef enum {
+	SIMPLE_EXTERNAL,
+	SIMPLE_BUILTIN,
+	SIMPLE_ASSIGNMENT,
+} simple_kind_t;
+
+#define MAX_REDIRECTIONS	3
+
+/* A redirection of a simple command: file is installed as fd. */
+struct plan_redirect {
+	int fd;
+	word_t *file;
+	int flags;
+};
+
+typedef struct plan_node {
+	plan_op_t op;
+
+	// PLAN_PIPELINE, PLAN_PARALLEL: the number of stages / jobs
+	int count;
+
+	// the node after this one's stages / jobs / background command, or the
+	// target of a jump
+	int next;
+
+	// PLAN_SIMPLE
+	command_t *cmd;
+	simple_command_t *scmd;
+	simple_kind_t kind;
+	const struct builtin *builtin;
+	int argc;
+	char **argv;		/* NULL if it must be built when it runs */
+	int nr_redirects;
+	struct plan_redirect redirects[MAX_REDIRECTIONS];
+
+	// time / timeout N prefixes: scmd is bare_scmd, the command without them
+	bool timed;
+	long long timeout_ns;	/* 0 if there is no deadline */
+	simple_command_t bare_scmd;
+} plan_node_t;
+
+typedef struct {
+	int nr_nodes;
+	plan_node_t *nodes;
+} plan_t;
+
+/**
+ * Lower a parse tree into a plan (a single allocation, released with
+ * plan_free); the plan points into the tree, which must outlive it.
+ */
+plan_t *plan_compile(command_t *root);
+
+void plan_free(plan_t *plan);
+
+/**
+ * Get the argv of a simple command node: the one built when the plan was
+ * compiled, or a new one (with the variables expanded now).
+ * Release it with plan_put_argv.
+ */
+char **plan_get_argv(const plan_node_t *n);
+
+void plan_put_argv(const plan_node_t *n, char **argv);
+
+/**
+ * Open the file of a redirection (its variables are expanded now).
+ * Returns the file descriptor, or -1 if the file could not be opened (the
+ * error is reported).
+ */
+int plan_open_redirect(const struct plan_redirect *r);
+
+/**
+ * Open the files of all the redirections of a node, in the shell (so that
+ * the ones the fd cache keeps are kept by the shell); fds[i] is the file of
+ * n->redirects[i].
+ * Returns 0 on success, or -1 if a file could not be opened (the files that
+ * were already opened are closed).
+ */
+int plan_open_redirects(const plan_node_t *n, int *fds);
+
+/**
+ * Print the nodes of a plan, one per line (mini-shell --explain).
+ */
+void plan_print(plan_t *plan, FILE *out);
+
+#endif /* _PLAN_H */
@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "reader.h"
+
+/*
+ * The line buffer is kept from one call to the next; getline() grows it
+ * (by doubling) only when a longer line shows up and appends to it in
+ * linear time, the length of the line being tracked instead of searched.
+ * It shrinks back once none of the last READER_WINDOW lines needed it, so
+ * that a single huge line does not keep its memory for the whole session.
+ */
+#define READER_WINDOW		16
+#define READER_KEEP_SIZE	(64 * 1024)
+
+static char *line;
+static size_t line_size;
+static size_t peak_size;
+
+static size_t recent_lengths[READER_WINDOW];
+static unsigned long nr_lines;
+
+
+/**
+ * Shrink the buffer to the longest of the last lines (at least
+ * READER_KEEP_SIZE is kept).
+ */
+static void shrink_buffer(void)
+{
+	size_t longest = 0;
+
+	for (int i = 0; i < READER_WINDOW; i++) {
+		if (recent_lengths[i] > longest)
+			longest = recent_lengths[i];
+	}
+
+	size_t size = (longest + 1 > READER_KEEP_SIZE) ? longest + 1 : READER_KEEP_SIZE;
+
+	if (line_size <= READER_KEEP_SIZE || line_size / 2 < size)
+		return;
+
+	char *smaller = realloc(line, size);
+
+	// the buffer is only kept bigger if it cannot be moved
+	if (smaller == NULL)
+		return;
+
+	line = smaller;
+	line_size = size;
+}
+
+char *read_line(void)
+{
+	shrink_buffer();
+
+	ssize_t line_length = getline(&line, &line_size, stdin);
+
+	if (line_length == -1)
+		return NULL;
+
+	recent_lengths[nr_lines++ % READER_WINDOW] = line_length;
+	if (line_size > peak_size)
+		peak_size = line_size;
+
+	if (line_length > 0 && line[line_length - 1] == '\n') {
+		if (line_length > 1 && line[line_length - 2] == '\r')
+			/* Windows */
+			line_length--;
+		line_length--;
+	}
+	line[line_length] = '\0';
+
+	return line;
+}
+
+size_t reader_buffer_size(void)
+{
+	return line_size;
+}
+
+size_t reader_buffer_peak(void)
+{
+	return peak_size;
+}
+
+void reader_free(void)
+{
+	free(line);
+	line = NULL;
+	line_size = 0;
+}
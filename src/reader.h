@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _READER_H
+#define _READER_H
+
+#include <stddef.h>
+
+/**
+ * Read a line from the standard input, without the line terminator.
+ * The returned buffer belongs to the reader and is reused by the next call
+ * (it shrinks back after a long line, see reader.c).
+ * Returns NULL if the end of the input was reached.
+ */
+char *read_line(void);
+
+/**
+ * Size of the buffer the lines are read into.
+ */
+size_t reader_buffer_size(void);
+
+/**
+ * Largest size the buffer had.
+ */
+size_t reader_buffer_peak(void);
+
+/**
+ * Release the buffer of the reader.
+ */
+void reader_free(void);
+
+#endif /* _READER_H */
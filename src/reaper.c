@@ -0,0 +1,496 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <linux/sched.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <time.h>
+
+#include "cgroup.h"
+#include "parseahead.h"
+#include "reaper.h"
+#include "trace.h"
+#include "utils.h"
+
+#define MAX_EVENTS		32
+#define MAX_NAME		64
+
+struct child {
+	pid_t pid;
+	int pidfd;
+	int group;
+	char name[MAX_NAME];
+	bool done;
+	int status;
+	long long start_ns;
+	struct child_usage usage;
+	pid_t pgid;
+	long long deadline;	/* 0 if there is none */
+	bool timed_out;
+	struct child *prev;
+	struct child *next;
+};
+
+static struct child *children;
+static int epoll_fd = -1;
+static int last_group;
+
+// expires at the earliest deadline of the children
+static int timer_fd = -1;
+static long long armed_deadline;
+
+// pidfd_open is not available (old kernel), fall back to waitpid(-1)
+static bool no_pidfd;
+
+
+static int pidfd_open(pid_t pid)
+{
+	return syscall(SYS_pidfd_open, pid, 0);
+}
+
+int reaper_new_group(void)
+{
+	return ++last_group;
+}
+
+static struct child *find_child(pid_t pid)
+{
+	for (struct child *c = children; c != NULL; c = c->next) {
+		if (c->pid == pid)
+			return c;
+	}
+
+	return NULL;
+}
+
+/**
+ * Stop tracking a child and release its entry.
+ */
+static void remove_child(struct child *c)
+{
+	if (c->pidfd != -1) {
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->pidfd, NULL);
+		close(c->pidfd);
+	}
+
+	if (c->prev != NULL)
+		c->prev->next = c->next;
+	else
+		children = c->next;
+
+	if (c->next != NULL)
+		c->next->prev = c->prev;
+
+	free(c);
+}
+
+void reaper_track(pid_t pid, int group, const char *name)
+{
+	struct child *c = malloc(sizeof(*c));
+
+	DIE(c == NULL, "malloc failed\n");
+
+	c->pid = pid;
+	c->pidfd = -1;
+	c->group = group;
+	snprintf(c->name, sizeof(c->name), "%s", name);
+	c->done = false;
+	c->status = 0;
+	c->start_ns = stats_now();
+	c->pgid = 0;
+	c->deadline = 0;
+	c->timed_out = false;
+
+	if (!no_pidfd) {
+		if (epoll_fd == -1) {
+			epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+			DIE(epoll_fd == -1, "epoll_create1 failed\n");
+		}
+
+		c->pidfd = pidfd_open(pid);
+		if (c->pidfd == -1) {
+			DIE(errno != ENOSYS, "pidfd_open failed\n");
+			no_pidfd = true;
+		}
+	}
+
+	// the pidfd becomes readable when the child terminates
+	if (c->pidfd != -1) {
+		struct epoll_event ev = {
+			.events = EPOLLIN,
+			.data.ptr = c,
+		};
+
+		DIE(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->pidfd, &ev) == -1,
+			"epoll_ctl failed\n");
+	}
+
+	c->prev = NULL;
+	c->next = children;
+	if (children != NULL)
+		children->prev = c;
+	children = c;
+}
+
+void reaper_deadline(pid_t pid, pid_t pgid, long long deadline)
+{
+	struct child *c = find_child(pid);
+
+	DIE(c == NULL, "deadline for an unknown child\n");
+
+	c->pgid = pgid;
+	c->deadline = deadline;
+
+	if (no_pidfd || timer_fd != -1)
+		return;
+
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	DIE(timer_fd == -1, "timerfd_create failed\n");
+
+	// the timer is told apart from the pidfds by its pointer
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = &timer_fd,
+	};
+
+	DIE(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) == -1,
+		"epoll_ctl failed\n");
+}
+
+/**
+ * Get the earliest deadline of the children that are still running, 0 if
+ * there is none.
+ */
+static long long earliest_deadline(void)
+{
+	long long deadline = 0;
+
+	for (struct child *c = children; c != NULL; c = c->next) {
+		if (c->done || c->timed_out || c->deadline == 0)
+			continue;
+
+		if (deadline == 0 || c->deadline < deadline)
+			deadline = c->deadline;
+	}
+
+	return deadline;
+}
+
+/**
+ * Set the timer to the earliest deadline (or disarm it).
+ */
+static void arm_timer(void)
+{
+	long long deadline = earliest_deadline();
+
+	if (timer_fd == -1 || deadline == armed_deadline)
+		return;
+
+	// a deadline of 0 disarms the timer
+	struct itimerspec its = {
+		.it_value.tv_sec = deadline / 1000000000LL,
+		.it_value.tv_nsec = deadline % 1000000000LL,
+	};
+
+	DIE(timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1,
+		"timerfd_settime failed\n");
+	armed_deadline = deadline;
+}
+
+/**
+ * Kill the children whose deadline passed; all the members of the process
+ * group of a child are killed at once (e.g. all the stages of a pipeline).
+ */
+static void expire_deadlines(void)
+{
+	long long now = stats_now();
+
+	for (struct child *c = children; c != NULL; c = c->next) {
+		if (c->done || c->timed_out || c->deadline == 0 || c->deadline > now)
+			continue;
+
+		kill((c->pgid != 0) ? -c->pgid : c->pid, SIGKILL);
+
+		for (struct child *other = children; other != NULL; other = other->next) {
+			if (other == c || (c->pgid != 0 && other->pgid == c->pgid))
+				other->timed_out = true;
+		}
+	}
+}
+
+/**
+ * Create a child process, straight in the cgroup of the commands if there is
+ * one.
+ */
+static pid_t fork_child(void)
+{
+	int cgroup = cgroup_fd();
+
+	if (cgroup == -1)
+		return fork();
+
+	// clone3 skips what fork does for the other threads (e.g. resetting
+	// the locks of malloc), so it is only used while there are none
+	if (!parse_ahead_running()) {
+		struct clone_args args = {
+			.flags = CLONE_INTO_CGROUP,
+			.exit_signal = SIGCHLD,
+			.cgroup = cgroup,
+		};
+		pid_t pid = syscall(SYS_clone3, &args, sizeof(args));
+
+		if (pid != -1 || (errno != ENOSYS && errno != E2BIG && errno != EINVAL))
+			return pid;
+	}
+
+	// no clone3 or no CLONE_INTO_CGROUP (before Linux 5.7): the child
+	// moves itself, before it runs anything
+	pid_t pid = fork();
+
+	if (pid == 0)
+		cgroup_join();
+
+	return pid;
+}
+
+pid_t reaper_fork(void)
+{
+	pid_t pid = fork_child();
+
+	if (pid != 0)
+		return pid;
+
+	// the children of the shell are not the children of this process;
+	// the epoll instance is shared with the shell and must be left alone
+	while (children != NULL) {
+		struct child *c = children;
+
+		children = c->next;
+		if (c->pidfd != -1)
+			close(c->pidfd);
+		free(c);
+	}
+
+	if (epoll_fd != -1) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+
+	if (timer_fd != -1) {
+		close(timer_fd);
+		timer_fd = -1;
+		armed_deadline = 0;
+	}
+
+	// the input of the shell stays with the shell: a child that exits
+	// without exec must not seek the shared offset back to its read-ahead
+	__fpurge(stdin);
+
+	trace_forked();
+
+	return pid;
+}
+
+/**
+ * Record the termination of a child, whose status and resource usage were
+ * just collected.
+ */
+static void child_done(struct child *c)
+{
+	c->done = true;
+	c->usage.wall_ns = stats_now() - c->start_ns;
+
+	if (c->timed_out)
+		c->status = W_EXITCODE(EXIT_TIMED_OUT, 0);
+
+	if (stats_fd != -1)
+		stats_child(c->name, c->pid, c->status, &c->usage);
+
+	TRACE_SPAN(c->name, c->pid, c->start_ns, c->usage.wall_ns);
+}
+
+/**
+ * Collect the status of a child that terminated.
+ */
+static void child_terminated(struct child *c)
+{
+	DIE(wait4(c->pid, &c->status, 0, &c->usage.rusage) == -1,
+		"wait4 failed\n");
+	child_done(c);
+
+	// the pidfd will not be needed anymore
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->pidfd, NULL);
+	close(c->pidfd);
+	c->pidfd = -1;
+}
+
+/**
+ * Collect all the terminations that are ready; if block is set, wait until
+ * at least one more tracked child terminates first.
+ */
+static void wait_events(bool block)
+{
+	long long start = stats_now();
+
+	if (block)
+		TRACE_BEGIN("wait");
+
+	if (no_pidfd) {
+		struct rusage rusage;
+		int status;
+		pid_t pid;
+
+		// without pidfds the deadlines can only be polled for
+		for (;;) {
+			bool poll = !block || earliest_deadline() != 0;
+
+			pid = wait4(-1, &status, poll ? WNOHANG : 0, &rusage);
+			if (pid == -1 && errno == EINTR)
+				continue;
+
+			if (pid != 0 || !block)
+				break;
+
+			struct timespec poll_interval = { .tv_nsec = 1000000 };
+
+			expire_deadlines();
+			nanosleep(&poll_interval, NULL);
+		}
+
+		// there is nothing to collect without blocking
+		if (pid <= 0 && !block)
+			return;
+
+		DIE(pid == -1, "wait4 failed\n");
+		stats_add(STATS_WAIT, start);
+
+		struct child *c = find_child(pid);
+
+		if (c != NULL) {
+			c->status = status;
+			c->usage.rusage = rusage;
+			child_done(c);
+		}
+
+		if (block)
+			TRACE_END("wait");
+		return;
+	}
+
+	struct epoll_event events[MAX_EVENTS];
+	int nr_events;
+
+	arm_timer();
+
+	do {
+		nr_events = epoll_wait(epoll_fd, events, MAX_EVENTS, block ? -1 : 0);
+	} while (nr_events == -1 && errno == EINTR);
+
+	DIE(nr_events == -1, "epoll_wait failed\n");
+	stats_add(STATS_WAIT, start);
+
+	for (int i = 0; i < nr_events; i++) {
+		if (events[i].data.ptr != &timer_fd) {
+			child_terminated(events[i].data.ptr);
+			continue;
+		}
+
+		uint64_t expirations;
+
+		if (read(timer_fd, &expirations, sizeof(expirations)) != -1)
+			armed_deadline = 0;
+
+		expire_deadlines();
+	}
+
+	if (block)
+		TRACE_END("wait");
+}
+
+int reaper_wait(pid_t pid)
+{
+	struct child *c = find_child(pid);
+
+	DIE(c == NULL, "waiting for an unknown child\n");
+
+	while (!c->done)
+		wait_events(true);
+
+	int status = c->status;
+
+	remove_child(c);
+
+	return status;
+}
+
+int reaper_try_wait(pid_t pid, int *status)
+{
+	struct child *c = find_child(pid);
+
+	DIE(c == NULL, "waiting for an unknown child\n");
+
+	if (!c->done)
+		wait_events(false);
+
+	if (!c->done)
+		return 0;
+
+	*status = c->status;
+	remove_child(c);
+
+	return 1;
+}
+
+pid_t reaper_wait_group(int group, int *status)
+{
+	for (;;) {
+		bool tracked = false;
+
+		for (struct child *c = children; c != NULL; c = c->next) {
+			if (c->group != group)
+				continue;
+
+			if (c->done) {
+				pid_t pid = c->pid;
+
+				*status = c->status;
+				remove_child(c);
+				return pid;
+			}
+
+			tracked = true;
+		}
+
+		if (!tracked)
+			return -1;
+
+		wait_events(true);
+	}
+}
+
+void reaper_free(void)
+{
+	while (children != NULL)
+		remove_child(children);
+
+	if (timer_fd != -1) {
+		close(timer_fd);
+		timer_fd = -1;
+	}
+
+	if (epoll_fd != -1) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+}
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _REAPER_H
+#define _REAPER_H
+
+#include <sys/types.h>
+
+#include "stats.h"
+
+/*
+ * Central tracking of the children of the shell.
+ *
+ * Every child is registered in a group (e.g. all the stages of a pipeline);
+ * the terminations are collected by an event loop built on pidfd + epoll,
+ * in the order they happen, and are handed to whoever waits for them.
+ * The resource usage of every child is collected with its status (and
+ * reported, if the statistics are enabled). The deadlines of the children
+ * are kept by a timerfd in the same event loop.
+ */
+
+/**
+ * Get a new group identifier.
+ */
+int reaper_new_group(void);
+
+/**
+ * Start tracking a child of the shell as a member of group; name is the
+ * command it runs (as reported in the statistics and traces).
+ */
+void reaper_track(pid_t pid, int group, const char *name);
+
+/* The exit status of the children killed when their deadline passed. */
+#define EXIT_TIMED_OUT		124
+
+/**
+ * Kill a tracked child (or its process group, if pgid is not 0) when the
+ * monotonic clock (stats_now) reaches deadline; it is then considered to
+ * have exited with EXIT_TIMED_OUT.
+ */
+void reaper_deadline(pid_t pid, pid_t pgid, long long deadline);
+
+/**
+ * Fork a child of the shell, in the cgroup of the commands (see cgroup.h);
+ * the child starts with no tracked children.
+ */
+pid_t reaper_fork(void);
+
+/**
+ * Wait for a tracked child to terminate and stop tracking it.
+ * Returns its wait status.
+ */
+int reaper_wait(pid_t pid);
+
+/**
+ * Check, without blocking, if a tracked child terminated; if it did, stop
+ * tracking it and set *status to its wait status.
+ * Returns 1 if it terminated, 0 if it is still running.
+ */
+int reaper_try_wait(pid_t pid, int *status);
+
+/**
+ * Wait for any child of group to terminate and stop tracking it; *status is
+ * its wait status.
+ * Returns its pid, or -1 if the group has no tracked children.
+ */
+pid_t reaper_wait_group(int group, int *status);
+
+/**
+ * Release the resources of the event loop.
+ */
+void reaper_free(void);
+
+#endif /* _REAPER_H */
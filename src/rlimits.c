@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rlimits.h"
+
+static const struct rlimit_info limits[] = {
+	{ 'c', RLIMIT_CORE, 1024, "core file size (kbytes)" },
+	{ 'd', RLIMIT_DATA, 1024, "data seg size (kbytes)" },
+	{ 'f', RLIMIT_FSIZE, 1024, "file size (kbytes)" },
+	{ 'n', RLIMIT_NOFILE, 1, "open files" },
+	{ 's', RLIMIT_STACK, 1024, "stack size (kbytes)" },
+	{ 't', RLIMIT_CPU, 1, "cpu time (seconds)" },
+	{ 'u', RLIMIT_NPROC, 1, "max user processes" },
+	{ 'v', RLIMIT_AS, 1024, "virtual memory (kbytes)" },
+};
+
+#define NR_LIMITS	((int)(sizeof(limits) / sizeof(limits[0])))
+
+// the limits that were set, in bytes / seconds
+static rlim_t values[NR_LIMITS];
+static int is_set[NR_LIMITS];
+static int nr_set;
+
+
+const struct rlimit_info *rlimits_find(char option)
+{
+	for (int i = 0; i < NR_LIMITS; i++) {
+		if (limits[i].option == option)
+			return &limits[i];
+	}
+
+	return NULL;
+}
+
+const struct rlimit_info *rlimits_all(int *count)
+{
+	*count = NR_LIMITS;
+
+	return limits;
+}
+
+int rlimits_set(const struct rlimit_info *info, rlim_t value)
+{
+	int i = info - limits;
+	struct rlimit rl;
+
+	if (value != RLIM_INFINITY) {
+		// a value that wraps around would be a much smaller limit
+		if (value > RLIM_INFINITY / info->unit)
+			return ERANGE;
+
+		value *= info->unit;
+	}
+
+	// the commands cannot raise their hard limits
+	if (getrlimit(info->resource, &rl) == 0 && rl.rlim_max != RLIM_INFINITY &&
+			(value == RLIM_INFINITY || value > rl.rlim_max))
+		return EPERM;
+
+	if (!is_set[i])
+		nr_set++;
+
+	is_set[i] = 1;
+	values[i] = value;
+
+	return 0;
+}
+
+rlim_t rlimits_get(const struct rlimit_info *info)
+{
+	int i = info - limits;
+	struct rlimit rl;
+	rlim_t value;
+
+	if (is_set[i])
+		value = values[i];
+	else if (getrlimit(info->resource, &rl) == 0)
+		value = rl.rlim_cur;
+	else
+		value = RLIM_INFINITY;
+
+	return (value == RLIM_INFINITY) ? value : value / info->unit;
+}
+
+int rlimits_count(void)
+{
+	return nr_set;
+}
+
+void rlimits_apply(void)
+{
+	for (int i = 0; i < NR_LIMITS && nr_set > 0; i++) {
+		struct rlimit rl;
+
+		if (!is_set[i] || getrlimit(limits[i].resource, &rl) == -1)
+			continue;
+
+		rl.rlim_cur = values[i];
+		if (setrlimit(limits[i].resource, &rl) == -1)
+			fprintf(stderr, "ulimit: %s: %s\n", limits[i].description,
+				strerror(errno));
+	}
+}
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _RLIMITS_H
+#define _RLIMITS_H
+
+#include <sys/resource.h>
+
+/*
+ * Resource limits of the commands (set with the ulimit builtin): they are
+ * not limits of the shell itself, but are installed in every external
+ * command, right before it is executed.
+ */
+
+/* A limit that can be set with ulimit, e.g. -t for the processor time. */
+struct rlimit_info {
+	char option;
+	int resource;
+	int unit;		/* the bytes, or the seconds, of a unit */
+	const char *description;
+};
+
+/**
+ * Get the limit that is set with option, or NULL if there is none.
+ */
+const struct rlimit_info *rlimits_find(char option);
+
+/**
+ * Get all the limits that can be set; *count is their number.
+ */
+const struct rlimit_info *rlimits_all(int *count);
+
+/**
+ * Set the (soft) limit of a resource for the commands, in units.
+ * Returns 0 on success, EPERM if it exceeds the hard limit, or ERANGE if it
+ * is too large to be counted in bytes.
+ */
+int rlimits_set(const struct rlimit_info *info, rlim_t value);
+
+/**
+ * Get the limit the commands get, in units (RLIM_INFINITY if unlimited).
+ */
+rlim_t rlimits_get(const struct rlimit_info *info);
+
+/**
+ * Get the number of limits that were set.
+ */
+int rlimits_count(void);
+
+/**
+ * Install the limits in the current (child) process.
+ */
+void rlimits_apply(void);
+
+#endif /* _RLIMITS_H */
@@ -0,0 +1,290 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cmd.h"
+#include "parsecache.h"
+#include "reaper.h"
+#include "server.h"
+#include "utils.h"
+
+#define MAX_REQUEST		(64 * 1024)
+#define MAX_FDS			3
+#define BACKLOG			64
+
+
+/**
+ * Receive a request: the command line (NUL terminated) or the packed tree in
+ * line, the descriptors passed with it in fds (-1 for the missing ones).
+ * Returns the length of the request, 0 at the end of the connection, or -1
+ * if the request is not valid.
+ */
+static ssize_t receive_request(int conn, char *line, int *fds)
+{
+	char control[CMSG_SPACE(MAX_FDS * sizeof(int))];
+	struct iovec iov = {
+		.iov_base = line,
+		.iov_len = MAX_REQUEST,
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	ssize_t len;
+
+	for (int i = 0; i < MAX_FDS; i++)
+		fds[i] = -1;
+
+	do {
+		len = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+	} while (len == -1 && errno == EINTR);
+
+	if (len <= 0)
+		return len;
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+			cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		int nr_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+		if (nr_fds > MAX_FDS)
+			nr_fds = MAX_FDS;
+
+		memcpy(fds, CMSG_DATA(cmsg), nr_fds * sizeof(int));
+	}
+
+	// a line that did not fit, or too many descriptors
+	if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+		return -1;
+
+	if (is_packed_parse_tree(line, len))
+		return len;
+
+	if (len > 0 && line[len - 1] == '\n')
+		len--;
+
+	line[len] = '\0';
+
+	return len;
+}
+
+static void send_reply(int conn, int status)
+{
+	char reply[16];
+	int len = snprintf(reply, sizeof(reply), "%d\n", status);
+
+	// the client may be gone already
+	send(conn, reply, len, MSG_NOSIGNAL);
+}
+
+/**
+ * Run a request in a new child, with fds as its standard descriptors.
+ * Returns its exit status, as sent to the client.
+ */
+static int run_request(command_t *root, int *fds, int conn)
+{
+	pid_t pid = reaper_fork();
+
+	if (pid == -1)
+		return -1;
+
+	if (pid == 0) {
+		close(conn);
+
+		for (int fd = 0; fd < MAX_FDS; fd++) {
+			int src = fds[fd];
+
+			if (src == -1)
+				src = open("/dev/null", (fd == 0) ? O_RDONLY : O_WRONLY);
+
+			DIE(src == -1, "open failed\n");
+			DIE(dup2(src, fd) == -1, "dup2 failed\n");
+
+			if (src != fd)
+				close(src);
+		}
+
+		int exit_code = parse_command(root, 0, NULL);
+
+		fflush(stdout);
+		exit((exit_code == SHELL_EXIT) ? 0 : exit_code);
+	}
+
+	reaper_track(pid, reaper_new_group(), "request");
+
+	int status = reaper_wait(pid);
+
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+
+	return WEXITSTATUS(status);
+}
+
+/**
+ * Serve all the requests of a connection, one after the other.
+ */
+static void serve_connection(int conn)
+{
+	char *line = malloc(MAX_REQUEST + 1);
+
+	DIE(line == NULL, "malloc failed\n");
+
+	for (;;) {
+		int fds[MAX_FDS];
+		ssize_t len = receive_request(conn, line, fds);
+
+		if (len == 0)
+			break;
+
+		int status = -1;
+
+		if (len > 0) {
+			command_t *root = NULL;
+
+			// a packed tree runs from the request itself; the trees
+			// of the lines are cached by this process, for the next
+			// requests of the connection
+			if (is_packed_parse_tree(line, len))
+				root = unpack_parse_tree(line, len);
+			else
+				parse_cached(line, len, &root);
+
+			if (root != NULL)
+				status = run_request(root, fds, conn);
+			else
+				status = 2;
+
+			free_parse_memory();
+		}
+
+		for (int i = 0; i < MAX_FDS; i++) {
+			if (fds[i] != -1)
+				close(fds[i]);
+		}
+
+		send_reply(conn, status);
+	}
+
+	free(line);
+}
+
+/**
+ * Create the listening socket at path, replacing a stale one; only its
+ * owner can connect to it.
+ */
+static int listen_on(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: %s\n", path, strerror(ENAMETOOLONG));
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+	DIE(sock == -1, "socket failed\n");
+
+	struct stat st;
+
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	// the socket runs any command as the user of the server: it is
+	// created with mode 0600, whatever the umask
+	mode_t old_mask = umask(0177);
+	int rc = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+
+	umask(old_mask);
+
+	if (rc == -1 || listen(sock, BACKLOG) == -1) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+/**
+ * Check if the peer of a connection runs as the user of the server.
+ */
+static bool same_user(int conn)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+		return false;
+
+	return cred.uid == geteuid();
+}
+
+int run_server(const char *path)
+{
+	int sock = listen_on(path);
+
+	if (sock == -1)
+		return EXIT_FAILURE;
+
+	// the connection processes are not waited for
+	signal(SIGCHLD, SIG_IGN);
+
+	for (;;) {
+		int conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+
+		if (conn == -1 && (errno == EINTR || errno == ECONNABORTED))
+			continue;
+
+		if (conn == -1) {
+			perror("accept4");
+			break;
+		}
+
+		// e.g. root, who can connect whatever the mode of the socket is
+		if (!same_user(conn)) {
+			fprintf(stderr, "%s: refused a client of another user\n", path);
+			close(conn);
+			continue;
+		}
+
+		pid_t pid = reaper_fork();
+
+		if (pid == 0) {
+			close(sock);
+			signal(SIGCHLD, SIG_DFL);
+
+			serve_connection(conn);
+			close(conn);
+			exit(EXIT_SUCCESS);
+		}
+
+		if (pid == -1)
+			perror("fork");
+
+		close(conn);
+	}
+
+	close(sock);
+
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _SERVER_H
+#define _SERVER_H
+
+/*
+ * Command server (mini-shell --server socket): a warm shell that runs the
+ * command lines sent to it over a Unix socket, so that the clients do not
+ * pay for starting a new shell for every command.
+ *
+ * The socket is a SOCK_SEQPACKET one. Every message a client sends is a
+ * request: one command line, or the tree of one packed by pack_parse_tree
+ * (so that it is not parsed again), with up to three descriptors attached
+ * (SCM_RIGHTS), which become the standard input, output and error of the
+ * command (the missing ones are /dev/null). The reply is the exit status of
+ * the command, as a decimal number followed by a newline (128 + the signal
+ * number if it was killed, -1 if the request could not be run).
+ *
+ * The socket is created with mode 0600 and the clients that do not run as
+ * the user of the server (SO_PEERCRED) are refused.
+ *
+ * Every connection is served by a process of its own, so that the requests
+ * of different clients run concurrently, and every request is run by a new
+ * child of it, so that its effects on the shell (cd, variables) do not
+ * outlive it.
+ */
+
+/**
+ * Serve the requests sent to the socket at path; only returns on error.
+ * Returns the exit code of the shell.
+ */
+int run_server(const char *path);
+
+#endif /* _SERVER_H */
@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "stats.h"
+
+// a record is written at once, under PIPE_BUF, so that the records of the
+// subshells that share stats_fd are never mixed up
+#define MAX_RECORD		1024
+
+// the longest string (escaped) a record keeps, the rest is cut
+#define MAX_STRING		256
+
+/* A JSON line being built. */
+struct record {
+	char text[MAX_RECORD];
+	size_t len;
+};
+
+int stats_fd = -1;
+
+static long long phase_ns[NR_STATS_PHASES];
+static unsigned int nr_children;
+
+
+void stats_init(void)
+{
+	const char *value = getenv("MINISHELL_STATS");
+
+	if (value == NULL)
+		return;
+
+	int fd = atoi(value);
+
+	// a descriptor that is not open just disables the statistics
+	if (fd >= 0 && fcntl(fd, F_GETFD) != -1)
+		stats_fd = fd;
+}
+
+long long stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void stats_add(enum stats_phase phase, long long start)
+{
+	if (stats_fd == -1)
+		return;
+
+	phase_ns[phase] += stats_now() - start;
+}
+
+static long long timeval_us(struct timeval tv)
+{
+	return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+/**
+ * Add formatted text to a record (cut if it does not fit).
+ */
+static void add(struct record *r, const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	int rc = vsnprintf(r->text + r->len, sizeof(r->text) - r->len, format,
+			args);
+	va_end(args);
+
+	if (rc > 0)
+		r->len += rc;
+	if (r->len >= sizeof(r->text))
+		r->len = sizeof(r->text) - 1;
+}
+
+/**
+ * Add a JSON string, with the quotes, the backslashes and the control
+ * characters escaped.
+ */
+static void add_string(struct record *r, const char *string)
+{
+	size_t start = r->len;
+
+	add(r, "\"");
+
+	for (const unsigned char *p = (const unsigned char *)string; *p != '\0';
+		p++) {
+		if (r->len - start > MAX_STRING)
+			break;
+
+		if (*p == '"' || *p == '\\')
+			add(r, "\\%c", *p);
+		else if (*p < 0x20)
+			add(r, "\\u%04x", *p);
+		else
+			add(r, "%c", *p);
+	}
+
+	add(r, "\"");
+}
+
+/**
+ * Write a record to stats_fd, with a single write.
+ */
+static void emit(struct record *r)
+{
+	ssize_t rc;
+
+	do {
+		rc = write(stats_fd, r->text, r->len);
+	} while (rc == -1 && errno == EINTR);
+}
+
+void stats_child(const char *name, pid_t pid, int status,
+		const struct child_usage *usage)
+{
+	const struct rusage *ru = &usage->rusage;
+	struct record r = { .len = 0 };
+
+	nr_children++;
+
+	add(&r, "{\"event\": \"child\", \"command\": ");
+	add_string(&r, name);
+	add(&r, ", \"pid\": %d, \"exit\": %d, \"signal\": %d, "
+		"\"wall_us\": %lld, \"user_us\": %lld, \"sys_us\": %lld, "
+		"\"maxrss_kb\": %ld, \"nvcsw\": %ld, \"nivcsw\": %ld, "
+		"\"minflt\": %ld, \"majflt\": %ld}\n",
+		pid, WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+		WIFSIGNALED(status) ? WTERMSIG(status) : 0,
+		usage->wall_ns / 1000, timeval_us(ru->ru_utime),
+		timeval_us(ru->ru_stime), ru->ru_maxrss, ru->ru_nvcsw,
+		ru->ru_nivcsw, ru->ru_minflt, ru->ru_majflt);
+	emit(&r);
+}
+
+void stats_cgroup(const char *name, const char *kind,
+		const struct cgroup_usage *usage)
+{
+	struct record r = { .len = 0 };
+
+	add(&r, "{\"event\": \"cgroup\", \"cgroup\": ");
+	add_string(&r, name);
+	add(&r, ", \"kind\": \"%s\", \"cpu_us\": %lld, \"user_us\": %lld, "
+		"\"sys_us\": %lld, \"memory_peak_kb\": %lld, "
+		"\"oom_kills\": %lld}\n", kind, usage->usage_us,
+		usage->user_us, usage->sys_us,
+		(usage->memory_peak == -1) ? -1 : usage->memory_peak / 1024,
+		usage->oom_kills);
+	emit(&r);
+}
+
+void stats_line(void)
+{
+	struct record r = { .len = 0 };
+
+	add(&r, "{\"event\": \"line\", \"children\": %u, "
+		"\"parse_us\": %lld, \"expand_us\": %lld, \"spawn_us\": %lld, "
+		"\"wait_us\": %lld}\n", nr_children,
+		phase_ns[STATS_PARSE] / 1000, phase_ns[STATS_EXPAND] / 1000,
+		phase_ns[STATS_SPAWN] / 1000, phase_ns[STATS_WAIT] / 1000);
+	emit(&r);
+
+	for (int i = 0; i < NR_STATS_PHASES; i++)
+		phase_ns[i] = 0;
+
+	nr_children = 0;
+}
@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/*
+ * Resource usage of the children and overhead of the shell, written as JSON
+ * lines to the file descriptor given by MINISHELL_STATS (e.g.
+ * MINISHELL_STATS=3 mini-shell 3>stats.jsonl):
+ *	{"event": "child", ...}	for every child, when it is reaped
+ *	{"event": "cgroup", ...}
+ *				for every cgroup of commands (see cgroup.h),
+ *				when it is released
+ *	{"event": "line", ...}	for every command line, the time the shell
+ *				spent parsing, expanding, creating the
+ *				children and waiting for them
+ */
+
+/* What a child used, from its start to its termination. */
+struct child_usage {
+	struct rusage rusage;
+	long long wall_ns;
+};
+
+/* What the processes of a cgroup used; -1 for what is not known. */
+struct cgroup_usage {
+	long long usage_us;
+	long long user_us;
+	long long sys_us;
+	long long memory_peak;	/* bytes */
+	long long oom_kills;
+};
+
+/* The phases of the shell whose time is measured. */
+enum stats_phase {
+	STATS_PARSE,
+	STATS_EXPAND,
+	STATS_SPAWN,
+	STATS_WAIT,
+	NR_STATS_PHASES
+};
+
+/* Set if the statistics are collected. */
+extern int stats_fd;
+
+/**
+ * Read MINISHELL_STATS; called once, when the shell starts.
+ */
+void stats_init(void);
+
+/**
+ * Get the current time of the monotonic clock, in nanoseconds.
+ */
+long long stats_now(void);
+
+/**
+ * Add the time since start (from stats_now) to a phase of the current line.
+ */
+void stats_add(enum stats_phase phase, long long start);
+
+/**
+ * Report a child that terminated.
+ */
+void stats_child(const char *name, pid_t pid, int status,
+		const struct child_usage *usage);
+
+/**
+ * Report a cgroup of commands that is released; kind is what it was for.
+ */
+void stats_cgroup(const char *name, const char *kind,
+		const struct cgroup_usage *usage);
+
+/**
+ * Report the overhead of the command line that just ran.
+ */
+void stats_line(void);
+
+#endif /* _STATS_H */
@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "trace.h"
+#include "utils.h"
+
+#define NR_EVENTS		4096
+#define MAX_NAME		64
+#define FLUSH_CHUNK		(64 * 1024)
+
+struct trace_event {
+	char name[MAX_NAME];
+	char phase;
+	pid_t tid;
+	long long start;
+	long long duration;
+};
+
+int trace_enabled;
+
+/*
+ * The events are only recorded by the process that owns the buffer, so it
+ * needs no locking; it is written out (and starts over) when it is full.
+ * The trace file is opened in append mode and inherited by the children of
+ * the shell, so that all the processes can add their events to it.
+ */
+static struct trace_event events[NR_EVENTS];
+static int nr_events;
+static int trace_fd = -1;
+static pid_t trace_pid;
+
+
+void trace_init(void)
+{
+	const char *path = getenv("MINISHELL_TRACE");
+
+	if (path == NULL || *path == '\0')
+		return;
+
+	trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+			0644);
+	if (trace_fd == -1) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return;
+	}
+
+	// the closing bracket of the array is optional in the format, so
+	// every process can simply append its events
+	DIE(write(trace_fd, "[\n", 2) == -1, "write failed\n");
+
+	trace_pid = getpid();
+	trace_enabled = 1;
+
+	atexit(trace_flush);
+}
+
+void trace_event(const char *name, char phase, pid_t tid, long long start,
+		long long duration)
+{
+	if (nr_events == NR_EVENTS)
+		trace_flush();
+
+	struct trace_event *e = &events[nr_events++];
+
+	// the names may point into a parse tree that is gone the next time
+	// the buffer is written
+	snprintf(e->name, sizeof(e->name), "%s", name);
+	e->phase = phase;
+	e->tid = (tid != 0) ? tid : trace_pid;
+	e->start = (phase == 'X') ? start : stats_now();
+	e->duration = duration;
+}
+
+void trace_forked(void)
+{
+	nr_events = 0;
+	trace_pid = getpid();
+}
+
+/**
+ * Format an event as a line of the trace file.
+ * Returns the length of the line.
+ */
+static int format_event(char *buf, size_t size, const struct trace_event *e)
+{
+	char name[2 * MAX_NAME];
+	char *p = name;
+
+	for (const char *s = e->name; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			*p++ = '\\';
+		*p++ = (*s < ' ') ? ' ' : *s;
+	}
+	*p = '\0';
+
+	int len = snprintf(buf, size, "{\"name\": \"%s\", \"ph\": \"%c\", "
+		"\"ts\": %lld.%03lld, \"pid\": %d, \"tid\": %d", name, e->phase,
+		e->start / 1000, e->start % 1000, trace_pid, e->tid);
+
+	if (e->phase == 'X')
+		len += snprintf(buf + len, size - len, ", \"dur\": %lld.%03lld",
+			e->duration / 1000, e->duration % 1000);
+
+	len += snprintf(buf + len, size - len, "},\n");
+
+	return len;
+}
+
+void trace_flush(void)
+{
+	static char buf[FLUSH_CHUNK];
+	size_t len = 0;
+
+	if (trace_fd == -1)
+		return;
+
+	for (int i = 0; i < nr_events; i++) {
+		if (len > FLUSH_CHUNK - 512) {
+			DIE(write(trace_fd, buf, len) == -1, "write failed\n");
+			len = 0;
+		}
+
+		len += format_event(buf + len, FLUSH_CHUNK - len, &events[i]);
+	}
+
+	if (len > 0)
+		DIE(write(trace_fd, buf, len) == -1, "write failed\n");
+
+	nr_events = 0;
+}
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <sys/types.h>
+
+/*
+ * Tracepoints of the parser and of the executor, enabled with
+ * MINISHELL_TRACE=<file>: the events are recorded with monotonic timestamps
+ * in a buffer of the process and written, when it fills up and when the
+ * process exits, to file in the trace event format (chrome://tracing,
+ * ui.perfetto.dev). Every child of the shell shows up as a span of its own,
+ * from its creation to its termination.
+ *
+ * When tracing is off a tracepoint costs one predictable branch; building
+ * with make TRACE=no removes them completely.
+ */
+
+#ifdef NO_TRACE
+
+#define TRACE_BEGIN(name)			do { } while (0)
+#define TRACE_END(name)				do { } while (0)
+#define TRACE_SPAN(name, tid, start, duration)	do { } while (0)
+
+static inline void trace_init(void)
+{
+}
+
+static inline void trace_forked(void)
+{
+}
+
+#else
+
+/* Set if the events are recorded. */
+extern int trace_enabled;
+
+/* Begin / end a span of the current process. */
+#define TRACE_BEGIN(name)						\
+	do {								\
+		if (__builtin_expect(trace_enabled, 0))			\
+			trace_event(name, 'B', 0, 0, 0);		\
+	} while (0)
+
+#define TRACE_END(name)							\
+	do {								\
+		if (__builtin_expect(trace_enabled, 0))			\
+			trace_event(name, 'E', 0, 0, 0);		\
+	} while (0)
+
+/* A complete span of tid (e.g. a child), in nanoseconds. */
+#define TRACE_SPAN(name, tid, start, duration)				\
+	do {								\
+		if (__builtin_expect(trace_enabled, 0))			\
+			trace_event(name, 'X', tid, start, duration);	\
+	} while (0)
+
+/**
+ * Read MINISHELL_TRACE and start the trace file; called once, when the shell
+ * starts.
+ */
+void trace_init(void);
+
+/**
+ * Record an event; start and duration are only used by complete spans (the
+ * other events happen now, in the current process).
+ */
+void trace_event(const char *name, char phase, pid_t tid, long long start,
+		long long duration);
+
+/**
+ * Drop the events a new child inherited from its parent, which the parent
+ * writes itself.
+ */
+void trace_forked(void);
+
+/**
+ * Write the recorded events to the trace file.
+ */
+void trace_flush(void);
+
+#endif /* NO_TRACE */
+
+#endif /* _TRACE_H */
@@ -5,42 +5,96 @@
 #include <string.h>
 
 #include "utils.h"
+#include "vars.h"
+
+#define MAX_EXPANDED_VARIABLES		16
+
+/*
+ * Values of the environment variables already looked up while expanding
+ * the words of a command, so that every variable is searched only once.
+ */
+struct expansion {
+	const char *names[MAX_EXPANDED_VARIABLES];
+	const char *values[MAX_EXPANDED_VARIABLES];
+	int count;
+};
 
 /**
- * Concatenate parts of the word to obtain the command.
+ * Get the string a part of a word expands to.
  */
-char *get_word(word_t *s)
+static const char *expand_part(word_t *part, struct expansion *e)
 {
-	char *string = NULL;
-	int string_length = 0;
+	if (part->expand != true)
+		return part->string;
 
-	const char *substring = NULL;
-	int substring_length = 0;
+	for (int i = 0; i < e->count; i++) {
+		if (strcmp(e->names[i], part->string) == 0)
+			return e->values[i];
+	}
 
-	while (s != NULL) {
-		if (s->expand == true) {
-			substring = getenv(s->string);
+	const char *value = vars_get(part->string);
 
-			/* Prevents strlen from failing. */
-			if (substring == NULL)
-				substring = "";
-		} else {
-			substring = s->string;
-		}
+	/* Prevents strlen from failing. */
+	if (value == NULL)
+		value = "";
 
-		substring_length = strlen(substring);
+	if (e->count < MAX_EXPANDED_VARIABLES) {
+		e->names[e->count] = part->string;
+		e->values[e->count] = value;
+		e->count++;
+	}
 
-		string = realloc(string, string_length + substring_length + 1);
-		DIE(string == NULL, "Error allocating word string.");
+	return value;
+}
 
-		string[string_length] = '\0';
-		strcat(string, substring);
+/**
+ * Get the length of the string obtained by concatenating the parts of a word.
+ */
+static size_t word_length(word_t *s, struct expansion *e)
+{
+	size_t length = 0;
+
+	for (; s != NULL; s = s->next_part)
+		length += strlen(expand_part(s, e));
+
+	return length;
+}
 
-		string_length += substring_length;
+/**
+ * Concatenate the parts of a word at dest (NUL terminated).
+ * Returns the position right after the terminator.
+ */
+static char *copy_word(word_t *s, char *dest, struct expansion *e)
+{
+	for (; s != NULL; s = s->next_part) {
+		const char *substring = expand_part(s, e);
+		size_t substring_length = strlen(substring);
 
-		s = s->next_part;
+		memcpy(dest, substring, substring_length);
+		dest += substring_length;
 	}
 
+	*dest = '\0';
+
+	return dest + 1;
+}
+
+/**
+ * Concatenate parts of the word to obtain the command.
+ */
+char *get_word(word_t *s)
+{
+	struct expansion e = { .count = 0 };
+
+	if (s == NULL)
+		return NULL;
+
+	char *string = malloc(word_length(s, &e) + 1);
+
+	DIE(string == NULL, "Error allocating word string.");
+
+	copy_word(s, string, &e);
+
 	return string;
 }
 
@@ -50,36 +104,41 @@ char *get_word(word_t *s)
  */
 char **get_argv(simple_command_t *command, int *size)
 {
+	struct expansion e = { .count = 0 };
 	char **argv;
 	int argc;
 
 	word_t *param;
 
+	/* Get parameters number and the size of all the strings. */
 	argc = 1;
+	size_t strings_length = word_length(command->verb, &e) + 1;
 
-	/* Get parameters number. */
-	param = command->params;
-	while (param != NULL) {
-		param = param->next_word;
+	for (param = command->params; param != NULL; param = param->next_word) {
+		strings_length += word_length(param, &e) + 1;
 		argc++;
 	}
 
-	argv = calloc(argc + 1, sizeof(char *));
+	/* The pointers and the strings they point to share one allocation. */
+	argv = malloc((argc + 1) * sizeof(char *) + strings_length);
 	DIE(argv == NULL, "Error allocating argv.");
 
-	argv[0] = get_word(command->verb);
-	DIE(argv[0] == NULL, "Error retrieving word.");
+	char *strings = (char *)(argv + argc + 1);
+
+	argv[0] = strings;
+	strings = copy_word(command->verb, strings, &e);
 
 	param = command->params;
 	argc = 1;
 	while (param != NULL) {
-		argv[argc] = get_word(param);
-		DIE(argv[argc] == NULL, "Error retrieving word.");
+		argv[argc] = strings;
+		strings = copy_word(param, strings, &e);
 
 		param = param->next_word;
 		argc++;
 	}
 
+	argv[argc] = NULL;
 	*size = argc;
 
 	return argv;
@@ -27,6 +27,7 @@ char *get_word(word_t *s);
 /**
  * Concatenate command arguments in a NULL terminated list in order to pass
  * them directly to execv.
+ * The list and the strings are a single allocation, released by free(argv).
  */
 char **get_argv(simple_command_t *command, int *size);
 
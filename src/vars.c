@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdio.h>
+#include <string.h>
+
+#include "utils.h"
+#include "vars.h"
+
+#define MIN_BUCKETS		64
+
+extern char **environ;
+
+struct var {
+	struct var *next;
+	unsigned int hash;
+	size_t name_length;
+	char *entry;		/* NAME=value, as it is in the environment */
+};
+
+static struct var **buckets;
+static unsigned int nr_buckets;
+static unsigned int nr_vars;
+
+// the environment built from the table, NULL if a variable changed since
+static char **envp;
+
+
+static unsigned int hash_name(const char *name, size_t length)
+{
+	unsigned int hash = 2166136261u;
+
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/**
+ * Double the number of buckets (there is one for every variable at most).
+ */
+static void grow_table(void)
+{
+	unsigned int size = (nr_buckets == 0) ? MIN_BUCKETS : 2 * nr_buckets;
+	struct var **table = calloc(size, sizeof(*table));
+
+	DIE(table == NULL, "calloc failed\n");
+
+	for (unsigned int i = 0; i < nr_buckets; i++) {
+		while (buckets[i] != NULL) {
+			struct var *v = buckets[i];
+
+			buckets[i] = v->next;
+			v->next = table[v->hash & (size - 1)];
+			table[v->hash & (size - 1)] = v;
+		}
+	}
+
+	free(buckets);
+	buckets = table;
+	nr_buckets = size;
+}
+
+static struct var *find_var(const char *name, size_t length, unsigned int hash)
+{
+	for (struct var *v = buckets[hash & (nr_buckets - 1)]; v != NULL; v = v->next) {
+		if (v->hash == hash && v->name_length == length &&
+				memcmp(v->entry, name, length) == 0)
+			return v;
+	}
+
+	return NULL;
+}
+
+static char *make_entry(const char *name, size_t length, const char *value)
+{
+	char *entry = malloc(length + 1 + strlen(value) + 1);
+
+	DIE(entry == NULL, "malloc failed\n");
+
+	memcpy(entry, name, length);
+	entry[length] = '=';
+	strcpy(entry + length + 1, value);
+
+	return entry;
+}
+
+static void store(const char *name, size_t length, const char *value)
+{
+	unsigned int hash = hash_name(name, length);
+	struct var *v = find_var(name, length, hash);
+
+	if (v != NULL) {
+		free(v->entry);
+		v->entry = make_entry(name, length, value);
+		return;
+	}
+
+	if (nr_vars == nr_buckets)
+		grow_table();
+
+	v = malloc(sizeof(*v));
+	DIE(v == NULL, "malloc failed\n");
+
+	v->hash = hash;
+	v->name_length = length;
+	v->entry = make_entry(name, length, value);
+	v->next = buckets[hash & (nr_buckets - 1)];
+	buckets[hash & (nr_buckets - 1)] = v;
+	nr_vars++;
+}
+
+/**
+ * Load the environment of the shell in the table.
+ */
+static void load_environ(void)
+{
+	grow_table();
+
+	for (char **e = environ; *e != NULL; e++) {
+		const char *equal = strchr(*e, '=');
+
+		if (equal != NULL)
+			store(*e, equal - *e, equal + 1);
+	}
+}
+
+const char *vars_get(const char *name)
+{
+	if (buckets == NULL)
+		load_environ();
+
+	size_t length = strlen(name);
+	struct var *v = find_var(name, length, hash_name(name, length));
+
+	return (v != NULL) ? v->entry + length + 1 : NULL;
+}
+
+void vars_set(const char *name, const char *value)
+{
+	if (buckets == NULL)
+		load_environ();
+
+	store(name, strlen(name), value);
+
+	free(envp);
+	envp = NULL;
+}
+
+char **vars_environ(void)
+{
+	if (envp != NULL)
+		return envp;
+
+	if (buckets == NULL)
+		load_environ();
+
+	envp = malloc((nr_vars + 1) * sizeof(*envp));
+	DIE(envp == NULL, "malloc failed\n");
+
+	int count = 0;
+
+	for (unsigned int i = 0; i < nr_buckets; i++) {
+		for (struct var *v = buckets[i]; v != NULL; v = v->next)
+			envp[count++] = v->entry;
+	}
+
+	envp[count] = NULL;
+
+	return envp;
+}
+
+void vars_free(void)
+{
+	for (unsigned int i = 0; i < nr_buckets; i++) {
+		while (buckets[i] != NULL) {
+			struct var *v = buckets[i];
+
+			buckets[i] = v->next;
+			free(v->entry);
+			free(v);
+		}
+	}
+
+	free(buckets);
+	free(envp);
+	buckets = NULL;
+	envp = NULL;
+	nr_buckets = 0;
+	nr_vars = 0;
+}
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _VARS_H
+#define _VARS_H
+
+/*
+ * The variables of the shell: a hash table, loaded from the environment the
+ * first time it is used, that makes every expansion a single lookup. The
+ * environment of the commands is built from it only when a command is
+ * started after a variable changed; until then, all the commands get the
+ * same block.
+ */
+
+/**
+ * Get the value of a variable, or NULL if it is not set.
+ */
+const char *vars_get(const char *name);
+
+/**
+ * Set (or add) a variable.
+ */
+void vars_set(const char *name, const char *value);
+
+/**
+ * Get the environment of the commands: NAME=value strings, NULL terminated.
+ * It is valid until the next vars_set.
+ */
+char **vars_environ(void);
+
+/**
+ * Release all the memory used by the variables.
+ */
+void vars_free(void);
+
+#endif /* _VARS_H */
@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "zerocopy.h"
+#include "utils.h"
+#include "vars.h"
+
+#define SPLICE_CHUNK		(1 << 20)
+#define COPY_CHUNK		(64 * 1024)
+
+
+/**
+ * Check if a word is a plain file name cat would not take as an option.
+ */
+static bool is_file_name(word_t *w)
+{
+	return w->expand == true || w->next_part != NULL || w->string[0] != '-';
+}
+
+enum zerocopy_role zerocopy_role(command_t *c, bool first, bool last)
+{
+	const char *enabled = vars_get("MINISHELL_SPLICE");
+
+	if (enabled != NULL && strcmp(enabled, "no") == 0)
+		return ZEROCOPY_NONE;
+
+	if (c->op != OP_NONE)
+		return ZEROCOPY_NONE;
+
+	simple_command_t *s = c->scmd;
+
+	if (s->verb->expand == true || s->verb->next_part != NULL ||
+		strcmp(s->verb->string, "cat") != 0)
+		return ZEROCOPY_NONE;
+
+	// only plain `cat file` and `cat < file`; its input is not needed
+	if (!last && s->out == NULL && s->err == NULL) {
+		if (s->in == NULL && s->params != NULL &&
+			s->params->next_word == NULL && is_file_name(s->params))
+			return ZEROCOPY_SOURCE;
+
+		if (s->in != NULL && s->params == NULL)
+			return ZEROCOPY_SOURCE;
+	}
+
+	// only plain `cat > file` and `cat >> file`
+	if (last && !first && s->in == NULL && s->err == NULL &&
+		s->out != NULL && s->params == NULL)
+		return ZEROCOPY_SINK;
+
+	return ZEROCOPY_NONE;
+}
+
+/**
+ * Copy through a user space buffer, for the files splice does not support.
+ */
+static int copy_user(int in_fd, int out_fd)
+{
+	static char buf[COPY_CHUNK];
+
+	for (;;) {
+		ssize_t nr_read = read(in_fd, buf, sizeof(buf));
+
+		if (nr_read == -1 && errno == EINTR)
+			continue;
+
+		if (nr_read <= 0)
+			return nr_read;
+
+		for (ssize_t done = 0; done < nr_read;) {
+			ssize_t rc = write(out_fd, buf + done, nr_read - done);
+
+			if (rc == -1 && errno == EINTR)
+				continue;
+
+			if (rc == -1)
+				return -1;
+
+			done += rc;
+		}
+	}
+}
+
+/**
+ * Move all the data from in_fd to out_fd, one of them being a pipe.
+ * Returns 0 on success, or -1 on failure.
+ */
+static int copy_data(int in_fd, int out_fd)
+{
+	for (;;) {
+		ssize_t rc = splice(in_fd, NULL, out_fd, NULL, SPLICE_CHUNK,
+				SPLICE_F_MOVE | SPLICE_F_MORE);
+
+		if (rc == 0)
+			return 0;
+
+		if (rc > 0)
+			continue;
+
+		if (errno == EINTR)
+			continue;
+
+		// e.g. the file is opened in append mode, or its file system
+		// does not support splice; the offsets have already advanced
+		if (errno == EINVAL || errno == ENOSYS)
+			return copy_user(in_fd, out_fd);
+
+		return -1;
+	}
+}
+
+int zerocopy_run(const plan_node_t *n, enum zerocopy_role role, int pipe_fd)
+{
+	// cat file reads a parameter, opened like cat < file would be
+	struct plan_redirect param = {
+		.fd = STDIN_FILENO,
+		.file = n->scmd->params,
+		.flags = O_RDONLY,
+	};
+	const struct plan_redirect *r = &param;
+
+	// otherwise, the file is the one of the single redirection
+	if (n->nr_redirects == 1)
+		r = &n->redirects[0];
+
+	int fd = plan_open_redirect(r);
+
+	if (fd == -1)
+		return EXIT_FAILURE;
+
+	// a reader that went away must not kill the shell
+	struct sigaction ignore = { .sa_handler = SIG_IGN };
+	struct sigaction old;
+	int rc;
+
+	sigaction(SIGPIPE, &ignore, &old);
+
+	if (role == ZEROCOPY_SOURCE)
+		rc = copy_data(fd, pipe_fd);
+	else
+		rc = copy_data(pipe_fd, fd);
+
+	sigaction(SIGPIPE, &old, NULL);
+
+	// like cat, a reader that went away is not reported
+	if (rc == -1 && errno != EPIPE) {
+		int err = errno;
+		char *filename = get_word(r->file);
+
+		fprintf(stderr, "cat: %s: %s\n", filename, strerror(err));
+		free(filename);
+	}
+
+	close(fd);
+
+	return (rc == -1) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _ZEROCOPY_H
+#define _ZEROCOPY_H
+
+#include "../util/parser/parser.h"
+#include "plan.h"
+
+/*
+ * Trivial pipeline stages the shell satisfies itself, by moving the data
+ * between a file and a pipe inside the kernel, instead of starting cat:
+ *	cat file | ...		(or cat < file | ...)
+ *	... | cat > file	(or cat >> file)
+ *
+ * Can be disabled by setting MINISHELL_SPLICE=no.
+ */
+enum zerocopy_role {
+	ZEROCOPY_NONE,
+	ZEROCOPY_SOURCE,	/* copies a file to the pipe of the next stage */
+	ZEROCOPY_SINK,		/* copies the pipe of the previous stage to a file */
+};
+
+/**
+ * Get the role a stage of a pipeline can have (ZEROCOPY_SOURCE only for
+ * the stages that are not the last one, ZEROCOPY_SINK only for the last one).
+ */
+enum zerocopy_role zerocopy_role(command_t *c, bool first, bool last);
+
+/**
+ * Satisfy a stage in the shell: its file is opened like the redirections of
+ * the other stages (plan_open_redirect) and pipe_fd is the writing end of
+ * the pipe to the next stage for a source, or the reading end of the pipe
+ * from the previous stage for a sink.
+ * Returns the exit status of the stage.
+ */
+int zerocopy_run(const plan_node_t *n, enum zerocopy_role role, int pipe_fd);
+
+#endif /* _ZEROCOPY_H */
@@ -190,11 +190,12 @@ test_common_alt() {
 	fi
 }
 
-# Test 18.
-test_exec_failed() {
+# Tests the output of the commands against a reference output (see test 18),
+# for what bash does not do the same way.
+test_reference() {
 	init_test
 
-	# Commands to execute the.
+	# Commands to execute the test.
 	execute_cmd "$exec_name" "../${IN_FILE}" "${REF_FILE}"
 
 	# Test output.
@@ -221,7 +222,13 @@ test_fun_array=(
 	test_common_alt "Testing big file" 5
 	test_common_alt "Testing sleep command" 7
 	test_common_alt "Testing fscanf function" 7
-	test_exec_failed "Testing unknown command" 4
+	test_reference "Testing unknown command" 4
+	test_reference "Testing cached append redirects" 0
+	test_reference "Testing path cache of forked commands" 0
+	test_common "Testing internal commands in pipes" 0
+	test_common "Testing waiting for background jobs" 0
+	test_reference "Testing bound of the finished jobs" 0
+	test_reference "Testing timeout of pipelines" 0
 )
 
 # ----------------- Run test ------------------------------------------------- #
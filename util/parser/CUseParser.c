@@ -45,6 +45,7 @@ int main(void)
 	}
 
 	free_parse_memory();
+	release_parse_memory();
 
 	return EXIT_SUCCESS;
 }
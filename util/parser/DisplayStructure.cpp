@@ -131,6 +131,9 @@ static void displayCommand(command_t * c, int level, command_t * father)
 		case OP_PIPE:
 			std::cout << "OP_PIPE";
 			break;
+		case OP_BACKGROUND:
+			std::cout << "OP_BACKGROUND";
+			break;
 		default:
 			assert(false);
 		}
@@ -139,17 +142,43 @@ static void displayCommand(command_t * c, int level, command_t * father)
 		std::cout << std::setw(2 * indent * level + indent) << "" << "cmd1 (" << std::endl;
 		displayCommand(c->cmd1, level + 1, c);
 		std::cout << std::setw(2 * indent * level + indent) << "" << ")" << std::endl;
-		std::cout << std::setw(2 * indent * level + indent) << "" << "cmd2 (" << std::endl;
-		displayCommand(c->cmd2, level + 1, c);
-		std::cout << std::setw(2 * indent * level + indent) << "" << ")" << std::endl;
+		if (c->cmd2 != NULL) {
+			std::cout << std::setw(2 * indent * level + indent) << "" << "cmd2 (" << std::endl;
+			displayCommand(c->cmd2, level + 1, c);
+			std::cout << std::setw(2 * indent * level + indent) << "" << ")" << std::endl;
+		}
 	}
 
 	std::cout << std::setw(2 * indent * level) << "" << ")" << std::endl;
 }
 
 
-int main(void)
+/*
+ * With --packed, every tree is packed and shown as it is unpacked from its
+ * buffer, after the memory of the parser is freed (see pack_parse_tree)
+ */
+static command_t * packedCopy(command_t * root, void ** buffer)
 {
+	size_t size = pack_parse_tree(root, NULL, 0);
+
+	*buffer = malloc(size);
+	if (*buffer == NULL) {
+		std::cerr << "malloc() failed" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	pack_parse_tree(root, *buffer, size);
+	std::cout << "Packed in " << size << " bytes" << std::endl;
+	free_parse_memory();
+
+	return unpack_parse_tree(*buffer, size);
+}
+
+
+int main(int argc, char ** argv)
+{
+	bool packed = (argc > 1) && (std::string(argv[1]) == "--packed");
+
 	for (;;) {
 		std::cout << "> ";
 
@@ -158,6 +187,7 @@ int main(void)
 		if ((line.length() == 0) && !std::cin.good()) {
 			// end of file reached
 			std::cerr << "End of file!" << std::endl;
+			release_parse_memory();
 			return EXIT_SUCCESS;
 		}
 
@@ -170,7 +200,12 @@ int main(void)
 				std::cout << "Command is empty!" << std::endl;
 			} else {
 				// Root points to a valid command tree that we can use
+				void * buffer = NULL;
+
+				if (packed)
+					root = packedCopy(root, &buffer);
 				displayCommand(root, 0, NULL);
+				free(buffer);
 			}
 		}	else {
 			// There was an error parsing the command
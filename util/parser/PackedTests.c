@@ -0,0 +1,197 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Tests of unpack_parse_tree: the packed trees of some lines are unpacked,
+ * and packed trees edited by hand so that they break the rules of parser.h
+ * (the nesting of the operators, a single father for every node) are
+ * refused and left unchanged.
+ *
+ * usage: ./PackedTests
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./parser.h"
+
+/* A packed tree, and the tree of a copy of it that was unpacked. */
+struct packed {
+	char *buffer;
+	size_t size;
+	char *copy;
+	command_t *root;
+};
+
+static int nrFailed;
+
+
+void parse_error(const char *str, const int where)
+{
+	fprintf(stderr, "Parse error near %d: %s\n", where, str);
+}
+
+static void check(bool ok, const char * name)
+{
+	printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+	if (!ok)
+		nrFailed++;
+}
+
+static void pack(struct packed * p, const char * line)
+{
+	command_t *root = NULL;
+
+	if (!parse_line(line, &root) || root == NULL) {
+		fprintf(stderr, "Cannot parse %s\n", line);
+		exit(EXIT_FAILURE);
+	}
+
+	p->size = pack_parse_tree(root, NULL, 0);
+	p->buffer = malloc(p->size);
+	p->copy = malloc(p->size);
+	if (p->buffer == NULL || p->copy == NULL) {
+		fprintf(stderr, "Out of memory!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	pack_parse_tree(root, p->buffer, p->size);
+	free_parse_memory();
+
+	memcpy(p->copy, p->buffer, p->size);
+	p->root = unpack_parse_tree(p->copy, p->size);
+	if (p->root == NULL) {
+		fprintf(stderr, "Cannot unpack %s\n", line);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* the node of the packed tree that a node of the unpacked copy stands for */
+static void * packedNode(const struct packed * p, const void * node)
+{
+	return p->buffer + ((const char *)node - p->copy);
+}
+
+/* the offset of the packed tree that a node of the copy is at */
+static void * packedOffset(const struct packed * p, const void * node)
+{
+	return (void *)((const char *)node - p->copy);
+}
+
+/* check that the edited tree is refused, and left as it is */
+static void checkRefused(struct packed * p, const char * name)
+{
+	char *before = malloc(p->size);
+
+	if (before == NULL) {
+		fprintf(stderr, "Out of memory!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	memcpy(before, p->buffer, p->size);
+	check(unpack_parse_tree(p->buffer, p->size) == NULL &&
+		memcmp(before, p->buffer, p->size) == 0, name);
+
+	free(before);
+	free(p->buffer);
+	free(p->copy);
+}
+
+static void testValid(void)
+{
+	static const char * const lines[] = {
+		"ls -l",
+		"a ; b | c && d || e & f",
+		"a & ; b &",
+		"echo x$HOME\"y\" 'z' > out 2>> err < in",
+		"ls &> out",
+	};
+
+	for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+		struct packed p;
+
+		pack(&p, lines[i]);
+		check(unpack_parse_tree(p.buffer, p.size) != NULL, lines[i]);
+		free(p.buffer);
+		free(p.copy);
+	}
+}
+
+static void testOperators(void)
+{
+	struct packed p;
+
+	/* a ; b | c, with the operators swapped: a | (b ; c) */
+	pack(&p, "a ; b | c");
+	((command_t *)packedNode(&p, p.root))->op = OP_PIPE;
+	((command_t *)packedNode(&p, p.root->cmd2))->op = OP_SEQUENTIAL;
+	checkRefused(&p, "sequence in a pipe");
+
+	/* a & ; b into (a &) | b */
+	pack(&p, "a & ; b");
+	((command_t *)packedNode(&p, p.root))->op = OP_PIPE;
+	checkRefused(&p, "background in a pipe");
+
+	/* a && b & ; c into (a && b &) & c */
+	pack(&p, "a && b & ; c");
+	((command_t *)packedNode(&p, p.root))->op = OP_PARALLEL;
+	checkRefused(&p, "background in a parallel command");
+}
+
+static void testSharedNodes(void)
+{
+	struct packed p;
+	command_t *inner;
+
+	/* a | b with b replaced by a */
+	pack(&p, "a | b");
+	((command_t *)packedNode(&p, p.root))->cmd2 = packedOffset(&p, p.root->cmd1);
+	checkRefused(&p, "command twice in a node");
+
+	/* (a | b) | c with c replaced by a */
+	pack(&p, "a | b | c");
+	inner = p.root->cmd1;
+	((command_t *)packedNode(&p, p.root))->cmd2 = packedOffset(&p, inner->cmd1);
+	checkRefused(&p, "command in two nodes");
+
+	/* a ; b with the simple command of a in both */
+	pack(&p, "a ; b");
+	((command_t *)packedNode(&p, p.root->cmd2))->scmd =
+		packedOffset(&p, p.root->cmd1->scmd);
+	checkRefused(&p, "simple command in two nodes");
+
+	/* a b ; c d with the parameters of a for c too */
+	pack(&p, "a b ; c d");
+	((simple_command_t *)packedNode(&p, p.root->cmd2->scmd))->params =
+		packedOffset(&p, p.root->cmd1->scmd->params);
+	checkRefused(&p, "word in two commands");
+
+	/* a b with the verb as its own parameter */
+	pack(&p, "a b");
+	((simple_command_t *)packedNode(&p, p.root->scmd))->params =
+		packedOffset(&p, p.root->scmd->verb);
+	checkRefused(&p, "word in two lists");
+
+	/* a x$V y with y after the part $V instead of after x$V */
+	pack(&p, "a x$V y");
+	((word_t *)packedNode(&p, p.root->scmd->params))->next_word = NULL;
+	((word_t *)packedNode(&p, p.root->scmd->params->next_part))->next_word =
+		packedOffset(&p, p.root->scmd->params->next_word);
+	checkRefused(&p, "word after a part");
+}
+
+int main(void)
+{
+	testValid();
+	testOperators();
+	testSharedNodes();
+
+	release_parse_memory();
+
+	if (nrFailed != 0) {
+		printf("%d tests failed\n", nrFailed);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,379 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Throughput of parse_line + free_parse_memory on generated corpora:
+ *
+ *   realistic  the seed lines (e.g. the tests), in a random order
+ *   fuzz       the seed lines with random edits, most of them parse errors
+ *   pipeline   deep pipelines (1000 commands)
+ *   vars       words made of many $VAR parts
+ *   quoted     long quoted words (64 KB)
+ *   huge       lines of 2 MB of commands
+ *
+ * For each corpus it reports the lines and bytes parsed per second, the
+ * calls to malloc per line (parse_malloc_count), the largest memory the
+ * parser kept (parse_memory_size) and the peak RSS of the process so far
+ * (the corpora go from the smallest lines to the largest, and the RSS
+ * includes the corpus itself).
+ *
+ * usage: ./ParserBench [-r rounds] [-s seed] [-d corpus] seed_file...
+ *   -r   parse every corpus that many times (1 by default)
+ *   -s   the seed of the random generator
+ *   -d   write the lines of a corpus to stdout instead (e.g. to check them
+ *        with DisplayStructure)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "./parser.h"
+
+#define MAX_LINE_LEN		4096
+#define MAX_SEEDS		4096
+
+/* The lines of a corpus, each one ending with "\n\0". */
+struct corpus {
+	const char *name;
+	char *data;
+	size_t size;
+	size_t capacity;
+	size_t nr_lines;
+	size_t bytes;
+};
+
+static char *seeds[MAX_SEEDS];
+static size_t nrSeeds;
+static unsigned long long randomSeed = 88172645463325252ULL;
+static unsigned long long randomState;
+static size_t nrErrors;
+
+
+void parse_error(const char *str, const int where)
+{
+	(void)str;
+	(void)where;
+
+	nrErrors++;
+}
+
+static unsigned long long nextRandom(void)
+{
+	/* xorshift64, so that a seed gives the same corpora everywhere */
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 7;
+	randomState ^= randomState << 17;
+
+	return randomState;
+}
+
+static size_t randomBelow(size_t n)
+{
+	return (size_t)(nextRandom() % n);
+}
+
+static void append(struct corpus * c, const char * str, size_t length)
+{
+	if (c->size + length > c->capacity) {
+		while (c->size + length > c->capacity)
+			c->capacity = (c->capacity == 0) ? 1 << 16 : 2 * c->capacity;
+		c->data = realloc(c->data, c->capacity);
+		if (c->data == NULL) {
+			fprintf(stderr, "Out of memory!\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	memcpy(c->data + c->size, str, length);
+	c->size += length;
+}
+
+static void appendString(struct corpus * c, const char * str)
+{
+	append(c, str, strlen(str));
+}
+
+static void appendRepeated(struct corpus * c, char ch, size_t count)
+{
+	char chunk[MAX_LINE_LEN];
+
+	memset(chunk, ch, sizeof(chunk));
+	while (count > 0) {
+		size_t length = (count < sizeof(chunk)) ? count : sizeof(chunk);
+
+		append(c, chunk, length);
+		count -= length;
+	}
+}
+
+static void endLine(struct corpus * c, size_t start)
+{
+	append(c, "\n", 2);
+	c->bytes += c->size - start - 1;
+	c->nr_lines++;
+}
+
+static void readSeeds(const char * fileName)
+{
+	char line[MAX_LINE_LEN];
+	FILE *file = fopen(fileName, "r");
+
+	if (file == NULL) {
+		perror(fileName);
+		exit(EXIT_FAILURE);
+	}
+
+	while (nrSeeds < MAX_SEEDS && fgets(line, sizeof(line), file) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+		seeds[nrSeeds] = strdup(line);
+		if (seeds[nrSeeds] == NULL) {
+			fprintf(stderr, "Out of memory!\n");
+			exit(EXIT_FAILURE);
+		}
+		nrSeeds++;
+	}
+
+	fclose(file);
+}
+
+static void makeRealistic(struct corpus * c)
+{
+	for (int i = 0; i < 20000; i++) {
+		size_t start = c->size;
+
+		appendString(c, seeds[randomBelow(nrSeeds)]);
+		endLine(c, start);
+	}
+}
+
+static void makeFuzz(struct corpus * c)
+{
+	static const char special[] = "|&;<>$\"'= \t\\%~x";
+
+	for (int i = 0; i < 20000; i++) {
+		char line[2 * MAX_LINE_LEN];
+		size_t length;
+		size_t start = c->size;
+		int edits = 1 + (int)randomBelow(4);
+
+		snprintf(line, MAX_LINE_LEN, "%s", seeds[randomBelow(nrSeeds)]);
+		length = strlen(line);
+
+		/* insert, delete or duplicate a few characters */
+		for (int j = 0; j < edits; j++) {
+			size_t at = randomBelow(length + 1);
+
+			switch (randomBelow(3)) {
+			case 0:
+				memmove(line + at + 1, line + at, length - at + 1);
+				line[at] = special[randomBelow(sizeof(special) - 1)];
+				length++;
+				break;
+			case 1:
+				if (at < length) {
+					memmove(line + at, line + at + 1, length - at);
+					length--;
+				}
+				break;
+			default:
+				if (length < MAX_LINE_LEN) {
+					size_t count = randomBelow(length - at + 1);
+
+					memmove(line + at + count, line + at, length - at + 1);
+					length += count;
+				}
+				break;
+			}
+		}
+
+		append(c, line, length);
+		endLine(c, start);
+	}
+}
+
+static void makePipeline(struct corpus * c)
+{
+	char command[64];
+
+	for (int i = 0; i < 200; i++) {
+		size_t start = c->size;
+
+		for (int j = 0; j < 1000; j++) {
+			snprintf(command, sizeof(command), "%scmd%d -x arg%d",
+				(j == 0) ? "" : " | ", j, i);
+			appendString(c, command);
+		}
+		appendString(c, " > out.txt");
+		endLine(c, start);
+	}
+}
+
+static void makeVars(struct corpus * c)
+{
+	char part[64];
+
+	for (int i = 0; i < 2000; i++) {
+		size_t start = c->size;
+
+		appendString(c, "echo");
+		for (int j = 0; j < 3; j++) {
+			appendString(c, " ");
+			for (int k = 0; k < 200; k++) {
+				snprintf(part, sizeof(part),
+					(k % 2 == 0) ? "$VAR%d" : "x%d\"$HOME\"", k);
+				appendString(c, part);
+			}
+		}
+		endLine(c, start);
+	}
+}
+
+static void makeQuoted(struct corpus * c)
+{
+	for (int i = 0; i < 200; i++) {
+		size_t start = c->size;
+
+		appendString(c, "echo \"");
+		appendRepeated(c, 'q', 1 << 16);
+		appendString(c, "\" '");
+		appendRepeated(c, 's', 1 << 16);
+		appendString(c, "'");
+		endLine(c, start);
+	}
+}
+
+static void makeHuge(struct corpus * c)
+{
+	static const char * const operators[] = { " ; ", " && ", " || ", " | " };
+
+	for (int i = 0; i < 8; i++) {
+		size_t start = c->size;
+
+		appendString(c, "cmd a b <in.txt");
+		while (c->size - start < (1 << 21)) {
+			appendString(c, operators[randomBelow(4)]);
+			appendString(c, "cmd a b <in.txt");
+		}
+		endLine(c, start);
+	}
+}
+
+static struct {
+	const char *name;
+	void (*make)(struct corpus *);
+} corpora[] = {
+	{ "realistic",	makeRealistic },
+	{ "fuzz",	makeFuzz },
+	{ "pipeline",	makePipeline },
+	{ "vars",	makeVars },
+	{ "quoted",	makeQuoted },
+	{ "huge",	makeHuge },
+};
+
+#define NR_CORPORA	(sizeof(corpora) / sizeof(corpora[0]))
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void runCorpus(const struct corpus * c, int rounds)
+{
+	size_t mallocs = parse_malloc_count();
+	size_t memory = 0;
+	struct rusage usage;
+	double start;
+	double seconds;
+
+	nrErrors = 0;
+	start = now();
+	for (int i = 0; i < rounds; i++) {
+		for (const char *line = c->data; line < c->data + c->size;
+			line += strlen(line) + 1) {
+			command_t *root = NULL;
+
+			parse_line(line, &root);
+			if (parse_memory_size() > memory)
+				memory = parse_memory_size();
+			free_parse_memory();
+		}
+	}
+	seconds = now() - start;
+
+	getrusage(RUSAGE_SELF, &usage);
+	printf("%-9s %7zu lines %10zu bytes %10.0f lines/s %8.1f MB/s "
+		"%7.2f mallocs/line %6zu kB parser %6ld kB rss %6zu errors\n",
+		c->name, c->nr_lines, c->bytes,
+		c->nr_lines * rounds / seconds, c->bytes * rounds / seconds / 1e6,
+		(double)(parse_malloc_count() - mallocs) / (c->nr_lines * rounds),
+		memory / 1024, usage.ru_maxrss, nrErrors / rounds);
+}
+
+static void usage(const char * program)
+{
+	fprintf(stderr, "usage: %s [-r rounds] [-s seed] [-d corpus] "
+		"seed_file...\n", program);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dump = NULL;
+	int rounds = 1;
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (i + 1 == argc)
+			usage(argv[0]);
+
+		if (strcmp(argv[i], "-r") == 0)
+			rounds = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-s") == 0)
+			randomSeed = strtoull(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-d") == 0)
+			dump = argv[++i];
+		else
+			usage(argv[0]);
+	}
+
+	if (i == argc || rounds <= 0)
+		usage(argv[0]);
+
+	for (; i < argc; i++)
+		readSeeds(argv[i]);
+
+	if (nrSeeds == 0) {
+		fprintf(stderr, "No seed lines!\n");
+		return EXIT_FAILURE;
+	}
+
+	for (size_t j = 0; j < NR_CORPORA; j++) {
+		struct corpus c = { .name = corpora[j].name };
+
+		if (dump != NULL && strcmp(dump, c.name) != 0)
+			continue;
+
+		/* every corpus has its own sequence, written out the same by -d */
+		randomState = (randomSeed + j) | 1;
+		corpora[j].make(&c);
+		if (dump != NULL) {
+			for (const char *line = c.data; line < c.data + c.size;
+				line += strlen(line) + 1)
+				fputs(line, stdout);
+		} else {
+			runCorpus(&c, rounds);
+		}
+		free(c.data);
+	}
+
+	for (size_t j = 0; j < nrSeeds; j++)
+		free(seeds[j]);
+	release_parse_memory();
+
+	return EXIT_SUCCESS;
+}
@@ -40,6 +40,7 @@ int main()
 		//there was an error parsing the command
 	}
 	free_parse_memory();
+	release_parse_memory();
 
 	return EXIT_SUCCESS;
 }
@@ -20,6 +20,9 @@
 
 
 
+#include <stddef.h>
+
+
 #ifdef __cplusplus
 #else
 /*
@@ -124,6 +127,11 @@ typedef struct {
 
  * The rest of the operators mean scmd == NULL
 
+ * OP_BACKGROUND (a trailing &) is the only one with a single operand:
+ * cmd1 runs in the background and cmd2 == NULL; the & ends a command of the
+ * list (it is followed by the end of the line or by ;), so only OP_SEQUENTIAL
+ * nodes can be above it
+
  * OP_DUMMY is a dummy value that can be used to count the number of operators
  */
 
@@ -134,6 +142,7 @@ typedef enum {
 	OP_CONDITIONAL_ZERO,
 	OP_CONDITIONAL_NZERO,
 	OP_PIPE,
+	OP_BACKGROUND,
 	OP_DUMMY
 } operator_t;
 
@@ -148,7 +157,7 @@ typedef enum {
  *  else
       scmd == NULL
       cmd1 != NULL
-      cmd2 != NULL
+      cmd2 != NULL (except for OP_BACKGROUND)
       cmd1 op cmd2 must be executed, according to the rules for op
 
  * You can use aux the same way as for simple_command_t
@@ -209,6 +218,37 @@ void parse_error(const char *str, const int where);
 bool parse_line(const char *line, command_t **root);
 
 
+/*
+ * Same as parse_line, for a line given by its first length characters
+ * (e.g. straight from a larger buffer); it needs no terminator
+ */
+
+bool parse_line_n(const char *line, size_t length, command_t **root);
+
+
+/*
+ * Streaming parsing: the lines are read from a file descriptor
+ * (parse_stream_fd) or from a memory region (parse_stream_buffer) while
+ * they are parsed, in chunks, instead of being split and buffered by the
+ * caller; a line can have any length, and it is parsed as soon as its
+ * newline is read (e.g. from a pipe)
+
+ * parse_stream_line parses the next line into (*root), like parse_line
+ * (and (*root) must point to NULL too); it returns 1 if the line was
+ * parsed, 0 if there was an error parsing it (the rest of the line is
+ * skipped) and -1 at the end of the input
+ * free_parse_memory must be called after every line
+
+ * parse_stream_end stops reading (the file descriptor is not closed);
+ * the tree of the last line is still valid until free_parse_memory
+ */
+
+void parse_stream_fd(int fd);
+void parse_stream_buffer(const char *buffer, size_t length);
+int parse_stream_line(command_t **root);
+void parse_stream_end(void);
+
+
 /*
  * Should be called to free the parse tree
  * call this even if parse_line() returned false
@@ -216,6 +256,91 @@ bool parse_line(const char *line, command_t **root);
 
 void free_parse_memory(void);
 
+
+/*
+ * The memory of the parse trees is reused from one line to the next;
+ * call this when the parser is not needed anymore to give it back
+ */
+
+void release_parse_memory(void);
+
+
+/*
+ * Returns how many times the parser called malloc() for the default context
+ * since the program started (the memory is reused, so this should barely
+ * grow per line)
+ */
+
+size_t parse_malloc_count(void);
+
+
+/*
+ * Returns the size of the memory the parser keeps for the next lines: the
+ * memory of the trees of the default context, which shrinks back to what
+ * the last lines needed, and the buffers of the stream of the thread
+ */
+
+size_t parse_memory_size(void);
+
+
+/*
+ * Reentrant parsing: a parser context owns the memory of its parse trees,
+ * so that several threads can parse at the same time, each with its own
+ * context (a context must only be used by one thread at a time, but it can
+ * move from one thread to another between the lines)
+
+ * parser_ctx_new returns a new context, or NULL if it cannot be allocated;
+ * parser_ctx_free gives its memory back (its tree is not valid anymore)
+
+ * parse_line_r, parse_line_n_r, parse_stream_line_r and free_parse_memory_r
+ * are the same as the functions without _r, for the trees of ctx;
+ * the functions without _r use a default context of the program
+
+ * A stream (see above) belongs to the thread that started it, and so does
+ * the state of the scanner: a thread that used the parser should call
+ * release_parse_thread before it exits.
+ * parse_error may be called by any thread that parses.
+ */
+
+typedef struct parser_ctx parser_ctx_t;
+
+parser_ctx_t *parser_ctx_new(void);
+void parser_ctx_free(parser_ctx_t *ctx);
+bool parse_line_r(parser_ctx_t *ctx, const char *line, command_t **root);
+bool parse_line_n_r(parser_ctx_t *ctx, const char *line, size_t length,
+	command_t **root);
+int parse_stream_line_r(parser_ctx_t *ctx, command_t **root);
+void free_parse_memory_r(parser_ctx_t *ctx);
+void release_parse_thread(void);
+
+
+/*
+ * Packed parse trees, e.g. to send a tree to another process (of a build
+ * with the same layout) instead of its line, so that it is not parsed again
+ * there: the tree is packed in a single relocatable buffer, made of flat
+ * arrays of nodes that refer to each other by offsets and of a table with
+ * every distinct string once (see parsetree.c)
+
+ * pack_parse_tree packs root (not NULL) into buffer (aligned like malloc)
+ * if it has room for it (size bytes); it returns the size of the packed
+ * tree either way (so it can be called with size 0 first), or 0 if the tree
+ * is too big to be packed
+
+ * unpack_parse_tree turns the offsets of the packed tree of size bytes in
+ * buffer (aligned like malloc, and writable, e.g. a received message or a
+ * MAP_PRIVATE mapping) back into pointers, in place: the tree is used
+ * straight from the buffer, nothing is copied or allocated; it returns its
+ * root, or NULL if buffer does not hold a valid packed tree, with the shape
+ * of a parse tree described above (it is left unchanged then)
+
+ * is_packed_parse_tree tells a packed tree from a line (it starts with a
+ * NUL character)
+ */
+
+size_t pack_parse_tree(command_t *root, void *buffer, size_t size);
+command_t *unpack_parse_tree(void *buffer, size_t size);
+bool is_packed_parse_tree(const void *buffer, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -229,6 +354,15 @@ void free_parse_memory(void);
 
 typedef void *GenericPointer;
 
+/* the state of the parser and of the scanner is per thread */
+#ifndef PARSER_THREAD_LOCAL
+#  ifdef _MSC_VER
+#    define PARSER_THREAD_LOCAL __declspec(thread)
+#  else
+#    define PARSER_THREAD_LOCAL __thread
+#  endif
+#endif
+
 typedef struct {
 	word_t *red_i;
 	word_t *red_o;
@@ -242,10 +376,17 @@ extern "C"
 {
 #endif
 
-void pointerToMallocMemory(const void *ptr);
-int yylex(void);
-void globalParseAnotherString(const char *str);
+void *parserAlloc(size_t size);
+char *parserStrdup(const char *str);
+void globalParseAnotherString(const char *str, size_t length);
 void globalEndParsing(void);
+void globalReleaseParsing(void);
+int globalStreamInput(char *buf, int max_size);
+void globalParseStream(int fd, const char *data, size_t size);
+bool globalStreamNextLine(void);
+void globalStreamSkipLine(void);
+void globalEndStream(void);
+size_t globalScannerSize(void);
 
 #ifdef __cplusplus
 }
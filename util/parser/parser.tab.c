@@ -55,7 +55,7 @@
 #define YYSKELETON_NAME "yacc.c"
 
 /* Pure parsers.  */
-#define YYPURE 0
+#define YYPURE 2
 
 /* Push parsers.  */
 #define YYPUSH 0
@@ -67,7 +67,7 @@
 
 
 /* First part of user prologue.  */
-#line 3 "parser.y"
+#line 4 "parser.y"
 
 
 
@@ -101,65 +101,154 @@ using namespace std;
 #include "parser.h"
 
 
-static GenericPointer * globalAllocMem = NULL;
-static size_t globalAllocCount = 0;
-static size_t globalAllocSize  = 0;
-static bool needsFree = false;
-static command_t * command_root = NULL;
+/*
+ * All the memory of the parse trees of a context (nodes and token strings) is
+ * taken from an arena made of a list of blocks. free_parse_memory_r() only
+ * rewinds the arena, the blocks are kept and reused for the next lines, as
+ * long as one of the last ARENA_WINDOW lines needed them (so that the memory
+ * of a single huge line does not stay there for the whole session).
+ */
+#define ARENA_BLOCK_SIZE	(64 * 1024)
+#define ARENA_ALIGNMENT		16
+#define ARENA_WINDOW		16
+
+typedef struct arena_block {
+	struct arena_block * next;
+	size_t size;
+} arena_block_t;
+
+struct parser_ctx {
+	arena_block_t * arenaFirst;
+	arena_block_t * arenaCurrent;
+	size_t arenaUsed;
+	size_t arenaMallocCount;
+	size_t arenaSize;
+	/* how much of the arena the last lines used */
+	size_t recentUse[ARENA_WINDOW];
+	size_t nrLines;
+	bool needsFree;
+	command_t * commandRoot;
+};
+
+/* the context of parse_line, of the streams and of free_parse_memory */
+static parser_ctx_t defaultCtx;
 
+/* the context of the line the current thread parses */
+static PARSER_THREAD_LOCAL parser_ctx_t * currentCtx = NULL;
 
-void yyerror(const char* str);
 
+/* the usable memory of a block starts right after its (aligned) header */
+#define ARENA_HEADER_SIZE \
+	((sizeof(arena_block_t) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+#define ARENA_BLOCK_DATA(b)	((char *)(b) + ARENA_HEADER_SIZE)
 
-static void ensureSize(size_t newSize)
+
+static arena_block_t * newArenaBlock(size_t minSize)
 {
-	GenericPointer * newPtr;
-	assert(newSize > 0);
-
-	if (globalAllocSize == 0) {
-		assert(globalAllocMem == NULL);
-		globalAllocSize = newSize;
-		globalAllocMem = (GenericPointer *)malloc(sizeof(GenericPointer) * globalAllocSize);
-		if (globalAllocMem == NULL) {
-			fprintf(stderr, "malloc() failed\n");
-			exit(EXIT_FAILURE);
-		}
+	size_t size = (minSize > ARENA_BLOCK_SIZE) ? minSize : ARENA_BLOCK_SIZE;
+	arena_block_t * b = (arena_block_t *)malloc(ARENA_HEADER_SIZE + size);
 
-		return;
+	if (b == NULL) {
+		fprintf(stderr, "malloc() failed\n");
+		exit(EXIT_FAILURE);
 	}
 
-	assert(globalAllocMem != NULL);
-	if (globalAllocSize >= newSize) {
-		return;
+	currentCtx->arenaMallocCount++;
+	currentCtx->arenaSize += size;
+	b->next = NULL;
+	b->size = size;
+
+	return b;
+}
+
+
+void * parserAlloc(size_t size)
+{
+	parser_ctx_t * ctx = currentCtx;
+	arena_block_t * b;
+
+	size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+	if (size == 0) {
+		size = ARENA_ALIGNMENT;
 	}
 
-	globalAllocSize += newSize;
-	newPtr = (GenericPointer *)realloc((void *)globalAllocMem, sizeof(GenericPointer) * globalAllocSize);
-	if (newPtr == NULL) {
-		fprintf(stderr, "realloc() failed\n");
-		exit(EXIT_FAILURE);
+	if (ctx->arenaCurrent == NULL) {
+		assert(ctx->arenaFirst == NULL);
+		ctx->arenaFirst = ctx->arenaCurrent = newArenaBlock(size);
+		ctx->arenaUsed = 0;
 	}
 
-	globalAllocMem = newPtr;
+	if (ctx->arenaCurrent->size - ctx->arenaUsed < size) {
+		/* reuse the next block if it is big enough, else insert a new one */
+		b = ctx->arenaCurrent->next;
+		if ((b == NULL) || (b->size < size)) {
+			b = newArenaBlock(size);
+			b->next = ctx->arenaCurrent->next;
+			ctx->arenaCurrent->next = b;
+		}
+
+		ctx->arenaCurrent = b;
+		ctx->arenaUsed = 0;
+	}
+
+	ctx->arenaUsed += size;
+	return ARENA_BLOCK_DATA(ctx->arenaCurrent) + ctx->arenaUsed - size;
 }
 
 
-void pointerToMallocMemory(const void * ptr)
+char * parserStrdup(const char * str)
 {
-	if (ptr == NULL) {
-		fprintf(stderr, "malloc() failed\n");
-		exit(EXIT_FAILURE);
+	size_t length = strlen(str) + 1;
+	char * copy = (char *)parserAlloc(length);
+
+	memcpy(copy, str, length);
+	return copy;
+}
+
+
+static void arenaReset(parser_ctx_t * ctx)
+{
+	arena_block_t * b;
+	size_t used = ctx->arenaUsed;
+	size_t keep = 0;
+	size_t kept;
+	int i;
+
+	for (b = ctx->arenaFirst; (b != NULL) && (b != ctx->arenaCurrent); b = b->next) {
+		used += b->size;
+	}
+
+	ctx->recentUse[ctx->nrLines++ % ARENA_WINDOW] = used;
+	for (i = 0; i < ARENA_WINDOW; i++) {
+		if (ctx->recentUse[i] > keep) {
+			keep = ctx->recentUse[i];
+		}
 	}
 
-	ensureSize(globalAllocCount + 1);
-	globalAllocMem[globalAllocCount++] = (GenericPointer)ptr;
+	/* the first block is always kept, the ones past keep are freed */
+	b = ctx->arenaFirst;
+	if (b != NULL) {
+		for (kept = b->size; (b->next != NULL) && (kept < keep); kept += b->size) {
+			b = b->next;
+		}
+
+		while (b->next != NULL) {
+			arena_block_t * next = b->next;
+
+			b->next = next->next;
+			ctx->arenaSize -= next->size;
+			free(next);
+		}
+	}
+
+	ctx->arenaCurrent = ctx->arenaFirst;
+	ctx->arenaUsed = 0;
 }
 
 
 static simple_command_t * bind_parts(word_t * exe_name, word_t * params, redirect_t red)
 {
-	simple_command_t * s = (simple_command_t *) malloc(sizeof(simple_command_t));
-	pointerToMallocMemory(s);
+	simple_command_t * s = (simple_command_t *) parserAlloc(sizeof(simple_command_t));
 
 	memset(s, 0, sizeof(*s));
 	assert(exe_name != NULL);
@@ -178,13 +267,7 @@ static simple_command_t * bind_parts(word_t * exe_name, word_t * params, redirec
 
 static command_t * new_command(simple_command_t * scmd)
 {
-	command_t * c = (command_t *) malloc(sizeof(command_t));
-
-	if (c == NULL) {
-		fprintf(stderr, "malloc() failed\n");
-		exit(EXIT_FAILURE);
-	}
-	pointerToMallocMemory(c);
+	command_t * c = (command_t *) parserAlloc(sizeof(command_t));
 
 	memset(c, 0, sizeof(*c));
 	c->up = c->cmd1 = c->cmd2 = NULL;
@@ -199,8 +282,7 @@ static command_t * new_command(simple_command_t * scmd)
 
 static command_t * bind_commands(command_t * cmd1, command_t * cmd2, operator_t op)
 {
-	command_t * c = (command_t *) malloc(sizeof(command_t));
-	pointerToMallocMemory(c);
+	command_t * c = (command_t *) parserAlloc(sizeof(command_t));
 
 	memset(c, 0, sizeof(*c));
 	c->up = NULL;
@@ -222,10 +304,28 @@ static command_t * bind_commands(command_t * cmd1, command_t * cmd2, operator_t
 }
 
 
+/* A trailing & binds tighter than ; (a ; b & only sends b to the background). */
+static command_t * background_command(command_t * cmd)
+{
+	command_t * c = (command_t *) parserAlloc(sizeof(command_t));
+
+	memset(c, 0, sizeof(*c));
+	c->up = NULL;
+	assert(cmd->up == NULL);
+	c->cmd1 = cmd;
+	cmd->up = c;
+	c->cmd2 = NULL;
+	c->op = OP_BACKGROUND;
+	c->scmd = NULL;
+	c->aux = NULL;
+
+	return c;
+}
+
+
 static word_t * new_word(const char * str, bool expand)
 {
-	word_t * w = (word_t *) malloc(sizeof(word_t));
-	pointerToMallocMemory(w);
+	word_t * w = (word_t *) parserAlloc(sizeof(word_t));
 
 	memset(w, 0, sizeof(*w));
 	assert(str != NULL);
@@ -263,6 +363,22 @@ static word_t * add_part_to_word(word_t * w, word_t * lst)
 }
 
 
+/*
+ the lists of words are linked through next_word, so a word that goes
+ into two of them (&>) needs a node for each one (its parts are shared)
+*/
+static word_t * copy_word(const word_t * w)
+{
+	word_t * c = (word_t *) parserAlloc(sizeof(word_t));
+
+	assert(w != NULL);
+	*c = *w;
+	c->next_word = NULL;
+
+	return c;
+}
+
+
 static word_t * add_word_to_list(word_t * w, word_t * lst)
 {
 	word_t * crt = lst;
@@ -289,7 +405,7 @@ static word_t * add_word_to_list(word_t * w, word_t * lst)
 
 
 
-#line 293 "parser.tab.c"
+#line 409 "parser.tab.c"
 
 # ifndef YY_CAST
 #  ifdef __cplusplus
@@ -342,12 +458,14 @@ enum yysymbol_kind_t
   YYSYMBOL_PIPE = 22,                      /* PIPE  */
   YYSYMBOL_YYACCEPT = 23,                  /* $accept  */
   YYSYMBOL_command_tree = 24,              /* command_tree  */
-  YYSYMBOL_command = 25,                   /* command  */
-  YYSYMBOL_simple_command = 26,            /* simple_command  */
-  YYSYMBOL_exe_name = 27,                  /* exe_name  */
-  YYSYMBOL_params = 28,                    /* params  */
-  YYSYMBOL_redirect = 29,                  /* redirect  */
-  YYSYMBOL_word = 30                       /* word  */
+  YYSYMBOL_list = 25,                      /* list  */
+  YYSYMBOL_job = 26,                       /* job  */
+  YYSYMBOL_command = 27,                   /* command  */
+  YYSYMBOL_simple_command = 28,            /* simple_command  */
+  YYSYMBOL_exe_name = 29,                  /* exe_name  */
+  YYSYMBOL_params = 30,                    /* params  */
+  YYSYMBOL_redirect = 31,                  /* redirect  */
+  YYSYMBOL_word = 32                       /* word  */
 };
 typedef enum yysymbol_kind_t yysymbol_kind_t;
 
@@ -676,18 +794,18 @@ union yyalloc
 #endif /* !YYCOPY_NEEDED */
 
 /* YYFINAL -- State number of the termination state.  */
-#define YYFINAL  14
+#define YYFINAL  16
 /* YYLAST -- Last index in YYTABLE.  */
-#define YYLAST   130
+#define YYLAST   132
 
 /* YYNTOKENS -- Number of terminals.  */
 #define YYNTOKENS  23
 /* YYNNTS -- Number of nonterminals.  */
-#define YYNNTS  8
+#define YYNNTS  10
 /* YYNRULES -- Number of rules.  */
-#define YYNRULES  50
+#define YYNRULES  54
 /* YYNSTATES -- Number of states.  */
-#define YYNSTATES  75
+#define YYNSTATES  78
 
 /* YYMAXUTOK -- Last valid token kind.  */
 #define YYMAXUTOK   277
@@ -738,12 +856,12 @@ static const yytype_int8 yytranslate[] =
 /* YYRLINE[YYN] -- Source line where rule number YYN was defined.  */
 static const yytype_int16 yyrline[] =
 {
-       0,   261,   261,   266,   271,   276,   281,   286,   295,   299,
-     303,   307,   311,   315,   323,   327,   331,   335,   343,   347,
-     355,   360,   367,   374,   380,   385,   390,   396,   402,   407,
-     413,   418,   423,   429,   435,   440,   446,   451,   456,   462,
-     468,   472,   478,   483,   488,   494,   500,   509,   513,   517,
-     521
+       0,   392,   392,   397,   402,   407,   412,   417,   426,   430,
+     439,   443,   447,   455,   459,   463,   467,   471,   479,   483,
+     487,   491,   499,   503,   511,   516,   523,   530,   536,   541,
+     546,   552,   558,   563,   569,   574,   579,   585,   591,   596,
+     602,   607,   612,   618,   624,   628,   634,   639,   644,   650,
+     656,   665,   669,   673,   677
 };
 #endif
 
@@ -764,8 +882,8 @@ static const char *const yytname[] =
   "END_OF_FILE", "END_OF_LINE", "BLANK", "REDIRECT_OE", "REDIRECT_O",
   "REDIRECT_E", "INDIRECT", "REDIRECT_APPEND_E", "REDIRECT_APPEND_O",
   "WORD", "ENV_VAR", "SEQUENTIAL", "PARALLEL", "CONDITIONAL_NZERO",
-  "CONDITIONAL_ZERO", "PIPE", "$accept", "command_tree", "command",
-  "simple_command", "exe_name", "params", "redirect", "word", YY_NULLPTR
+  "CONDITIONAL_ZERO", "PIPE", "$accept", "command_tree", "list", "job",
+  "command", "simple_command", "exe_name", "params", "redirect", "word", YY_NULLPTR
 };
 
 static const char *
@@ -775,7 +893,7 @@ yysymbol_name (yysymbol_kind_t yysymbol)
 }
 #endif
 
-#define YYPACT_NINF (-22)
+#define YYPACT_NINF (-23)
 
 #define yypact_value_is_default(Yyn) \
   ((Yyn) == YYPACT_NINF)
@@ -789,14 +907,14 @@ yysymbol_name (yysymbol_kind_t yysymbol)
    STATE-NUM.  */
 static const yytype_int8 yypact[] =
 {
-      44,   -22,   -22,    14,   -22,   -22,    10,    -5,   -22,     3,
-     100,   -22,   -22,   100,   -22,   -22,   -22,     9,     9,     9,
-       9,     9,   113,    -6,   -22,   -22,   113,   106,     7,     2,
-       2,   -22,    30,    -6,   100,    38,    40,    49,    53,    55,
-      58,   113,    -6,   113,    64,   113,    67,   113,    69,   113,
-      73,   113,    78,   113,    82,    -6,   100,    84,   -22,    87,
-     -22,    93,   -22,    96,   -22,    98,   -22,   102,   -22,   -22,
-     -22,   -22,   -22,   -22,   -22
+      -1,   -23,   -23,     2,   -23,   -23,     1,    -4,   -23,    92,
+     -23,     8,    -5,   -23,   -23,    -5,   -23,   -23,   -23,    14,
+      17,    14,    14,    14,    12,   109,   -23,   -23,    12,   -23,
+      12,   110,   -17,   -17,   -23,    11,   109,    -5,    39,    41,
+      43,    45,    54,    56,    12,   109,    12,    58,    12,    60,
+      12,    69,    12,    71,    12,    73,    12,    75,   109,    -5,
+      84,   -23,    86,   -23,    88,   -23,    90,   -23,    99,   -23,
+     101,   -23,   -23,   -23,   -23,   -23,   -23,   -23
 };
 
 /* YYDEFACT[STATE-NUM] -- Default reduction number in state STATE-NUM.
@@ -804,26 +922,26 @@ static const yytype_int8 yypact[] =
    means the default is an error.  */
 static const yytype_int8 yydefact[] =
 {
-       0,     5,     4,     0,    49,    50,     0,     0,     8,    22,
-      18,     7,     6,    19,     1,     3,     2,     0,     0,     0,
-       0,     0,    22,    16,    47,    48,     0,     9,    10,    12,
-      11,    13,    22,    17,    21,     0,     0,     0,     0,     0,
-       0,    22,    14,     0,    23,     0,    25,     0,    24,     0,
-      28,     0,    26,     0,    27,    15,    20,    35,    29,    37,
-      31,    36,    30,    40,    34,    38,    32,    39,    33,    41,
-      43,    42,    46,    45,    44
+       0,     5,     4,     0,    53,    54,     0,     0,     8,    10,
+      13,    26,    22,     7,     6,    23,     1,     3,     2,     0,
+      11,     0,     0,     0,    26,    20,    51,    52,     0,     9,
+      12,    14,    16,    15,    17,    26,    21,    25,     0,     0,
+       0,     0,     0,     0,    26,    18,     0,    27,     0,    29,
+       0,    28,     0,    32,     0,    30,     0,    31,    19,    24,
+      39,    33,    41,    35,    40,    34,    44,    38,    42,    36,
+      43,    37,    45,    47,    46,    50,    49,    48
 };
 
 /* YYPGOTO[NTERM-NUM].  */
 static const yytype_int8 yypgoto[] =
 {
-     -22,   -22,   103,   -22,   -22,   -22,   -21,    -3
+     -23,   -23,   -23,     5,   105,   -23,   -23,   -23,   -22,    -3
 };
 
 /* YYDEFGOTO[NTERM-NUM].  */
 static const yytype_int8 yydefgoto[] =
 {
-       0,     6,     7,     8,     9,    32,    23,    10
+       0,     6,     7,     8,     9,    10,    11,    35,    25,    12
 };
 
 /* YYTABLE[YYPACT[STATE-NUM]] -- What to do in state STATE-NUM.  If
@@ -831,38 +949,38 @@ static const yytype_int8 yydefgoto[] =
    number is the opposite.  If YYTABLE_NINF, syntax error.  */
 static const yytype_int8 yytable[] =
 {
-      13,    33,    15,    16,    35,    36,    37,    38,    39,    40,
-      14,    42,    22,    17,    18,    19,    20,    21,    26,    34,
-      55,    11,    12,    13,    21,     4,     5,    19,    20,    21,
-       4,     5,    44,    46,    48,    50,    52,    54,    56,    41,
-      57,     0,    59,     0,    61,     0,    63,    43,    65,    45,
-      67,     1,     2,     3,     4,     5,     4,     5,    47,     0,
-       4,     5,    49,     0,    51,     4,     5,    53,     0,     4,
-       5,     4,     5,    58,     4,     5,    60,     0,    62,     0,
-      24,    25,    64,    24,    25,    24,    25,    66,     0,    24,
-      25,    68,     0,    69,    24,    25,    70,     0,    24,    25,
-      24,    25,    71,    24,    25,    72,     0,    73,     0,    24,
-      25,    74,    24,    25,    24,    25,    24,    25,    24,    25,
-      27,    28,    29,    30,    31,    18,    19,    20,    21,     4,
-       5
+      15,    16,    36,    17,    18,    23,     1,     2,     3,    13,
+      14,    26,    27,    45,    19,     4,     5,    24,     4,     5,
+      44,    37,    58,    28,    29,    15,    30,    15,     4,     5,
+       4,     5,     0,     4,     5,    47,    49,    51,    53,    55,
+      57,    59,     0,    60,     0,    62,     0,    64,    46,    66,
+      48,    68,    50,    70,    52,     4,     5,     4,     5,     4,
+       5,     4,     5,    54,     0,    56,     0,    61,     0,    63,
+       4,     5,     4,     5,    26,    27,    26,    27,    65,     0,
+      67,     0,    69,     0,    71,    26,    27,    26,    27,    26,
+      27,    26,    27,    72,     0,    73,     0,    74,     0,    75,
+      26,    27,    26,    27,    26,    27,    26,    27,    76,     0,
+      77,    20,    21,    22,    23,    26,    27,    26,    27,    38,
+      39,    40,    41,    42,    43,    31,    32,    33,    34,     0,
+      21,    22,    23
 };
 
 static const yytype_int8 yycheck[] =
 {
-       3,    22,     7,     8,    10,    11,    12,    13,    14,    15,
-       0,    32,     9,    18,    19,    20,    21,    22,     9,    22,
-      41,     7,     8,    26,    22,    16,    17,    20,    21,    22,
-      16,    17,    35,    36,    37,    38,    39,    40,    41,     9,
-      43,    -1,    45,    -1,    47,    -1,    49,     9,    51,     9,
-      53,     7,     8,     9,    16,    17,    16,    17,     9,    -1,
-      16,    17,     9,    -1,     9,    16,    17,     9,    -1,    16,
-      17,    16,    17,     9,    16,    17,     9,    -1,     9,    -1,
-      16,    17,     9,    16,    17,    16,    17,     9,    -1,    16,
-      17,     9,    -1,     9,    16,    17,     9,    -1,    16,    17,
-      16,    17,     9,    16,    17,     9,    -1,     9,    -1,    16,
-      17,     9,    16,    17,    16,    17,    16,    17,    16,    17,
-      17,    18,    19,    20,    21,    19,    20,    21,    22,    16,
-      17
+       3,     0,    24,     7,     8,    22,     7,     8,     9,     7,
+       8,    16,    17,    35,    18,    16,    17,     9,    16,    17,
+       9,    24,    44,     9,    19,    28,     9,    30,    16,    17,
+      16,    17,    -1,    16,    17,    38,    39,    40,    41,    42,
+      43,    44,    -1,    46,    -1,    48,    -1,    50,     9,    52,
+       9,    54,     9,    56,     9,    16,    17,    16,    17,    16,
+      17,    16,    17,     9,    -1,     9,    -1,     9,    -1,     9,
+      16,    17,    16,    17,    16,    17,    16,    17,     9,    -1,
+       9,    -1,     9,    -1,     9,    16,    17,    16,    17,    16,
+      17,    16,    17,     9,    -1,     9,    -1,     9,    -1,     9,
+      16,    17,    16,    17,    16,    17,    16,    17,     9,    -1,
+       9,    19,    20,    21,    22,    16,    17,    16,    17,    10,
+      11,    12,    13,    14,    15,    20,    21,    22,    23,    -1,
+      20,    21,    22
 };
 
 /* YYSTOS[STATE-NUM] -- The symbol kind of the accessing symbol of
@@ -870,35 +988,35 @@ static const yytype_int8 yycheck[] =
 static const yytype_int8 yystos[] =
 {
        0,     7,     8,     9,    16,    17,    24,    25,    26,    27,
-      30,     7,     8,    30,     0,     7,     8,    18,    19,    20,
-      21,    22,     9,    29,    16,    17,     9,    25,    25,    25,
-      25,    25,    28,    29,    30,    10,    11,    12,    13,    14,
-      15,     9,    29,     9,    30,     9,    30,     9,    30,     9,
-      30,     9,    30,     9,    30,    29,    30,    30,     9,    30,
-       9,    30,     9,    30,     9,    30,     9,    30,     9,     9,
-       9,     9,     9,     9,     9
+      28,    29,    32,     7,     8,    32,     0,     7,     8,    18,
+      19,    20,    21,    22,     9,    31,    16,    17,     9,    26,
+       9,    27,    27,    27,    27,    30,    31,    32,    10,    11,
+      12,    13,    14,    15,     9,    31,     9,    32,     9,    32,
+       9,    32,     9,    32,     9,    32,     9,    32,    31,    32,
+      32,     9,    32,     9,    32,     9,    32,     9,    32,     9,
+      32,     9,     9,     9,     9,     9,     9,     9
 };
 
 /* YYR1[RULE-NUM] -- Symbol kind of the left-hand side of rule RULE-NUM.  */
 static const yytype_int8 yyr1[] =
 {
        0,    23,    24,    24,    24,    24,    24,    24,    25,    25,
-      25,    25,    25,    25,    26,    26,    26,    26,    27,    27,
-      28,    28,    29,    29,    29,    29,    29,    29,    29,    29,
-      29,    29,    29,    29,    29,    29,    29,    29,    29,    29,
-      29,    29,    29,    29,    29,    29,    29,    30,    30,    30,
-      30
+      26,    26,    26,    27,    27,    27,    27,    27,    28,    28,
+      28,    28,    29,    29,    30,    30,    31,    31,    31,    31,
+      31,    31,    31,    31,    31,    31,    31,    31,    31,    31,
+      31,    31,    31,    31,    31,    31,    31,    31,    31,    31,
+      31,    32,    32,    32,    32
 };
 
 /* YYR2[RULE-NUM] -- Number of symbols on the right-hand side of rule RULE-NUM.  */
 static const yytype_int8 yyr2[] =
 {
        0,     2,     2,     2,     1,     1,     2,     2,     1,     3,
-       3,     3,     3,     3,     4,     5,     2,     3,     1,     2,
-       3,     1,     0,     3,     3,     3,     3,     3,     3,     4,
-       4,     4,     4,     4,     4,     4,     4,     4,     4,     4,
-       4,     5,     5,     5,     5,     5,     5,     2,     2,     1,
-       1
+       1,     2,     3,     1,     3,     3,     3,     3,     4,     5,
+       2,     3,     1,     2,     3,     1,     0,     3,     3,     3,
+       3,     3,     3,     4,     4,     4,     4,     4,     4,     4,
+       4,     4,     4,     4,     4,     5,     5,     5,     5,     5,
+       5,     2,     2,     1,     1
 };
 
 
@@ -927,7 +1045,7 @@ enum { YYENOMEM = -2 };
       }                                                           \
     else                                                          \
       {                                                           \
-        yyerror (YY_("syntax error: cannot back up")); \
+        yyerror (&yylloc, YY_("syntax error: cannot back up")); \
         YYERROR;                                                  \
       }                                                           \
   while (0)
@@ -1192,19 +1310,6 @@ yydestruct (const char *yymsg,
 }
 
 
-/* Lookahead token kind.  */
-int yychar;
-
-/* The semantic value of the lookahead symbol.  */
-YYSTYPE yylval;
-/* Location data for the lookahead symbol.  */
-YYLTYPE yylloc
-# if defined YYLTYPE_IS_TRIVIAL && YYLTYPE_IS_TRIVIAL
-  = { 1, 1, 1, 1 }
-# endif
-;
-/* Number of syntax errors so far.  */
-int yynerrs;
 
 
 
@@ -1216,6 +1321,27 @@ int yynerrs;
 int
 yyparse (void)
 {
+/* Lookahead token kind.  */
+int yychar;
+
+
+/* The semantic value of the lookahead symbol.  */
+/* Default value used for initialization, for pacifying older GCCs
+   or non-GCC compilers.  */
+YY_INITIAL_VALUE (static YYSTYPE yyval_default;)
+YYSTYPE yylval YY_INITIAL_VALUE (= yyval_default);
+
+/* Location data for the lookahead symbol.  */
+static YYLTYPE yyloc_default
+# if defined YYLTYPE_IS_TRIVIAL && YYLTYPE_IS_TRIVIAL
+  = { 1, 1, 1, 1 }
+# endif
+;
+YYLTYPE yylloc = yyloc_default;
+
+    /* Number of syntax errors so far.  */
+    int yynerrs = 0;
+
     yy_state_fast_t yystate = 0;
     /* Number of tokens to shift before error messages enabled.  */
     int yyerrstatus = 0;
@@ -1266,6 +1392,16 @@ yyparse (void)
 
   yychar = YYEMPTY; /* Cause a token to be read.  */
 
+
+/* User initialization code.  */
+#line 361 "parser.y"
+{
+	yylloc.first_line = yylloc.last_line = 1;
+	yylloc.first_column = yylloc.last_column = 0;
+}
+
+#line 1404 "parser.tab.c"
+
   yylsp[0] = yylloc;
   goto yysetstate;
 
@@ -1383,7 +1519,7 @@ yybackup:
   if (yychar == YYEMPTY)
     {
       YYDPRINTF ((stderr, "Reading a token\n"));
-      yychar = yylex ();
+      yychar = yylex (&yylval, &yylloc);
     }
 
   if (yychar <= YYEOF)
@@ -1474,446 +1610,478 @@ yyreduce:
   YY_REDUCE_PRINT (yyn);
   switch (yyn)
     {
-  case 2: /* command_tree: command END_OF_LINE  */
-#line 261 "parser.y"
-                              {
-		command_root = (yyvsp[-1].command_un);
+  case 2: /* command_tree: list END_OF_LINE  */
+#line 392 "parser.y"
+                           {
+		currentCtx->commandRoot = (yyvsp[-1].command_un);
 		YYACCEPT;
 	}
-#line 1484 "parser.tab.c"
+#line 1620 "parser.tab.c"
     break;
 
-  case 3: /* command_tree: command END_OF_FILE  */
-#line 266 "parser.y"
-                              {
-		command_root = (yyvsp[-1].command_un);
+  case 3: /* command_tree: list END_OF_FILE  */
+#line 397 "parser.y"
+                           {
+		currentCtx->commandRoot = (yyvsp[-1].command_un);
 		YYACCEPT;
 	}
-#line 1493 "parser.tab.c"
+#line 1629 "parser.tab.c"
     break;
 
   case 4: /* command_tree: END_OF_LINE  */
-#line 271 "parser.y"
+#line 402 "parser.y"
                       {
-		command_root = NULL;
+		currentCtx->commandRoot = NULL;
 		YYACCEPT;
 	}
-#line 1502 "parser.tab.c"
+#line 1638 "parser.tab.c"
     break;
 
   case 5: /* command_tree: END_OF_FILE  */
-#line 276 "parser.y"
+#line 407 "parser.y"
                       {
-		command_root = NULL;
+		currentCtx->commandRoot = NULL;
 		YYACCEPT;
 	}
-#line 1511 "parser.tab.c"
+#line 1647 "parser.tab.c"
     break;
 
   case 6: /* command_tree: BLANK END_OF_LINE  */
-#line 281 "parser.y"
+#line 412 "parser.y"
                             {
-		command_root = NULL;
+		currentCtx->commandRoot = NULL;
 		YYACCEPT;
 	}
-#line 1520 "parser.tab.c"
+#line 1656 "parser.tab.c"
     break;
 
   case 7: /* command_tree: BLANK END_OF_FILE  */
-#line 286 "parser.y"
+#line 417 "parser.y"
                             {
-		command_root = NULL;
+		currentCtx->commandRoot = NULL;
 		YYACCEPT;
 	}
-#line 1529 "parser.tab.c"
+#line 1665 "parser.tab.c"
     break;
 
-  case 8: /* command: simple_command  */
-#line 295 "parser.y"
-                         {
-		(yyval.command_un) = new_command((yyvsp[0].simple_command_un));
+  case 8: /* list: job  */
+#line 426 "parser.y"
+              {
+		(yyval.command_un) = (yyvsp[0].command_un);
 	}
-#line 1537 "parser.tab.c"
+#line 1673 "parser.tab.c"
     break;
 
-  case 9: /* command: command SEQUENTIAL command  */
-#line 299 "parser.y"
-                                     {
+  case 9: /* list: list SEQUENTIAL job  */
+#line 430 "parser.y"
+                              {
 		(yyval.command_un) = bind_commands((yyvsp[-2].command_un), (yyvsp[0].command_un), OP_SEQUENTIAL);
 	}
-#line 1545 "parser.tab.c"
+#line 1681 "parser.tab.c"
+    break;
+
+  case 10: /* job: command  */
+#line 439 "parser.y"
+                  {
+		(yyval.command_un) = (yyvsp[0].command_un);
+	}
+#line 1689 "parser.tab.c"
+    break;
+
+  case 11: /* job: command PARALLEL  */
+#line 443 "parser.y"
+                           {
+		(yyval.command_un) = background_command((yyvsp[-1].command_un));
+	}
+#line 1697 "parser.tab.c"
+    break;
+
+  case 12: /* job: command PARALLEL BLANK  */
+#line 447 "parser.y"
+                                 {
+		(yyval.command_un) = background_command((yyvsp[-2].command_un));
+	}
+#line 1705 "parser.tab.c"
+    break;
+
+  case 13: /* command: simple_command  */
+#line 455 "parser.y"
+                         {
+		(yyval.command_un) = new_command((yyvsp[0].simple_command_un));
+	}
+#line 1713 "parser.tab.c"
     break;
 
-  case 10: /* command: command PARALLEL command  */
-#line 303 "parser.y"
+  case 14: /* command: command PARALLEL command  */
+#line 459 "parser.y"
                                    {
 		(yyval.command_un) = bind_commands((yyvsp[-2].command_un), (yyvsp[0].command_un), OP_PARALLEL);
 	}
-#line 1553 "parser.tab.c"
+#line 1721 "parser.tab.c"
     break;
 
-  case 11: /* command: command CONDITIONAL_ZERO command  */
-#line 307 "parser.y"
+  case 15: /* command: command CONDITIONAL_ZERO command  */
+#line 463 "parser.y"
                                            {
 		(yyval.command_un) = bind_commands((yyvsp[-2].command_un), (yyvsp[0].command_un), OP_CONDITIONAL_ZERO);
 	}
-#line 1561 "parser.tab.c"
+#line 1729 "parser.tab.c"
     break;
 
-  case 12: /* command: command CONDITIONAL_NZERO command  */
-#line 311 "parser.y"
+  case 16: /* command: command CONDITIONAL_NZERO command  */
+#line 467 "parser.y"
                                             {
 		(yyval.command_un) = bind_commands((yyvsp[-2].command_un), (yyvsp[0].command_un), OP_CONDITIONAL_NZERO);
 	}
-#line 1569 "parser.tab.c"
+#line 1737 "parser.tab.c"
     break;
 
-  case 13: /* command: command PIPE command  */
-#line 315 "parser.y"
+  case 17: /* command: command PIPE command  */
+#line 471 "parser.y"
                                {
 		(yyval.command_un) = bind_commands((yyvsp[-2].command_un), (yyvsp[0].command_un), OP_PIPE);
 	}
-#line 1577 "parser.tab.c"
+#line 1745 "parser.tab.c"
     break;
 
-  case 14: /* simple_command: exe_name BLANK params redirect  */
-#line 323 "parser.y"
+  case 18: /* simple_command: exe_name BLANK params redirect  */
+#line 479 "parser.y"
                                          {
 		(yyval.simple_command_un) = bind_parts((yyvsp[-3].exe_un), (yyvsp[-1].params_un), (yyvsp[0].redirect_un));
 	}
-#line 1585 "parser.tab.c"
+#line 1753 "parser.tab.c"
     break;
 
-  case 15: /* simple_command: exe_name BLANK params BLANK redirect  */
-#line 327 "parser.y"
+  case 19: /* simple_command: exe_name BLANK params BLANK redirect  */
+#line 483 "parser.y"
                                                {
 		(yyval.simple_command_un) = bind_parts((yyvsp[-4].exe_un), (yyvsp[-2].params_un), (yyvsp[0].redirect_un));
 	}
-#line 1593 "parser.tab.c"
+#line 1761 "parser.tab.c"
     break;
 
-  case 16: /* simple_command: exe_name redirect  */
-#line 331 "parser.y"
+  case 20: /* simple_command: exe_name redirect  */
+#line 487 "parser.y"
                             {
 		(yyval.simple_command_un) = bind_parts((yyvsp[-1].exe_un), NULL, (yyvsp[0].redirect_un));
 	}
-#line 1601 "parser.tab.c"
+#line 1769 "parser.tab.c"
     break;
 
-  case 17: /* simple_command: exe_name BLANK redirect  */
-#line 335 "parser.y"
+  case 21: /* simple_command: exe_name BLANK redirect  */
+#line 491 "parser.y"
                                   {
 		(yyval.simple_command_un) = bind_parts((yyvsp[-2].exe_un), NULL, (yyvsp[0].redirect_un));
 	}
-#line 1609 "parser.tab.c"
+#line 1777 "parser.tab.c"
     break;
 
-  case 18: /* exe_name: word  */
-#line 343 "parser.y"
+  case 22: /* exe_name: word  */
+#line 499 "parser.y"
                {
 		(yyval.exe_un) = (yyvsp[0].word_un);
 	}
-#line 1617 "parser.tab.c"
+#line 1785 "parser.tab.c"
     break;
 
-  case 19: /* exe_name: BLANK word  */
-#line 347 "parser.y"
+  case 23: /* exe_name: BLANK word  */
+#line 503 "parser.y"
                      {
 		(yyval.exe_un) = (yyvsp[0].word_un);
 	}
-#line 1625 "parser.tab.c"
+#line 1793 "parser.tab.c"
     break;
 
-  case 20: /* params: params BLANK word  */
-#line 355 "parser.y"
+  case 24: /* params: params BLANK word  */
+#line 511 "parser.y"
                             {
 		(yyval.params_un) = add_word_to_list((yyvsp[0].word_un), (yyvsp[-2].params_un));
 		assert((yyval.params_un) == (yyvsp[-2].params_un));
 	}
-#line 1634 "parser.tab.c"
+#line 1802 "parser.tab.c"
     break;
 
-  case 21: /* params: word  */
-#line 360 "parser.y"
+  case 25: /* params: word  */
+#line 516 "parser.y"
                {
 		(yyval.params_un) = (yyvsp[0].word_un);
 	}
-#line 1642 "parser.tab.c"
+#line 1810 "parser.tab.c"
     break;
 
-  case 22: /* redirect: %empty  */
-#line 367 "parser.y"
+  case 26: /* redirect: %empty  */
+#line 523 "parser.y"
           { /* empty */
 		(yyval.redirect_un).red_o = NULL;
 		(yyval.redirect_un).red_i = NULL;
 		(yyval.redirect_un).red_e = NULL;
 		(yyval.redirect_un).red_flags = IO_REGULAR;
 	}
-#line 1653 "parser.tab.c"
+#line 1821 "parser.tab.c"
     break;
 
-  case 23: /* redirect: redirect REDIRECT_OE word  */
-#line 374 "parser.y"
+  case 27: /* redirect: redirect REDIRECT_OE word  */
+#line 530 "parser.y"
                                     {
 		(yyvsp[-2].redirect_un).red_o = add_word_to_list((yyvsp[0].word_un), (yyvsp[-2].redirect_un).red_o);
-		(yyvsp[-2].redirect_un).red_e = add_word_to_list((yyvsp[0].word_un), (yyvsp[-2].redirect_un).red_e);
+		(yyvsp[-2].redirect_un).red_e = add_word_to_list(copy_word((yyvsp[0].word_un)), (yyvsp[-2].redirect_un).red_e);
 		(yyval.redirect_un) = (yyvsp[-2].redirect_un);
 	}
-#line 1663 "parser.tab.c"
+#line 1831 "parser.tab.c"
     break;
 
-  case 24: /* redirect: redirect REDIRECT_E word  */
-#line 380 "parser.y"
+  case 28: /* redirect: redirect REDIRECT_E word  */
+#line 536 "parser.y"
                                    {
 		(yyvsp[-2].redirect_un).red_e = add_word_to_list((yyvsp[0].word_un), (yyvsp[-2].redirect_un).red_e);
 		(yyval.redirect_un) = (yyvsp[-2].redirect_un);
 	}
-#line 1672 "parser.tab.c"
+#line 1840 "parser.tab.c"
     break;
 
-  case 25: /* redirect: redirect REDIRECT_O word  */
-#line 385 "parser.y"
+  case 29: /* redirect: redirect REDIRECT_O word  */
+#line 541 "parser.y"
                                    {
 		(yyvsp[-2].redirect_un).red_o = add_word_to_list((yyvsp[0].word_un), (yyvsp[-2].redirect_un).red_o);
 		(yyval.redirect_un) = (yyvsp[-2].redirect_un);
 	}
-#line 1681 "parser.tab.c"
+#line 1849 "parser.tab.c"
     break;
 
-  case 26: /* redirect: redirect REDIRECT_APPEND_E word  */
-#line 390 "parser.y"
+  case 30: /* redirect: redirect REDIRECT_APPEND_E word  */
+#line 546 "parser.y"
                                           {
 		(yyvsp[-2].redirect_un).red_e = add_word_to_list((yyvsp[0].word_un), (yyvsp[-2].redirect_un).red_e);
 		(yyvsp[-2].redirect_un).red_flags |= IO_ERR_APPEND;
 		(yyval.redirect_un) = (yyvsp[-2].redirect_un);
 	}
-#line 1691 "parser.tab.c"
+#line 1859 "parser.tab.c"
     break;
 
-  case 27: /* redirect: redirect REDIRECT_APPEND_O word  */
-#line 396 "parser.y"
+  case 31: /* redirect: redirect REDIRECT_APPEND_O word  */
+#line 552 "parser.y"
                                           {
 		(yyvsp[-2].redirect_un).red_o = add_word_to_list((yyvsp[0].word_un), (yyvsp[-2].redirect_un).red_o);
 		(yyvsp[-2].redirect_un).red_flags |= IO_OUT_APPEND;
 		(yyval.redirect_un) = (yyvsp[-2].redirect_un);
 	}
-#line 1701 "parser.tab.c"
+#line 1869 "parser.tab.c"
     break;
 
-  case 28: /* redirect: redirect INDIRECT word  */
-#line 402 "parser.y"
+  case 32: /* redirect: redirect INDIRECT word  */
+#line 558 "parser.y"
                                  {
 		(yyvsp[-2].redirect_un).red_i = add_word_to_list((yyvsp[0].word_un), (yyvsp[-2].redirect_un).red_i);
 		(yyval.redirect_un) = (yyvsp[-2].redirect_un);
 	}
-#line 1710 "parser.tab.c"
+#line 1878 "parser.tab.c"
     break;
 
-  case 29: /* redirect: redirect REDIRECT_OE word BLANK  */
-#line 407 "parser.y"
+  case 33: /* redirect: redirect REDIRECT_OE word BLANK  */
+#line 563 "parser.y"
                                           {
 		(yyvsp[-3].redirect_un).red_o = add_word_to_list((yyvsp[-1].word_un), (yyvsp[-3].redirect_un).red_o);
-		(yyvsp[-3].redirect_un).red_e = add_word_to_list((yyvsp[-1].word_un), (yyvsp[-3].redirect_un).red_e);
+		(yyvsp[-3].redirect_un).red_e = add_word_to_list(copy_word((yyvsp[-1].word_un)), (yyvsp[-3].redirect_un).red_e);
 		(yyval.redirect_un) = (yyvsp[-3].redirect_un);
 	}
-#line 1720 "parser.tab.c"
+#line 1888 "parser.tab.c"
     break;
 
-  case 30: /* redirect: redirect REDIRECT_E word BLANK  */
-#line 413 "parser.y"
+  case 34: /* redirect: redirect REDIRECT_E word BLANK  */
+#line 569 "parser.y"
                                          {
 		(yyvsp[-3].redirect_un).red_e = add_word_to_list((yyvsp[-1].word_un), (yyvsp[-3].redirect_un).red_e);
 		(yyval.redirect_un) = (yyvsp[-3].redirect_un);
 	}
-#line 1729 "parser.tab.c"
+#line 1897 "parser.tab.c"
     break;
 
-  case 31: /* redirect: redirect REDIRECT_O word BLANK  */
-#line 418 "parser.y"
+  case 35: /* redirect: redirect REDIRECT_O word BLANK  */
+#line 574 "parser.y"
                                          {
 		(yyvsp[-3].redirect_un).red_o = add_word_to_list((yyvsp[-1].word_un), (yyvsp[-3].redirect_un).red_o);
 		(yyval.redirect_un) = (yyvsp[-3].redirect_un);
 	}
-#line 1738 "parser.tab.c"
+#line 1906 "parser.tab.c"
     break;
 
-  case 32: /* redirect: redirect REDIRECT_APPEND_E word BLANK  */
-#line 423 "parser.y"
+  case 36: /* redirect: redirect REDIRECT_APPEND_E word BLANK  */
+#line 579 "parser.y"
                                                 {
 		(yyvsp[-3].redirect_un).red_e = add_word_to_list((yyvsp[-1].word_un), (yyvsp[-3].redirect_un).red_e);
 		(yyvsp[-3].redirect_un).red_flags |= IO_ERR_APPEND;
 		(yyval.redirect_un) = (yyvsp[-3].redirect_un);
 	}
-#line 1748 "parser.tab.c"
+#line 1916 "parser.tab.c"
     break;
 
-  case 33: /* redirect: redirect REDIRECT_APPEND_O word BLANK  */
-#line 429 "parser.y"
+  case 37: /* redirect: redirect REDIRECT_APPEND_O word BLANK  */
+#line 585 "parser.y"
                                                 {
 		(yyvsp[-3].redirect_un).red_o = add_word_to_list((yyvsp[-1].word_un), (yyvsp[-3].redirect_un).red_o);
 		(yyvsp[-3].redirect_un).red_flags |= IO_OUT_APPEND;
 		(yyval.redirect_un) = (yyvsp[-3].redirect_un);
 	}
-#line 1758 "parser.tab.c"
+#line 1926 "parser.tab.c"
     break;
 
-  case 34: /* redirect: redirect INDIRECT word BLANK  */
-#line 435 "parser.y"
+  case 38: /* redirect: redirect INDIRECT word BLANK  */
+#line 591 "parser.y"
                                        {
 		(yyvsp[-3].redirect_un).red_i = add_word_to_list((yyvsp[-1].word_un), (yyvsp[-3].redirect_un).red_i);
 		(yyval.redirect_un) = (yyvsp[-3].redirect_un);
 	}
-#line 1767 "parser.tab.c"
+#line 1935 "parser.tab.c"
     break;
 
-  case 35: /* redirect: redirect REDIRECT_OE BLANK word  */
-#line 440 "parser.y"
+  case 39: /* redirect: redirect REDIRECT_OE BLANK word  */
+#line 596 "parser.y"
                                           {
 		(yyvsp[-3].redirect_un).red_o = add_word_to_list((yyvsp[0].word_un), (yyvsp[-3].redirect_un).red_o);
-		(yyvsp[-3].redirect_un).red_e = add_word_to_list((yyvsp[0].word_un), (yyvsp[-3].redirect_un).red_e);
+		(yyvsp[-3].redirect_un).red_e = add_word_to_list(copy_word((yyvsp[0].word_un)), (yyvsp[-3].redirect_un).red_e);
 		(yyval.redirect_un) = (yyvsp[-3].redirect_un);
 	}
-#line 1777 "parser.tab.c"
+#line 1945 "parser.tab.c"
     break;
 
-  case 36: /* redirect: redirect REDIRECT_E BLANK word  */
-#line 446 "parser.y"
+  case 40: /* redirect: redirect REDIRECT_E BLANK word  */
+#line 602 "parser.y"
                                          {
 		(yyvsp[-3].redirect_un).red_e = add_word_to_list((yyvsp[0].word_un), (yyvsp[-3].redirect_un).red_e);
 		(yyval.redirect_un) = (yyvsp[-3].redirect_un);
 	}
-#line 1786 "parser.tab.c"
+#line 1954 "parser.tab.c"
     break;
 
-  case 37: /* redirect: redirect REDIRECT_O BLANK word  */
-#line 451 "parser.y"
+  case 41: /* redirect: redirect REDIRECT_O BLANK word  */
+#line 607 "parser.y"
                                          {
 		(yyvsp[-3].redirect_un).red_o = add_word_to_list((yyvsp[0].word_un), (yyvsp[-3].redirect_un).red_o);
 		(yyval.redirect_un) = (yyvsp[-3].redirect_un);
 	}
-#line 1795 "parser.tab.c"
+#line 1963 "parser.tab.c"
     break;
 
-  case 38: /* redirect: redirect REDIRECT_APPEND_E BLANK word  */
-#line 456 "parser.y"
+  case 42: /* redirect: redirect REDIRECT_APPEND_E BLANK word  */
+#line 612 "parser.y"
                                                 {
 		(yyvsp[-3].redirect_un).red_e = add_word_to_list((yyvsp[0].word_un), (yyvsp[-3].redirect_un).red_e);
 		(yyvsp[-3].redirect_un).red_flags |= IO_ERR_APPEND;
 		(yyval.redirect_un) = (yyvsp[-3].redirect_un);
 	}
-#line 1805 "parser.tab.c"
+#line 1973 "parser.tab.c"
     break;
 
-  case 39: /* redirect: redirect REDIRECT_APPEND_O BLANK word  */
-#line 462 "parser.y"
+  case 43: /* redirect: redirect REDIRECT_APPEND_O BLANK word  */
+#line 618 "parser.y"
                                                 {
 		(yyvsp[-3].redirect_un).red_o = add_word_to_list((yyvsp[0].word_un), (yyvsp[-3].redirect_un).red_o);
 		(yyvsp[-3].redirect_un).red_flags |= IO_OUT_APPEND;
 		(yyval.redirect_un) = (yyvsp[-3].redirect_un);
 	}
-#line 1815 "parser.tab.c"
+#line 1983 "parser.tab.c"
     break;
 
-  case 40: /* redirect: redirect INDIRECT BLANK word  */
-#line 468 "parser.y"
+  case 44: /* redirect: redirect INDIRECT BLANK word  */
+#line 624 "parser.y"
                                        {
 		(yyvsp[-3].redirect_un).red_i = add_word_to_list((yyvsp[0].word_un), (yyvsp[-3].redirect_un).red_i);
 		(yyval.redirect_un) = (yyvsp[-3].redirect_un);
 	}
-#line 1824 "parser.tab.c"
+#line 1992 "parser.tab.c"
     break;
 
-  case 41: /* redirect: redirect REDIRECT_OE BLANK word BLANK  */
-#line 472 "parser.y"
+  case 45: /* redirect: redirect REDIRECT_OE BLANK word BLANK  */
+#line 628 "parser.y"
                                                 {
 		(yyvsp[-4].redirect_un).red_o = add_word_to_list((yyvsp[-1].word_un), (yyvsp[-4].redirect_un).red_o);
-		(yyvsp[-4].redirect_un).red_e = add_word_to_list((yyvsp[-1].word_un), (yyvsp[-4].redirect_un).red_e);
+		(yyvsp[-4].redirect_un).red_e = add_word_to_list(copy_word((yyvsp[-1].word_un)), (yyvsp[-4].redirect_un).red_e);
 		(yyval.redirect_un) = (yyvsp[-4].redirect_un);
 	}
-#line 1834 "parser.tab.c"
+#line 2002 "parser.tab.c"
     break;
 
-  case 42: /* redirect: redirect REDIRECT_E BLANK word BLANK  */
-#line 478 "parser.y"
+  case 46: /* redirect: redirect REDIRECT_E BLANK word BLANK  */
+#line 634 "parser.y"
                                                {
 		(yyvsp[-4].redirect_un).red_e = add_word_to_list((yyvsp[-1].word_un), (yyvsp[-4].redirect_un).red_e);
 		(yyval.redirect_un) = (yyvsp[-4].redirect_un);
 	}
-#line 1843 "parser.tab.c"
+#line 2011 "parser.tab.c"
     break;
 
-  case 43: /* redirect: redirect REDIRECT_O BLANK word BLANK  */
-#line 483 "parser.y"
+  case 47: /* redirect: redirect REDIRECT_O BLANK word BLANK  */
+#line 639 "parser.y"
                                                {
 		(yyvsp[-4].redirect_un).red_o = add_word_to_list((yyvsp[-1].word_un), (yyvsp[-4].redirect_un).red_o);
 		(yyval.redirect_un) = (yyvsp[-4].redirect_un);
 	}
-#line 1852 "parser.tab.c"
+#line 2020 "parser.tab.c"
     break;
 
-  case 44: /* redirect: redirect REDIRECT_APPEND_O BLANK word BLANK  */
-#line 488 "parser.y"
+  case 48: /* redirect: redirect REDIRECT_APPEND_O BLANK word BLANK  */
+#line 644 "parser.y"
                                                       {
 		(yyvsp[-4].redirect_un).red_o = add_word_to_list((yyvsp[-1].word_un), (yyvsp[-4].redirect_un).red_o);
 		(yyvsp[-4].redirect_un).red_flags |= IO_OUT_APPEND;
 		(yyval.redirect_un) = (yyvsp[-4].redirect_un);
 	}
-#line 1862 "parser.tab.c"
+#line 2030 "parser.tab.c"
     break;
 
-  case 45: /* redirect: redirect REDIRECT_APPEND_E BLANK word BLANK  */
-#line 494 "parser.y"
+  case 49: /* redirect: redirect REDIRECT_APPEND_E BLANK word BLANK  */
+#line 650 "parser.y"
                                                       {
 		(yyvsp[-4].redirect_un).red_e = add_word_to_list((yyvsp[-1].word_un), (yyvsp[-4].redirect_un).red_e);
 		(yyvsp[-4].redirect_un).red_flags |= IO_ERR_APPEND;
 		(yyval.redirect_un) = (yyvsp[-4].redirect_un);
 	}
-#line 1872 "parser.tab.c"
+#line 2040 "parser.tab.c"
     break;
 
-  case 46: /* redirect: redirect INDIRECT BLANK word BLANK  */
-#line 500 "parser.y"
+  case 50: /* redirect: redirect INDIRECT BLANK word BLANK  */
+#line 656 "parser.y"
                                              {
 		(yyvsp[-4].redirect_un).red_i = add_word_to_list((yyvsp[-1].word_un), (yyvsp[-4].redirect_un).red_i);
 		(yyval.redirect_un) = (yyvsp[-4].redirect_un);
 	}
-#line 1881 "parser.tab.c"
+#line 2049 "parser.tab.c"
     break;
 
-  case 47: /* word: word WORD  */
-#line 509 "parser.y"
+  case 51: /* word: word WORD  */
+#line 665 "parser.y"
                     {
 		(yyval.word_un) = add_part_to_word(new_word((yyvsp[0].string_un), false), (yyvsp[-1].word_un));
 	}
-#line 1889 "parser.tab.c"
+#line 2057 "parser.tab.c"
     break;
 
-  case 48: /* word: word ENV_VAR  */
-#line 513 "parser.y"
+  case 52: /* word: word ENV_VAR  */
+#line 669 "parser.y"
                        {
 		(yyval.word_un) = add_part_to_word(new_word((yyvsp[0].string_un), true), (yyvsp[-1].word_un));
 	}
-#line 1897 "parser.tab.c"
+#line 2065 "parser.tab.c"
     break;
 
-  case 49: /* word: WORD  */
-#line 517 "parser.y"
+  case 53: /* word: WORD  */
+#line 673 "parser.y"
                {
 		(yyval.word_un) = new_word((yyvsp[0].string_un), false);
 	}
-#line 1905 "parser.tab.c"
+#line 2073 "parser.tab.c"
     break;
 
-  case 50: /* word: ENV_VAR  */
-#line 521 "parser.y"
+  case 54: /* word: ENV_VAR  */
+#line 677 "parser.y"
                   {
 		(yyval.word_un) = new_word((yyvsp[0].string_un), true);
 	}
-#line 1913 "parser.tab.c"
+#line 2081 "parser.tab.c"
     break;
 
 
-#line 1917 "parser.tab.c"
+#line 2085 "parser.tab.c"
 
       default: break;
     }
@@ -1961,7 +2129,7 @@ yyerrlab:
   if (!yyerrstatus)
     {
       ++yynerrs;
-      yyerror (YY_("syntax error"));
+      yyerror (&yylloc, YY_("syntax error"));
     }
 
   yyerror_range[1] = yylloc;
@@ -2076,7 +2244,7 @@ yyabortlab:
 | yyexhaustedlab -- YYNOMEM (memory exhaustion) comes here.  |
 `-----------------------------------------------------------*/
 yyexhaustedlab:
-  yyerror (YY_("memory exhausted"));
+  yyerror (&yylloc, YY_("memory exhausted"));
   yyresult = 2;
   goto yyreturnlab;
 
@@ -2111,12 +2279,84 @@ yyreturnlab:
   return yyresult;
 }
 
-#line 526 "parser.y"
+#line 682 "parser.y"
 
 
 
+/* the tree of the last line, if the caller did not free it */
+static void freeTree(parser_ctx_t * ctx)
+{
+	if (ctx->needsFree) {
+		arenaReset(ctx);
+		ctx->needsFree = false;
+	}
+}
+
+
+parser_ctx_t * parser_ctx_new()
+{
+	return (parser_ctx_t *)calloc(1, sizeof(parser_ctx_t));
+}
+
+
+static void releaseArena(parser_ctx_t * ctx)
+{
+	arena_block_t * b;
+
+	free_parse_memory_r(ctx);
+
+	while (ctx->arenaFirst != NULL) {
+		b = ctx->arenaFirst;
+		ctx->arenaFirst = b->next;
+		free(b);
+	}
+
+	ctx->arenaCurrent = NULL;
+	ctx->arenaUsed = 0;
+	ctx->arenaSize = 0;
+}
+
+
+void parser_ctx_free(parser_ctx_t * ctx)
+{
+	if (ctx == NULL) {
+		return;
+	}
+
+	releaseArena(ctx);
+	free(ctx);
+}
+
+
 bool parse_line(const char * line, command_t ** root)
 {
+	return parse_line_r(&defaultCtx, line, root);
+}
+
+
+bool parse_line_n(const char * line, size_t length, command_t ** root)
+{
+	return parse_line_n_r(&defaultCtx, line, length, root);
+}
+
+
+bool parse_line_r(parser_ctx_t * ctx, const char * line, command_t ** root)
+{
+	if (line == NULL) {
+		/* see the comment in parser.h */
+		assert(false);
+		return false;
+	}
+
+	return parse_line_n_r(ctx, line, strlen(line), root);
+}
+
+
+bool parse_line_n_r(parser_ctx_t * ctx, const char * line, size_t length,
+	command_t ** root)
+{
+	int rc;
+
 	if (*root != NULL) {
 		/* see the comment in parser.h */
 		assert(false);
@@ -2129,48 +2369,132 @@ bool parse_line(const char * line, command_t ** root)
 		return false;
 	}
 
-	free_parse_memory();
-	globalParseAnotherString(line);
-	needsFree = true;
-	command_root = NULL;
+	freeTree(ctx);
+	currentCtx = ctx;
+	globalParseAnotherString(line, length);
+	ctx->needsFree = true;
+	ctx->commandRoot = NULL;
 
-	yylloc.first_line = yylloc.last_line = 1;
-	yylloc.first_column = yylloc.last_column = 0;
+	rc = yyparse();
 
-	if (yyparse() != 0) {
+	/*
+	 * the scanner of this thread is done with the line (the tree only
+	 * points into the arena), the context may be used by another one next
+	 */
+	globalEndParsing();
+	currentCtx = NULL;
+
+	if (rc != 0) {
 		/* yyparse failed */
 		return false;
 	}
 
-	*root = command_root;
+	*root = ctx->commandRoot;
 
 	return true;
 }
 
 
-void free_parse_memory()
+void parse_stream_fd(int fd)
 {
-	if (needsFree) {
-		globalEndParsing();
-		while (globalAllocCount != 0) {
-			globalAllocCount--;
-			assert(globalAllocMem[globalAllocCount] != NULL);
-			free(globalAllocMem[globalAllocCount]);
-			globalAllocMem[globalAllocCount] = NULL;
-		}
+	globalParseStream(fd, NULL, 0);
+}
+
+
+void parse_stream_buffer(const char * buffer, size_t length)
+{
+	globalParseStream(-1, buffer, length);
+}
+
+
+int parse_stream_line(command_t ** root)
+{
+	return parse_stream_line_r(&defaultCtx, root);
+}
 
-		if (globalAllocMem != NULL) {
-			free((void *)globalAllocMem);
-			globalAllocMem = NULL;
-		}
 
-		globalAllocSize = 0;
-		needsFree = false;
+int parse_stream_line_r(parser_ctx_t * ctx, command_t ** root)
+{
+	int rc;
+
+	if (*root != NULL) {
+		/* see the comment in parser.h */
+		assert(false);
+		return 0;
+	}
+
+	freeTree(ctx);
+	if (!globalStreamNextLine())
+		return -1;
+
+	currentCtx = ctx;
+	ctx->needsFree = true;
+	ctx->commandRoot = NULL;
+
+	rc = yyparse();
+	currentCtx = NULL;
+
+	if (rc != 0) {
+		/* yyparse failed, go on with the next line */
+		globalStreamSkipLine();
+		return 0;
 	}
+
+	*root = ctx->commandRoot;
+
+	return 1;
+}
+
+
+void parse_stream_end()
+{
+	globalEndStream();
+}
+
+
+void free_parse_memory()
+{
+	free_parse_memory_r(&defaultCtx);
+}
+
+
+void free_parse_memory_r(parser_ctx_t * ctx)
+{
+	/*
+	 * a line that was not parsed (e.g. its tree was cached by the caller)
+	 * counts as one that needed nothing, so that the arena still shrinks
+	 */
+	arenaReset(ctx);
+	ctx->needsFree = false;
+}
+
+
+void release_parse_memory()
+{
+	releaseArena(&defaultCtx);
+	globalReleaseParsing();
+}
+
+
+void release_parse_thread()
+{
+	globalReleaseParsing();
+}
+
+
+size_t parse_malloc_count()
+{
+	return defaultCtx.arenaMallocCount;
+}
+
+
+size_t parse_memory_size()
+{
+	return defaultCtx.arenaSize + globalScannerSize();
 }
 
 
-void yyerror(const char* str)
+void yyerror(YYLTYPE * llocp, const char * str)
 {
-	parse_error(str, yylloc.first_column);
+	parse_error(str, llocp->first_column);
 }
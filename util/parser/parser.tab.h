@@ -82,7 +82,7 @@ extern int yydebug;
 #if ! defined YYSTYPE && ! defined YYSTYPE_IS_DECLARED
 union YYSTYPE
 {
-#line 225 "parser.y"
+#line 342 "parser.y"
 
 	command_t * command_un;
 	const char * string_un;
@@ -115,10 +115,16 @@ struct YYLTYPE
 #endif
 
 
-extern YYSTYPE yylval;
-extern YYLTYPE yylloc;
+
 
 int yyparse (void);
 
+/* "%code provides" blocks.  */
+#line 356 "parser.y"
+
+int yylex(YYSTYPE * lvalp, YYLTYPE * llocp);
+void yyerror(YYLTYPE * llocp, const char * str);
+
+#line 129 "parser.tab.h"
 
 #endif /* !YY_YY_PARSER_TAB_H_INCLUDED  */
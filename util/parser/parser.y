@@ -1,5 +1,6 @@
 %defines
 %locations
+%define api.pure full
 %{
 
 
@@ -33,65 +34,154 @@ using namespace std;
 #include "parser.h"
 
 
-static GenericPointer * globalAllocMem = NULL;
-static size_t globalAllocCount = 0;
-static size_t globalAllocSize  = 0;
-static bool needsFree = false;
-static command_t * command_root = NULL;
+/*
+ * All the memory of the parse trees of a context (nodes and token strings) is
+ * taken from an arena made of a list of blocks. free_parse_memory_r() only
+ * rewinds the arena, the blocks are kept and reused for the next lines, as
+ * long as one of the last ARENA_WINDOW lines needed them (so that the memory
+ * of a single huge line does not stay there for the whole session).
+ */
+#define ARENA_BLOCK_SIZE	(64 * 1024)
+#define ARENA_ALIGNMENT		16
+#define ARENA_WINDOW		16
+
+typedef struct arena_block {
+	struct arena_block * next;
+	size_t size;
+} arena_block_t;
+
+struct parser_ctx {
+	arena_block_t * arenaFirst;
+	arena_block_t * arenaCurrent;
+	size_t arenaUsed;
+	size_t arenaMallocCount;
+	size_t arenaSize;
+	/* how much of the arena the last lines used */
+	size_t recentUse[ARENA_WINDOW];
+	size_t nrLines;
+	bool needsFree;
+	command_t * commandRoot;
+};
+
+/* the context of parse_line, of the streams and of free_parse_memory */
+static parser_ctx_t defaultCtx;
+
+/* the context of the line the current thread parses */
+static PARSER_THREAD_LOCAL parser_ctx_t * currentCtx = NULL;
+
+
+/* the usable memory of a block starts right after its (aligned) header */
+#define ARENA_HEADER_SIZE \
+	((sizeof(arena_block_t) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+#define ARENA_BLOCK_DATA(b)	((char *)(b) + ARENA_HEADER_SIZE)
+
+
+static arena_block_t * newArenaBlock(size_t minSize)
+{
+	size_t size = (minSize > ARENA_BLOCK_SIZE) ? minSize : ARENA_BLOCK_SIZE;
+	arena_block_t * b = (arena_block_t *)malloc(ARENA_HEADER_SIZE + size);
 
+	if (b == NULL) {
+		fprintf(stderr, "malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
 
-void yyerror(const char* str);
+	currentCtx->arenaMallocCount++;
+	currentCtx->arenaSize += size;
+	b->next = NULL;
+	b->size = size;
 
+	return b;
+}
 
-static void ensureSize(size_t newSize)
-{
-	GenericPointer * newPtr;
-	assert(newSize > 0);
 
-	if (globalAllocSize == 0) {
-		assert(globalAllocMem == NULL);
-		globalAllocSize = newSize;
-		globalAllocMem = (GenericPointer *)malloc(sizeof(GenericPointer) * globalAllocSize);
-		if (globalAllocMem == NULL) {
-			fprintf(stderr, "malloc() failed\n");
-			exit(EXIT_FAILURE);
-		}
+void * parserAlloc(size_t size)
+{
+	parser_ctx_t * ctx = currentCtx;
+	arena_block_t * b;
 
-		return;
+	size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+	if (size == 0) {
+		size = ARENA_ALIGNMENT;
 	}
 
-	assert(globalAllocMem != NULL);
-	if (globalAllocSize >= newSize) {
-		return;
+	if (ctx->arenaCurrent == NULL) {
+		assert(ctx->arenaFirst == NULL);
+		ctx->arenaFirst = ctx->arenaCurrent = newArenaBlock(size);
+		ctx->arenaUsed = 0;
 	}
 
-	globalAllocSize += newSize;
-	newPtr = (GenericPointer *)realloc((void *)globalAllocMem, sizeof(GenericPointer) * globalAllocSize);
-	if (newPtr == NULL) {
-		fprintf(stderr, "realloc() failed\n");
-		exit(EXIT_FAILURE);
+	if (ctx->arenaCurrent->size - ctx->arenaUsed < size) {
+		/* reuse the next block if it is big enough, else insert a new one */
+		b = ctx->arenaCurrent->next;
+		if ((b == NULL) || (b->size < size)) {
+			b = newArenaBlock(size);
+			b->next = ctx->arenaCurrent->next;
+			ctx->arenaCurrent->next = b;
+		}
+
+		ctx->arenaCurrent = b;
+		ctx->arenaUsed = 0;
 	}
 
-	globalAllocMem = newPtr;
+	ctx->arenaUsed += size;
+	return ARENA_BLOCK_DATA(ctx->arenaCurrent) + ctx->arenaUsed - size;
 }
 
 
-void pointerToMallocMemory(const void * ptr)
+char * parserStrdup(const char * str)
 {
-	if (ptr == NULL) {
-		fprintf(stderr, "malloc() failed\n");
-		exit(EXIT_FAILURE);
+	size_t length = strlen(str) + 1;
+	char * copy = (char *)parserAlloc(length);
+
+	memcpy(copy, str, length);
+	return copy;
+}
+
+
+static void arenaReset(parser_ctx_t * ctx)
+{
+	arena_block_t * b;
+	size_t used = ctx->arenaUsed;
+	size_t keep = 0;
+	size_t kept;
+	int i;
+
+	for (b = ctx->arenaFirst; (b != NULL) && (b != ctx->arenaCurrent); b = b->next) {
+		used += b->size;
+	}
+
+	ctx->recentUse[ctx->nrLines++ % ARENA_WINDOW] = used;
+	for (i = 0; i < ARENA_WINDOW; i++) {
+		if (ctx->recentUse[i] > keep) {
+			keep = ctx->recentUse[i];
+		}
+	}
+
+	/* the first block is always kept, the ones past keep are freed */
+	b = ctx->arenaFirst;
+	if (b != NULL) {
+		for (kept = b->size; (b->next != NULL) && (kept < keep); kept += b->size) {
+			b = b->next;
+		}
+
+		while (b->next != NULL) {
+			arena_block_t * next = b->next;
+
+			b->next = next->next;
+			ctx->arenaSize -= next->size;
+			free(next);
+		}
 	}
 
-	ensureSize(globalAllocCount + 1);
-	globalAllocMem[globalAllocCount++] = (GenericPointer)ptr;
+	ctx->arenaCurrent = ctx->arenaFirst;
+	ctx->arenaUsed = 0;
 }
 
 
 static simple_command_t * bind_parts(word_t * exe_name, word_t * params, redirect_t red)
 {
-	simple_command_t * s = (simple_command_t *) malloc(sizeof(simple_command_t));
-	pointerToMallocMemory(s);
+	simple_command_t * s = (simple_command_t *) parserAlloc(sizeof(simple_command_t));
 
 	memset(s, 0, sizeof(*s));
 	assert(exe_name != NULL);
@@ -110,13 +200,7 @@ static simple_command_t * bind_parts(word_t * exe_name, word_t * params, redirec
 
 static command_t * new_command(simple_command_t * scmd)
 {
-	command_t * c = (command_t *) malloc(sizeof(command_t));
-
-	if (c == NULL) {
-		fprintf(stderr, "malloc() failed\n");
-		exit(EXIT_FAILURE);
-	}
-	pointerToMallocMemory(c);
+	command_t * c = (command_t *) parserAlloc(sizeof(command_t));
 
 	memset(c, 0, sizeof(*c));
 	c->up = c->cmd1 = c->cmd2 = NULL;
@@ -131,8 +215,7 @@ static command_t * new_command(simple_command_t * scmd)
 
 static command_t * bind_commands(command_t * cmd1, command_t * cmd2, operator_t op)
 {
-	command_t * c = (command_t *) malloc(sizeof(command_t));
-	pointerToMallocMemory(c);
+	command_t * c = (command_t *) parserAlloc(sizeof(command_t));
 
 	memset(c, 0, sizeof(*c));
 	c->up = NULL;
@@ -154,10 +237,28 @@ static command_t * bind_commands(command_t * cmd1, command_t * cmd2, operator_t
 }
 
 
+/* A trailing & binds tighter than ; (a ; b & only sends b to the background). */
+static command_t * background_command(command_t * cmd)
+{
+	command_t * c = (command_t *) parserAlloc(sizeof(command_t));
+
+	memset(c, 0, sizeof(*c));
+	c->up = NULL;
+	assert(cmd->up == NULL);
+	c->cmd1 = cmd;
+	cmd->up = c;
+	c->cmd2 = NULL;
+	c->op = OP_BACKGROUND;
+	c->scmd = NULL;
+	c->aux = NULL;
+
+	return c;
+}
+
+
 static word_t * new_word(const char * str, bool expand)
 {
-	word_t * w = (word_t *) malloc(sizeof(word_t));
-	pointerToMallocMemory(w);
+	word_t * w = (word_t *) parserAlloc(sizeof(word_t));
 
 	memset(w, 0, sizeof(*w));
 	assert(str != NULL);
@@ -195,6 +296,22 @@ static word_t * add_part_to_word(word_t * w, word_t * lst)
 }
 
 
+/*
+ the lists of words are linked through next_word, so a word that goes
+ into two of them (&>) needs a node for each one (its parts are shared)
+*/
+static word_t * copy_word(const word_t * w)
+{
+	word_t * c = (word_t *) parserAlloc(sizeof(word_t));
+
+	assert(w != NULL);
+	*c = *w;
+	c->next_word = NULL;
+
+	return c;
+}
+
+
 static word_t * add_word_to_list(word_t * w, word_t * lst)
 {
 	word_t * crt = lst;
@@ -232,6 +349,20 @@ static word_t * add_word_to_list(word_t * w, word_t * lst)
 	word_t * word_un;
 }
 
+/*
+ * The parser is pure: the value and the location of the tokens are kept by
+ * yyparse and given to yylex, instead of being globals
+ */
+%code provides {
+int yylex(YYSTYPE * lvalp, YYLTYPE * llocp);
+void yyerror(YYLTYPE * llocp, const char * str);
+}
+
+%initial-action {
+	@$.first_line = @$.last_line = 1;
+	@$.first_column = @$.last_column = 0;
+}
+
 
 %token NOT_ACCEPTED_CHAR INVALID_ENVIRONMENT_VAR UNEXPECTED_EOF CHARS_AFTER_EOL
 %token END_OF_FILE END_OF_LINE BLANK
@@ -240,12 +371,12 @@ static word_t * add_word_to_list(word_t * w, word_t * lst)
 %token <string_un> WORD
 %token <string_un> ENV_VAR
 
-%left SEQUENTIAL
+%token SEQUENTIAL
 %left PARALLEL
 %left CONDITIONAL_NZERO CONDITIONAL_ZERO
 %left PIPE
 
-%type <command_un> command
+%type <command_un> command job list
 %type <exe_un> exe_name
 %type <params_un> params
 %type <redirect_un> redirect
@@ -258,48 +389,73 @@ static word_t * add_word_to_list(word_t * w, word_t * lst)
 
 command_tree:
 
-	  command END_OF_LINE {
-		command_root = $1;
+	  list END_OF_LINE {
+		currentCtx->commandRoot = $1;
 		YYACCEPT;
 	}
 
-	| command END_OF_FILE {
-		command_root = $1;
+	| list END_OF_FILE {
+		currentCtx->commandRoot = $1;
 		YYACCEPT;
 	}
 
 	| END_OF_LINE {
-		command_root = NULL;
+		currentCtx->commandRoot = NULL;
 		YYACCEPT;
 	}
 
 	| END_OF_FILE {
-		command_root = NULL;
+		currentCtx->commandRoot = NULL;
 		YYACCEPT;
 	}
 
 	| BLANK END_OF_LINE {
-		command_root = NULL;
+		currentCtx->commandRoot = NULL;
 		YYACCEPT;
 	}
 
 	| BLANK END_OF_FILE {
-		command_root = NULL;
+		currentCtx->commandRoot = NULL;
 		YYACCEPT;
 	}
 
 	;
 
-command:
+list:
 
-	  simple_command {
-		$$ = new_command($1);
+	  job {
+		$$ = $1;
 	}
 
-	| command SEQUENTIAL command {
+	| list SEQUENTIAL job {
 		$$ = bind_commands($1, $3, OP_SEQUENTIAL);
 	}
 
+	;
+
+/* a trailing & only ends a command of the list, it is not an operand */
+job:
+
+	  command {
+		$$ = $1;
+	}
+
+	| command PARALLEL {
+		$$ = background_command($1);
+	}
+
+	| command PARALLEL BLANK {
+		$$ = background_command($1);
+	}
+
+	;
+
+command:
+
+	  simple_command {
+		$$ = new_command($1);
+	}
+
 	| command PARALLEL command {
 		$$ = bind_commands($1, $3, OP_PARALLEL);
 	}
@@ -373,7 +529,7 @@ redirect:
 
 	| redirect REDIRECT_OE word {
 		$1.red_o = add_word_to_list($3, $1.red_o);
-		$1.red_e = add_word_to_list($3, $1.red_e);
+		$1.red_e = add_word_to_list(copy_word($3), $1.red_e);
 		$$ = $1;
 	}
 
@@ -406,7 +562,7 @@ redirect:
 
 	| redirect REDIRECT_OE word BLANK {
 		$1.red_o = add_word_to_list($3, $1.red_o);
-		$1.red_e = add_word_to_list($3, $1.red_e);
+		$1.red_e = add_word_to_list(copy_word($3), $1.red_e);
 		$$ = $1;
 	}
 
@@ -439,7 +595,7 @@ redirect:
 
 	| redirect REDIRECT_OE BLANK word {
 		$1.red_o = add_word_to_list($4, $1.red_o);
-		$1.red_e = add_word_to_list($4, $1.red_e);
+		$1.red_e = add_word_to_list(copy_word($4), $1.red_e);
 		$$ = $1;
 	}
 
@@ -471,7 +627,7 @@ redirect:
 	}
 	| redirect REDIRECT_OE BLANK word BLANK {
 		$1.red_o = add_word_to_list($4, $1.red_o);
-		$1.red_e = add_word_to_list($4, $1.red_e);
+		$1.red_e = add_word_to_list(copy_word($4), $1.red_e);
 		$$ = $1;
 	}
 
@@ -526,8 +682,80 @@ word:
 %%
 
 
+/* the tree of the last line, if the caller did not free it */
+static void freeTree(parser_ctx_t * ctx)
+{
+	if (ctx->needsFree) {
+		arenaReset(ctx);
+		ctx->needsFree = false;
+	}
+}
+
+
+parser_ctx_t * parser_ctx_new()
+{
+	return (parser_ctx_t *)calloc(1, sizeof(parser_ctx_t));
+}
+
+
+static void releaseArena(parser_ctx_t * ctx)
+{
+	arena_block_t * b;
+
+	free_parse_memory_r(ctx);
+
+	while (ctx->arenaFirst != NULL) {
+		b = ctx->arenaFirst;
+		ctx->arenaFirst = b->next;
+		free(b);
+	}
+
+	ctx->arenaCurrent = NULL;
+	ctx->arenaUsed = 0;
+	ctx->arenaSize = 0;
+}
+
+
+void parser_ctx_free(parser_ctx_t * ctx)
+{
+	if (ctx == NULL) {
+		return;
+	}
+
+	releaseArena(ctx);
+	free(ctx);
+}
+
+
 bool parse_line(const char * line, command_t ** root)
 {
+	return parse_line_r(&defaultCtx, line, root);
+}
+
+
+bool parse_line_n(const char * line, size_t length, command_t ** root)
+{
+	return parse_line_n_r(&defaultCtx, line, length, root);
+}
+
+
+bool parse_line_r(parser_ctx_t * ctx, const char * line, command_t ** root)
+{
+	if (line == NULL) {
+		/* see the comment in parser.h */
+		assert(false);
+		return false;
+	}
+
+	return parse_line_n_r(ctx, line, strlen(line), root);
+}
+
+
+bool parse_line_n_r(parser_ctx_t * ctx, const char * line, size_t length,
+	command_t ** root)
+{
+	int rc;
+
 	if (*root != NULL) {
 		/* see the comment in parser.h */
 		assert(false);
@@ -540,48 +768,132 @@ bool parse_line(const char * line, command_t ** root)
 		return false;
 	}
 
-	free_parse_memory();
-	globalParseAnotherString(line);
-	needsFree = true;
-	command_root = NULL;
+	freeTree(ctx);
+	currentCtx = ctx;
+	globalParseAnotherString(line, length);
+	ctx->needsFree = true;
+	ctx->commandRoot = NULL;
 
-	yylloc.first_line = yylloc.last_line = 1;
-	yylloc.first_column = yylloc.last_column = 0;
+	rc = yyparse();
 
-	if (yyparse() != 0) {
+	/*
+	 * the scanner of this thread is done with the line (the tree only
+	 * points into the arena), the context may be used by another one next
+	 */
+	globalEndParsing();
+	currentCtx = NULL;
+
+	if (rc != 0) {
 		/* yyparse failed */
 		return false;
 	}
 
-	*root = command_root;
+	*root = ctx->commandRoot;
 
 	return true;
 }
 
 
-void free_parse_memory()
+void parse_stream_fd(int fd)
 {
-	if (needsFree) {
-		globalEndParsing();
-		while (globalAllocCount != 0) {
-			globalAllocCount--;
-			assert(globalAllocMem[globalAllocCount] != NULL);
-			free(globalAllocMem[globalAllocCount]);
-			globalAllocMem[globalAllocCount] = NULL;
-		}
+	globalParseStream(fd, NULL, 0);
+}
 
-		if (globalAllocMem != NULL) {
-			free((void *)globalAllocMem);
-			globalAllocMem = NULL;
-		}
 
-		globalAllocSize = 0;
-		needsFree = false;
+void parse_stream_buffer(const char * buffer, size_t length)
+{
+	globalParseStream(-1, buffer, length);
+}
+
+
+int parse_stream_line(command_t ** root)
+{
+	return parse_stream_line_r(&defaultCtx, root);
+}
+
+
+int parse_stream_line_r(parser_ctx_t * ctx, command_t ** root)
+{
+	int rc;
+
+	if (*root != NULL) {
+		/* see the comment in parser.h */
+		assert(false);
+		return 0;
 	}
+
+	freeTree(ctx);
+	if (!globalStreamNextLine())
+		return -1;
+
+	currentCtx = ctx;
+	ctx->needsFree = true;
+	ctx->commandRoot = NULL;
+
+	rc = yyparse();
+	currentCtx = NULL;
+
+	if (rc != 0) {
+		/* yyparse failed, go on with the next line */
+		globalStreamSkipLine();
+		return 0;
+	}
+
+	*root = ctx->commandRoot;
+
+	return 1;
+}
+
+
+void parse_stream_end()
+{
+	globalEndStream();
+}
+
+
+void free_parse_memory()
+{
+	free_parse_memory_r(&defaultCtx);
+}
+
+
+void free_parse_memory_r(parser_ctx_t * ctx)
+{
+	/*
+	 * a line that was not parsed (e.g. its tree was cached by the caller)
+	 * counts as one that needed nothing, so that the arena still shrinks
+	 */
+	arenaReset(ctx);
+	ctx->needsFree = false;
+}
+
+
+void release_parse_memory()
+{
+	releaseArena(&defaultCtx);
+	globalReleaseParsing();
+}
+
+
+void release_parse_thread()
+{
+	globalReleaseParsing();
+}
+
+
+size_t parse_malloc_count()
+{
+	return defaultCtx.arenaMallocCount;
+}
+
+
+size_t parse_memory_size()
+{
+	return defaultCtx.arenaSize + globalScannerSize();
 }
 
 
-void yyerror(const char* str)
+void yyerror(YYLTYPE * llocp, const char * str)
 {
-	parse_error(str, yylloc.first_column);
+	parse_error(str, llocp->first_column);
 }
@@ -1,6 +1,16 @@
 #line 2 "parser.yy.c"
+#line 3 "parser.l"
+/* the state of the scanner is per thread (see parser.h) */
+#ifndef PARSER_THREAD_LOCAL
+#  ifdef _MSC_VER
+#    define PARSER_THREAD_LOCAL __declspec(thread)
+#  else
+#    define PARSER_THREAD_LOCAL __thread
+#  endif
+#endif
+
 
-#line 4 "parser.yy.c"
+#line 14 "parser.yy.c"
 
 #define  YY_INT_ALIGNED short int
 
@@ -155,9 +165,9 @@ typedef struct yy_buffer_state *YY_BUFFER_STATE;
 typedef size_t yy_size_t;
 #endif
 
-extern int yyleng;
+extern PARSER_THREAD_LOCAL int yyleng;
 
-extern FILE *yyin, *yyout;
+extern PARSER_THREAD_LOCAL FILE *yyin, *yyout;
 
 #define EOB_ACT_CONTINUE_SCAN 0
 #define EOB_ACT_END_OF_FILE 1
@@ -247,9 +257,9 @@ struct yy_buffer_state
 #endif /* !YY_STRUCT_YY_BUFFER_STATE */
 
 /* Stack of input buffers. */
-static size_t yy_buffer_stack_top = 0; /**< index of top of stack. */
-static size_t yy_buffer_stack_max = 0; /**< capacity of stack. */
-static YY_BUFFER_STATE * yy_buffer_stack = NULL; /**< Stack as an array. */
+static PARSER_THREAD_LOCAL size_t yy_buffer_stack_top = 0; /**< index of top of stack. */
+static PARSER_THREAD_LOCAL size_t yy_buffer_stack_max = 0; /**< capacity of stack. */
+static PARSER_THREAD_LOCAL YY_BUFFER_STATE * yy_buffer_stack = NULL; /**< Stack as an array. */
 
 /* We provide macros for accessing buffer states in case in the
  * future we want to put the buffer states in a more general
@@ -266,19 +276,19 @@ static YY_BUFFER_STATE * yy_buffer_stack = NULL; /**< Stack as an array. */
 #define YY_CURRENT_BUFFER_LVALUE (yy_buffer_stack)[(yy_buffer_stack_top)]
 
 /* yy_hold_char holds the character lost when yytext is formed. */
-static char yy_hold_char;
-static int yy_n_chars;		/* number of characters read into yy_ch_buf */
-int yyleng;
+static PARSER_THREAD_LOCAL char yy_hold_char;
+static PARSER_THREAD_LOCAL int yy_n_chars;		/* number of characters read into yy_ch_buf */
+PARSER_THREAD_LOCAL int yyleng;
 
 /* Points to current character in buffer. */
-static char *yy_c_buf_p = NULL;
-static int yy_init = 0;		/* whether we need to initialize */
-static int yy_start = 0;	/* start state number */
+static PARSER_THREAD_LOCAL char *yy_c_buf_p = NULL;
+static PARSER_THREAD_LOCAL int yy_init = 0;		/* whether we need to initialize */
+static PARSER_THREAD_LOCAL int yy_start = 0;	/* start state number */
 
 /* Flag which is used to allow yywrap()'s to do buffer switches
  * instead of setting up a fresh yyin.  A bit of a hack ...
  */
-static int yy_did_buffer_switch_on_eof;
+static PARSER_THREAD_LOCAL int yy_did_buffer_switch_on_eof;
 
 void yyrestart ( FILE *input_file  );
 void yy_switch_to_buffer ( YY_BUFFER_STATE new_buffer  );
@@ -325,14 +335,14 @@ void yyfree ( void *  );
 /* Begin user sect3 */
 typedef flex_uint8_t YY_CHAR;
 
-FILE *yyin = NULL, *yyout = NULL;
+PARSER_THREAD_LOCAL FILE *yyin = NULL, *yyout = NULL;
 
 typedef int yy_state_type;
 
-extern int yylineno;
-int yylineno = 1;
+extern PARSER_THREAD_LOCAL int yylineno;
+PARSER_THREAD_LOCAL int yylineno = 1;
 
-extern char *yytext;
+extern PARSER_THREAD_LOCAL char *yytext;
 #ifdef yytext_ptr
 #undef yytext_ptr
 #endif
@@ -452,11 +462,11 @@ static const flex_int16_t yy_chk[87] =
        44,   44,   44,   44,   44,   44
     } ;
 
-static yy_state_type yy_last_accepting_state;
-static char *yy_last_accepting_cpos;
+static PARSER_THREAD_LOCAL yy_state_type yy_last_accepting_state;
+static PARSER_THREAD_LOCAL char *yy_last_accepting_cpos;
 
-extern int yy_flex_debug;
-int yy_flex_debug = 0;
+extern PARSER_THREAD_LOCAL int yy_flex_debug;
+PARSER_THREAD_LOCAL int yy_flex_debug = 0;
 
 /* The intent behind this definition is that it'll catch
  * any uses of REJECT which flex missed.
@@ -465,10 +475,10 @@ int yy_flex_debug = 0;
 #define yymore() yymore_used_but_not_detected
 #define YY_MORE_ADJ 0
 #define YY_RESTORE_YY_MORE_OFFSET
-char *yytext;
+PARSER_THREAD_LOCAL char *yytext;
 #line 1 "parser.l"
 #define YY_NO_INPUT 1
-#line 3 "parser.l"
+#line 13 "parser.l"
 
 
 #ifdef _WIN32
@@ -549,9 +559,32 @@ int yywrap(void)
 	yylloc.first_column = yylloc.last_column; \
 	yylloc.last_column += yyleng
 
-#line 553 "parser.yy.c"
+/*
+ * The input of a stream (see globalParseStream) is given to flex a line at
+ * a time; strings are scanned from buffers, without it
+ */
+#define YY_INPUT(buf, result, max_size) \
+	result = globalStreamInput(buf, max_size)
+
+/*
+ * flex reads at most this much at a time, and scans the token it is in
+ * again after every read: with the default (8K), a huge token would take
+ * quadratic time; the buffer already grows by doubling, so it is only
+ * limited by the room left in it
+ */
+#define YY_READ_BUF_SIZE (1 << 30)
+
+/*
+ * The parser is pure (see parser.y): the value and the location of the
+ * tokens are given to yylex by yyparse instead of being globals
+ */
+#define YY_DECL int yylex(YYSTYPE * yylval_param, YYLTYPE * yylloc_param)
+#define yylval (*yylval_param)
+#define yylloc (*yylloc_param)
+
+#line 586 "parser.yy.c"
 
-#line 555 "parser.yy.c"
+#line 588 "parser.yy.c"
 
 #define INITIAL 0
 #define ACCEPT_ANY 1
@@ -768,9 +801,9 @@ YY_DECL
 		}
 
 	{
-#line 110 "parser.l"
+#line 143 "parser.l"
 
-#line 774 "parser.yy.c"
+#line 807 "parser.yy.c"
 
 	while ( /*CONSTCOND*/1 )		/* loops until end-of-file is reached */
 		{
@@ -824,7 +857,7 @@ do_action:	/* This label is used only to access EOF actions. */
 			goto yy_find_action;
 
 case YY_STATE_EOF(INITIAL):
-#line 111 "parser.l"
+#line 144 "parser.l"
 {
 	return END_OF_FILE;
 }
@@ -832,7 +865,7 @@ case YY_STATE_EOF(INITIAL):
 case 1:
 /* rule 1 can match eol */
 YY_RULE_SETUP
-#line 114 "parser.l"
+#line 147 "parser.l"
 {
 	UPD_LOCATION;
 	return CHARS_AFTER_EOL;
@@ -841,7 +874,7 @@ YY_RULE_SETUP
 case 2:
 /* rule 2 can match eol */
 YY_RULE_SETUP
-#line 118 "parser.l"
+#line 151 "parser.l"
 {
 	UPD_LOCATION;
 	return END_OF_LINE;
@@ -849,7 +882,7 @@ YY_RULE_SETUP
 	YY_BREAK
 case 3:
 YY_RULE_SETUP
-#line 122 "parser.l"
+#line 155 "parser.l"
 {
 	UPD_LOCATION;
 	BEGIN(ACCEPT_ANY);
@@ -857,7 +890,7 @@ YY_RULE_SETUP
 	YY_BREAK
 case 4:
 YY_RULE_SETUP
-#line 126 "parser.l"
+#line 159 "parser.l"
 {
 	UPD_LOCATION;
 	BEGIN(ACCEPT_ANY_AND_EXPANSION);
@@ -865,7 +898,7 @@ YY_RULE_SETUP
 	YY_BREAK
 case 5:
 YY_RULE_SETUP
-#line 130 "parser.l"
+#line 163 "parser.l"
 {
 	UPD_LOCATION;
 	return SEQUENTIAL;
@@ -873,7 +906,7 @@ YY_RULE_SETUP
 	YY_BREAK
 case 6:
 YY_RULE_SETUP
-#line 134 "parser.l"
+#line 167 "parser.l"
 {
 	UPD_LOCATION;
 	return CONDITIONAL_NZERO;
@@ -881,7 +914,7 @@ YY_RULE_SETUP
 	YY_BREAK
 case 7:
 YY_RULE_SETUP
-#line 138 "parser.l"
+#line 171 "parser.l"
 {
 	UPD_LOCATION;
 	return PIPE;
@@ -889,7 +922,7 @@ YY_RULE_SETUP
 	YY_BREAK
 case 8:
 YY_RULE_SETUP
-#line 142 "parser.l"
+#line 175 "parser.l"
 {
 	UPD_LOCATION;
 	return CONDITIONAL_ZERO;
@@ -897,7 +930,7 @@ YY_RULE_SETUP
 	YY_BREAK
 case 9:
 YY_RULE_SETUP
-#line 146 "parser.l"
+#line 179 "parser.l"
 {
 	UPD_LOCATION;
 	return REDIRECT_OE;
@@ -905,7 +938,7 @@ YY_RULE_SETUP
 	YY_BREAK
 case 10:
 YY_RULE_SETUP
-#line 150 "parser.l"
+#line 183 "parser.l"
 {
 	UPD_LOCATION;
 	return PARALLEL;
@@ -913,7 +946,7 @@ YY_RULE_SETUP
 	YY_BREAK
 case 11:
 YY_RULE_SETUP
-#line 154 "parser.l"
+#line 187 "parser.l"
 {
 	UPD_LOCATION;
 	return REDIRECT_APPEND_E;
@@ -921,7 +954,7 @@ YY_RULE_SETUP
 	YY_BREAK
 case 12:
 YY_RULE_SETUP
-#line 158 "parser.l"
+#line 191 "parser.l"
 {
 	UPD_LOCATION;
 	return REDIRECT_APPEND_O;
@@ -929,7 +962,7 @@ YY_RULE_SETUP
 	YY_BREAK
 case 13:
 YY_RULE_SETUP
-#line 162 "parser.l"
+#line 195 "parser.l"
 {
 	UPD_LOCATION;
 	return REDIRECT_E;
@@ -937,7 +970,7 @@ YY_RULE_SETUP
 	YY_BREAK
 case 14:
 YY_RULE_SETUP
-#line 166 "parser.l"
+#line 199 "parser.l"
 {
 	UPD_LOCATION;
 	return REDIRECT_O;
@@ -945,7 +978,7 @@ YY_RULE_SETUP
 	YY_BREAK
 case 15:
 YY_RULE_SETUP
-#line 170 "parser.l"
+#line 203 "parser.l"
 {
 	UPD_LOCATION;
 	return INDIRECT;
@@ -953,7 +986,7 @@ YY_RULE_SETUP
 	YY_BREAK
 case 16:
 YY_RULE_SETUP
-#line 174 "parser.l"
+#line 207 "parser.l"
 {
 	UPD_LOCATION;
 	return BLANK;
@@ -961,27 +994,25 @@ YY_RULE_SETUP
 	YY_BREAK
 case 17:
 YY_RULE_SETUP
-#line 178 "parser.l"
+#line 211 "parser.l"
 {
 	UPD_LOCATION;
-	yylval.string_un = strdup(yytext);
-	pointerToMallocMemory(yylval.string_un);
+	yylval.string_un = parserStrdup(yytext);
 	return WORD;
 }
 	YY_BREAK
 case 18:
 YY_RULE_SETUP
-#line 184 "parser.l"
+#line 216 "parser.l"
 {
 	UPD_LOCATION;
-	yylval.string_un = strdup(yytext + 1);
-	pointerToMallocMemory(yylval.string_un);
+	yylval.string_un = parserStrdup(yytext + 1);
 	return ENV_VAR;
 }
 	YY_BREAK
 case 19:
 YY_RULE_SETUP
-#line 190 "parser.l"
+#line 221 "parser.l"
 {
 	UPD_LOCATION;
 	return INVALID_ENVIRONMENT_VAR;
@@ -989,23 +1020,22 @@ YY_RULE_SETUP
 	YY_BREAK
 case 20:
 YY_RULE_SETUP
-#line 194 "parser.l"
+#line 225 "parser.l"
 {
 	UPD_LOCATION;
-	yylval.string_un = strdup(yytext);
-	pointerToMallocMemory(yylval.string_un);
+	yylval.string_un = parserStrdup(yytext);
 	return WORD;
 }
 	YY_BREAK
 case YY_STATE_EOF(ACCEPT_ANY):
-#line 200 "parser.l"
+#line 230 "parser.l"
 {
 	return UNEXPECTED_EOF;
 }
 	YY_BREAK
 case 21:
 YY_RULE_SETUP
-#line 203 "parser.l"
+#line 233 "parser.l"
 {
 	UPD_LOCATION;
 	BEGIN(INITIAL);
@@ -1014,23 +1044,22 @@ YY_RULE_SETUP
 case 22:
 /* rule 22 can match eol */
 YY_RULE_SETUP
-#line 207 "parser.l"
+#line 237 "parser.l"
 {
 	UPD_LOCATION;
-	yylval.string_un = strdup(yytext);
-	pointerToMallocMemory(yylval.string_un);
+	yylval.string_un = parserStrdup(yytext);
 	return WORD;
 }
 	YY_BREAK
 case YY_STATE_EOF(ACCEPT_ANY_AND_EXPANSION):
-#line 213 "parser.l"
+#line 242 "parser.l"
 {
 	return UNEXPECTED_EOF;
 }
 	YY_BREAK
 case 23:
 YY_RULE_SETUP
-#line 216 "parser.l"
+#line 245 "parser.l"
 {
 	UPD_LOCATION;
 	BEGIN(INITIAL);
@@ -1038,17 +1067,16 @@ YY_RULE_SETUP
 	YY_BREAK
 case 24:
 YY_RULE_SETUP
-#line 220 "parser.l"
+#line 249 "parser.l"
 {
 	UPD_LOCATION;
-	yylval.string_un = strdup(yytext + 1);
-	pointerToMallocMemory(yylval.string_un);
+	yylval.string_un = parserStrdup(yytext + 1);
 	return ENV_VAR;
 }
 	YY_BREAK
 case 25:
 YY_RULE_SETUP
-#line 226 "parser.l"
+#line 254 "parser.l"
 {
 	UPD_LOCATION;
 	return INVALID_ENVIRONMENT_VAR;
@@ -1057,18 +1085,17 @@ YY_RULE_SETUP
 case 26:
 /* rule 26 can match eol */
 YY_RULE_SETUP
-#line 230 "parser.l"
+#line 258 "parser.l"
 {
 	UPD_LOCATION;
-	yylval.string_un = strdup(yytext);
-	pointerToMallocMemory(yylval.string_un);
+	yylval.string_un = parserStrdup(yytext);
 	return WORD;
 }
 	YY_BREAK
 case 27:
 /* rule 27 can match eol */
 YY_RULE_SETUP
-#line 236 "parser.l"
+#line 263 "parser.l"
 {
 	UPD_LOCATION;
 	return NOT_ACCEPTED_CHAR;
@@ -1076,10 +1103,10 @@ YY_RULE_SETUP
 	YY_BREAK
 case 28:
 YY_RULE_SETUP
-#line 240 "parser.l"
+#line 267 "parser.l"
 ECHO;
 	YY_BREAK
-#line 1083 "parser.yy.c"
+#line 1110 "parser.yy.c"
 
 	case YY_END_OF_BUFFER:
 		{
@@ -2046,18 +2073,30 @@ void yyfree (void * ptr )
 
 #define YYTABLES_NAME "yytables"
 
-#line 240 "parser.l"
+#line 267 "parser.l"
 
 
 
-YY_BUFFER_STATE myState;
-bool haveOneBufferState = false;
+static PARSER_THREAD_LOCAL YY_BUFFER_STATE myState;
+static PARSER_THREAD_LOCAL bool haveOneBufferState = false;
 
 
-void globalParseAnotherString(const char * str)
+void globalParseAnotherString(const char * str, size_t length)
 {
+	char * copy;
+
 	globalEndParsing();
-	myState = yy_scan_string(str);
+
+	/*
+	 * scan a copy of the line from the parser memory, in place
+	 * (yy_scan_buffer needs it to end with two NULs), so that
+	 * flex does not allocate a new buffer for every line
+	 */
+	copy = (char *)parserAlloc(length + 2);
+	memcpy(copy, str, length);
+	copy[length] = copy[length + 1] = '\0';
+
+	myState = yy_scan_buffer(copy, length + 2);
 	BEGIN(INITIAL);
 	/*
 	 * Actually i don't know how this should be done, but the
@@ -2070,8 +2109,185 @@ void globalParseAnotherString(const char * str)
 void globalEndParsing()
 {
 	if (haveOneBufferState) {
-		yylex_destroy();
+		yy_delete_buffer(myState);
 		haveOneBufferState = false;
 	}
 }
 
+
+void globalReleaseParsing()
+{
+	globalEndParsing();
+	globalEndStream();
+	yylex_destroy();
+}
+
+
+/*
+ * Streaming input: the lines of a file descriptor (read in chunks) or of a
+ * memory region are given to flex as it needs them, so that no line has to
+ * be buffered whole; the input seems to end right after the newline of a
+ * line until the next one is started, so flex never reads past the line it
+ * scans (e.g. waiting for the next line of a pipe)
+ */
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#define STREAM_CHUNK_SIZE	(64 * 1024)
+/* the buffer of flex grows for the long tokens, it is not kept that big */
+#define STREAM_BUFFER_KEEP	(4 * YY_BUF_SIZE)
+
+static PARSER_THREAD_LOCAL YY_BUFFER_STATE streamState;
+static PARSER_THREAD_LOCAL bool haveStreamState = false;
+static PARSER_THREAD_LOCAL int streamFd = -1;
+static PARSER_THREAD_LOCAL char * streamChunk = NULL;
+static PARSER_THREAD_LOCAL const char * streamData;
+static PARSER_THREAD_LOCAL size_t streamPos;
+static PARSER_THREAD_LOCAL size_t streamEnd;
+static PARSER_THREAD_LOCAL bool streamLineDone;
+
+
+/* there is no more input if this returns false */
+static bool streamFill(void)
+{
+	int rc;
+
+	if (streamPos < streamEnd)
+		return true;
+
+	if (streamFd == -1)
+		return false;
+
+	do {
+		rc = read(streamFd, streamChunk, STREAM_CHUNK_SIZE);
+	} while ((rc == -1) && (errno == EINTR));
+
+	if (rc <= 0)
+		return false;
+
+	streamPos = 0;
+	streamEnd = rc;
+
+	return true;
+}
+
+
+int globalStreamInput(char * buf, int max_size)
+{
+	const char * newline;
+	size_t length;
+
+	if (streamLineDone || !streamFill())
+		return 0;
+
+	length = streamEnd - streamPos;
+	if (length > (size_t)max_size)
+		length = max_size;
+
+	newline = (const char *)memchr(streamData + streamPos, '\n', length);
+	if (newline != NULL) {
+		length = newline - (streamData + streamPos) + 1;
+		streamLineDone = true;
+	}
+
+	memcpy(buf, streamData + streamPos, length);
+	streamPos += length;
+
+	return (int)length;
+}
+
+
+void globalParseStream(int fd, const char * data, size_t size)
+{
+	globalEndStream();
+
+	streamFd = fd;
+	if (fd != -1) {
+		streamChunk = (char *)malloc(STREAM_CHUNK_SIZE);
+		if (streamChunk == NULL) {
+			fprintf(stderr, "malloc() failed\n");
+			exit(EXIT_FAILURE);
+		}
+
+		streamData = streamChunk;
+		streamPos = streamEnd = 0;
+	} else {
+		streamData = data;
+		streamPos = 0;
+		streamEnd = size;
+	}
+
+	streamState = yy_create_buffer(NULL, YY_BUF_SIZE);
+	haveStreamState = true;
+	streamLineDone = true;
+}
+
+
+bool globalStreamNextLine(void)
+{
+	if (!haveStreamState || !streamFill())
+		return false;
+
+	/* a string may have been scanned since the last line */
+	globalEndParsing();
+	if (streamState->yy_buf_size > STREAM_BUFFER_KEEP) {
+		yy_delete_buffer(streamState);
+		streamState = yy_create_buffer(NULL, YY_BUF_SIZE);
+	}
+	yy_switch_to_buffer(streamState);
+	yy_flush_buffer(streamState);
+	BEGIN(INITIAL);
+	streamLineDone = false;
+
+	return true;
+}
+
+
+void globalStreamSkipLine(void)
+{
+	const char * newline;
+
+	while (!streamLineDone && streamFill()) {
+		newline = (const char *)memchr(streamData + streamPos, '\n',
+			streamEnd - streamPos);
+		if (newline != NULL) {
+			streamPos = newline - streamData + 1;
+			streamLineDone = true;
+		} else {
+			streamPos = streamEnd;
+		}
+	}
+}
+
+
+void globalEndStream(void)
+{
+	if (haveStreamState) {
+		yy_delete_buffer(streamState);
+		haveStreamState = false;
+	}
+
+	free(streamChunk);
+	streamChunk = NULL;
+	streamFd = -1;
+	streamPos = streamEnd = 0;
+}
+
+
+size_t globalScannerSize(void)
+{
+	size_t size = 0;
+
+	if (haveStreamState) {
+		size += streamState->yy_buf_size + 2;
+	}
+
+	if (streamChunk != NULL) {
+		size += STREAM_CHUNK_SIZE;
+	}
+
+	return size;
+}
+
@@ -0,0 +1,654 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifdef __cplusplus
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+#else
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#endif
+
+#include "parser.h"
+
+
+/*
+ * Layout of a packed tree (see parser.h): the header, then the arrays of
+ * the command_t, simple_command_t and word_t nodes, then the string table.
+ * The nodes keep their native layout, with offsets from the start of the
+ * buffer in place of the pointers (0 for NULL); a node only points to nodes
+ * after it, except for up, so relocated trees cannot have cycles. Every node
+ * also has a single father, and the operators are nested like in the trees
+ * of the parser (checked before a tree is unpacked).
+ */
+
+#define PACKED_MAGIC		"\0PT1"
+#define PACKED_MAGIC_SIZE	4
+#define PACKED_ALIGNMENT	16
+#define PACKED_MAX_SIZE		0x7fffffffU
+
+typedef struct {
+	char magic[PACKED_MAGIC_SIZE];
+	unsigned int size;
+	/* a tree can only be unpacked by a build with the same layout */
+	unsigned short pointerSize;
+	unsigned short commandSize;
+	unsigned short simpleSize;
+	unsigned short wordSize;
+	unsigned int nrCommands;
+	unsigned int nrSimple;
+	unsigned int nrWords;
+	unsigned int stringsSize;
+} packed_header_t;
+
+#define PACKED_ALIGN(size) \
+	(((size) + PACKED_ALIGNMENT - 1) & ~(size_t)(PACKED_ALIGNMENT - 1))
+#define HEADER_SIZE		PACKED_ALIGN(sizeof(packed_header_t))
+
+#define TO_OFFSET(type, offset)	((type *)(size_t)(offset))
+#define OFFSET_OF(ptr)		((size_t)(ptr))
+
+
+/* a string of the table, found by its hash */
+typedef struct {
+	const char * string;
+	size_t offset;
+} packed_string_t;
+
+typedef struct {
+	char * base;
+	size_t nrCommands;
+	size_t nrSimple;
+	size_t nrWords;
+	size_t simpleOffset;
+	size_t wordsOffset;
+	size_t stringsOffset;
+	size_t stringsSize;
+	size_t nextCommand;
+	size_t nextSimple;
+	size_t nextWord;
+	packed_string_t * strings;
+	size_t stringsCapacity;
+} packer_t;
+
+
+static size_t hashString(const char * str)
+{
+	size_t hash = 5381;
+
+	while (*str != '\0') {
+		hash = hash * 33 + (unsigned char)*str++;
+	}
+
+	return hash;
+}
+
+
+/* the slot of str in the table of the strings, empty if it is not there */
+static packed_string_t * findString(packer_t * p, const char * str)
+{
+	size_t i = hashString(str) & (p->stringsCapacity - 1);
+
+	while ((p->strings[i].string != NULL) && (strcmp(p->strings[i].string, str) != 0)) {
+		i = (i + 1) & (p->stringsCapacity - 1);
+	}
+
+	return &p->strings[i];
+}
+
+
+static void countWords(packer_t * p, word_t * w)
+{
+	word_t * part;
+
+	for (; w != NULL; w = w->next_word) {
+		for (part = w; part != NULL; part = part->next_part) {
+			p->nrWords++;
+		}
+	}
+}
+
+
+static void countNodes(packer_t * p, command_t * c)
+{
+	p->nrCommands++;
+
+	if (c->op != OP_NONE) {
+		countNodes(p, c->cmd1);
+		if (c->cmd2 != NULL) {
+			countNodes(p, c->cmd2);
+		}
+		return;
+	}
+
+	p->nrSimple++;
+	countWords(p, c->scmd->verb);
+	countWords(p, c->scmd->params);
+	countWords(p, c->scmd->in);
+	countWords(p, c->scmd->out);
+	countWords(p, c->scmd->err);
+}
+
+
+static void addStrings(packer_t * p, word_t * w)
+{
+	packed_string_t * s;
+	word_t * part;
+
+	for (; w != NULL; w = w->next_word) {
+		for (part = w; part != NULL; part = part->next_part) {
+			s = findString(p, part->string);
+			if (s->string == NULL) {
+				s->string = part->string;
+				s->offset = p->stringsSize;
+				p->stringsSize += strlen(part->string) + 1;
+			}
+		}
+	}
+}
+
+
+static void addTreeStrings(packer_t * p, command_t * c)
+{
+	if (c->op != OP_NONE) {
+		addTreeStrings(p, c->cmd1);
+		if (c->cmd2 != NULL) {
+			addTreeStrings(p, c->cmd2);
+		}
+		return;
+	}
+
+	addStrings(p, c->scmd->verb);
+	addStrings(p, c->scmd->params);
+	addStrings(p, c->scmd->in);
+	addStrings(p, c->scmd->out);
+	addStrings(p, c->scmd->err);
+}
+
+
+static word_t * packParts(packer_t * p, word_t * part)
+{
+	size_t offset;
+	word_t * copy;
+
+	if (part == NULL) {
+		return NULL;
+	}
+
+	offset = p->wordsOffset + p->nextWord++ * sizeof(word_t);
+	copy = (word_t *)(p->base + offset);
+
+	memset(copy, 0, sizeof(*copy));
+	copy->string = TO_OFFSET(const char, p->stringsOffset + findString(p, part->string)->offset);
+	copy->expand = part->expand;
+	copy->next_part = packParts(p, part->next_part);
+
+	return TO_OFFSET(word_t, offset);
+}
+
+
+static word_t * packWords(packer_t * p, word_t * w)
+{
+	word_t * first = NULL;
+	word_t * last = NULL;
+	word_t * copy;
+
+	for (; w != NULL; w = w->next_word) {
+		copy = packParts(p, w);
+		if (last == NULL) {
+			first = copy;
+		} else {
+			((word_t *)(p->base + OFFSET_OF(last)))->next_word = copy;
+		}
+		last = copy;
+	}
+
+	return first;
+}
+
+
+static command_t * packCommand(packer_t * p, command_t * c, size_t up)
+{
+	size_t offset = HEADER_SIZE + p->nextCommand++ * sizeof(command_t);
+	command_t * copy = (command_t *)(p->base + offset);
+	size_t simpleOffset;
+	simple_command_t * s;
+
+	memset(copy, 0, sizeof(*copy));
+	copy->up = TO_OFFSET(command_t, up);
+	copy->op = c->op;
+
+	if (c->op != OP_NONE) {
+		copy->cmd1 = packCommand(p, c->cmd1, offset);
+		if (c->cmd2 != NULL) {
+			copy->cmd2 = packCommand(p, c->cmd2, offset);
+		}
+		return TO_OFFSET(command_t, offset);
+	}
+
+	simpleOffset = p->simpleOffset + p->nextSimple++ * sizeof(simple_command_t);
+	s = (simple_command_t *)(p->base + simpleOffset);
+
+	memset(s, 0, sizeof(*s));
+	s->verb = packWords(p, c->scmd->verb);
+	s->params = packWords(p, c->scmd->params);
+	s->in = packWords(p, c->scmd->in);
+	s->out = packWords(p, c->scmd->out);
+	s->err = packWords(p, c->scmd->err);
+	s->io_flags = c->scmd->io_flags;
+	s->up = TO_OFFSET(command_t, offset);
+	copy->scmd = TO_OFFSET(simple_command_t, simpleOffset);
+
+	return TO_OFFSET(command_t, offset);
+}
+
+
+size_t pack_parse_tree(command_t * root, void * buffer, size_t size)
+{
+	packer_t p;
+	packed_header_t * h;
+	size_t total;
+	size_t i;
+
+	memset(&p, 0, sizeof(p));
+	countNodes(&p, root);
+
+	/* a power of two, at least twice the number of strings */
+	p.stringsCapacity = 16;
+	while (p.stringsCapacity < 2 * p.nrWords) {
+		p.stringsCapacity *= 2;
+	}
+
+	p.strings = (packed_string_t *)calloc(p.stringsCapacity, sizeof(packed_string_t));
+	if (p.strings == NULL) {
+		fprintf(stderr, "calloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	addTreeStrings(&p, root);
+
+	p.simpleOffset = HEADER_SIZE + p.nrCommands * sizeof(command_t);
+	p.wordsOffset = p.simpleOffset + p.nrSimple * sizeof(simple_command_t);
+	p.stringsOffset = p.wordsOffset + p.nrWords * sizeof(word_t);
+	total = PACKED_ALIGN(p.stringsOffset + p.stringsSize);
+
+	if (total > PACKED_MAX_SIZE) {
+		free(p.strings);
+		return 0;
+	}
+
+	if (size < total) {
+		free(p.strings);
+		return total;
+	}
+
+	p.base = (char *)buffer;
+	memset(p.base, 0, HEADER_SIZE);
+	packCommand(&p, root, 0);
+
+	for (i = 0; i < p.stringsCapacity; i++) {
+		if (p.strings[i].string != NULL) {
+			strcpy(p.base + p.stringsOffset + p.strings[i].offset, p.strings[i].string);
+		}
+	}
+
+	memset(p.base + p.stringsOffset + p.stringsSize, 0,
+		total - p.stringsOffset - p.stringsSize);
+	free(p.strings);
+
+	h = (packed_header_t *)buffer;
+	memcpy(h->magic, PACKED_MAGIC, PACKED_MAGIC_SIZE);
+	h->size = (unsigned int)total;
+	h->pointerSize = sizeof(void *);
+	h->commandSize = sizeof(command_t);
+	h->simpleSize = sizeof(simple_command_t);
+	h->wordSize = sizeof(word_t);
+	h->nrCommands = (unsigned int)p.nrCommands;
+	h->nrSimple = (unsigned int)p.nrSimple;
+	h->nrWords = (unsigned int)p.nrWords;
+	h->stringsSize = (unsigned int)p.stringsSize;
+
+	return total;
+}
+
+
+bool is_packed_parse_tree(const void * buffer, size_t size)
+{
+	return (size >= HEADER_SIZE) && (memcmp(buffer, PACKED_MAGIC, PACKED_MAGIC_SIZE) == 0);
+}
+
+
+/* the bounds of an array of nodes of the buffer being unpacked */
+typedef struct {
+	size_t first;
+	size_t count;
+	size_t nodeSize;
+} packed_array_t;
+
+typedef struct {
+	char * base;
+	packed_array_t commands;
+	packed_array_t simples;
+	packed_array_t words;
+	size_t stringsOffset;
+	size_t stringsSize;
+} packed_layout_t;
+
+
+#define NODE(l, array, type, i) \
+	((type *)((l)->base + (l)->array.first + (i) * sizeof(type)))
+
+/* the pointer a (non NULL) offset of the buffer stands for */
+#define RELOCATE(l, type, ptr)	((type *)((l)->base + OFFSET_OF(ptr)))
+
+
+/*
+ * Check that offset is 0 or points to a node of array; with after the node
+ * must also come after the one at self, and before it otherwise.
+ */
+static bool validOffset(const packed_array_t * array, size_t offset, size_t self, bool after)
+{
+	if (offset == 0) {
+		return true;
+	}
+
+	if ((offset < array->first) || (offset >= array->first + array->count * array->nodeSize)) {
+		return false;
+	}
+
+	if ((offset - array->first) % array->nodeSize != 0) {
+		return false;
+	}
+
+	return after ? (offset > self) : (offset < self);
+}
+
+
+static bool validWords(const packed_layout_t * l)
+{
+	size_t i;
+
+	for (i = 0; i < l->words.count; i++) {
+		word_t * w = NODE(l, words, word_t, i);
+		size_t offset = l->words.first + i * sizeof(word_t);
+
+		if ((OFFSET_OF(w->string) < l->stringsOffset) ||
+			(OFFSET_OF(w->string) >= l->stringsOffset + l->stringsSize)) {
+			return false;
+		}
+
+		if (!validOffset(&l->words, OFFSET_OF(w->next_part), offset, true) ||
+			!validOffset(&l->words, OFFSET_OF(w->next_word), offset, true)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+static bool validSimple(const packed_layout_t * l)
+{
+	size_t i;
+
+	for (i = 0; i < l->simples.count; i++) {
+		simple_command_t * s = NODE(l, simples, simple_command_t, i);
+
+		if ((s->verb == NULL) || (s->up == NULL) ||
+			!validOffset(&l->commands, OFFSET_OF(s->up), (size_t)-1, false)) {
+			return false;
+		}
+
+		if (!validOffset(&l->words, OFFSET_OF(s->verb), 0, true) ||
+			!validOffset(&l->words, OFFSET_OF(s->params), 0, true) ||
+			!validOffset(&l->words, OFFSET_OF(s->in), 0, true) ||
+			!validOffset(&l->words, OFFSET_OF(s->out), 0, true) ||
+			!validOffset(&l->words, OFFSET_OF(s->err), 0, true)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * The rank of an operator in the tree: the operands of a node have a higher
+ * one, or the same one for the operators that can be chained (parser.h)
+ */
+static int operatorRank(operator_t op)
+{
+	switch (op) {
+	case OP_SEQUENTIAL:
+		return 0;
+	case OP_BACKGROUND:
+		return 1;
+	case OP_PARALLEL:
+		return 2;
+	case OP_CONDITIONAL_ZERO:
+	case OP_CONDITIONAL_NZERO:
+		return 3;
+	case OP_PIPE:
+		return 4;
+	default:
+		return 5;
+	}
+}
+
+
+static bool validCommands(const packed_layout_t * l)
+{
+	size_t nrSimple = 0;
+	size_t i;
+
+	for (i = 0; i < l->commands.count; i++) {
+		command_t * c = NODE(l, commands, command_t, i);
+		size_t offset = l->commands.first + i * sizeof(command_t);
+		command_t * up;
+
+		if (((int)c->op < (int)OP_NONE) || ((int)c->op >= (int)OP_DUMMY)) {
+			return false;
+		}
+
+		/* the shape parser.h describes, which the users rely on */
+		if (c->op == OP_NONE) {
+			if ((c->scmd == NULL) || (c->cmd1 != NULL) || (c->cmd2 != NULL)) {
+				return false;
+			}
+			nrSimple++;
+		} else if ((c->scmd != NULL) || (c->cmd1 == NULL) || (c->cmd1 == c->cmd2) ||
+			((c->cmd2 == NULL) != (c->op == OP_BACKGROUND))) {
+			return false;
+		}
+
+		if (!validOffset(&l->commands, OFFSET_OF(c->cmd1), offset, true) ||
+			!validOffset(&l->commands, OFFSET_OF(c->cmd2), offset, true) ||
+			!validOffset(&l->commands, OFFSET_OF(c->up), offset, false) ||
+			!validOffset(&l->simples, OFFSET_OF(c->scmd), 0, true) ||
+			((i == 0) != (c->up == NULL))) {
+			return false;
+		}
+
+		if ((c->scmd != NULL) &&
+			(OFFSET_OF(RELOCATE(l, simple_command_t, c->scmd)->up) != offset)) {
+			return false;
+		}
+
+		if (c->up == NULL) {
+			continue;
+		}
+
+		/* a node is an operand of its father only, so the nodes are a tree */
+		up = RELOCATE(l, command_t, c->up);
+		if ((OFFSET_OF(up->cmd1) != offset) && (OFFSET_OF(up->cmd2) != offset)) {
+			return false;
+		}
+
+		if ((operatorRank(c->op) < operatorRank(up->op)) ||
+			((operatorRank(c->op) == operatorRank(up->op)) && (c->op == OP_BACKGROUND))) {
+			return false;
+		}
+	}
+
+	/* every simple command belongs to one command (its up) */
+	return nrSimple == l->simples.count;
+}
+
+
+/*
+ * Check that the words of a list are the next ones of the array, in the
+ * order pack_parse_tree writes them, so that every one of them is in a
+ * single list; the parts of a word do not start another one.
+ */
+static bool validWordList(const packed_layout_t * l, word_t * list, size_t * next)
+{
+	size_t word;
+	size_t part;
+
+	for (word = OFFSET_OF(list); word != 0; word = OFFSET_OF(RELOCATE(l, word_t, word)->next_word)) {
+		for (part = word; part != 0; part = OFFSET_OF(RELOCATE(l, word_t, part)->next_part)) {
+			if (part != l->words.first + (*next)++ * sizeof(word_t)) {
+				return false;
+			}
+
+			if ((part != word) && (RELOCATE(l, word_t, part)->next_word != NULL)) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+
+static bool validWordLists(const packed_layout_t * l)
+{
+	size_t next = 0;
+	size_t i;
+
+	for (i = 0; i < l->simples.count; i++) {
+		simple_command_t * s = NODE(l, simples, simple_command_t, i);
+
+		if (!validWordList(l, s->verb, &next) || !validWordList(l, s->params, &next) ||
+			!validWordList(l, s->in, &next) || !validWordList(l, s->out, &next) ||
+			!validWordList(l, s->err, &next)) {
+			return false;
+		}
+	}
+
+	return next == l->words.count;
+}
+
+
+static void relocateTree(const packed_layout_t * l)
+{
+	size_t i;
+
+	for (i = 0; i < l->words.count; i++) {
+		word_t * w = NODE(l, words, word_t, i);
+
+		w->string = RELOCATE(l, const char, w->string);
+		if (w->next_part != NULL) {
+			w->next_part = RELOCATE(l, word_t, w->next_part);
+		}
+		if (w->next_word != NULL) {
+			w->next_word = RELOCATE(l, word_t, w->next_word);
+		}
+	}
+
+	for (i = 0; i < l->simples.count; i++) {
+		simple_command_t * s = NODE(l, simples, simple_command_t, i);
+
+		s->verb = RELOCATE(l, word_t, s->verb);
+		if (s->params != NULL) {
+			s->params = RELOCATE(l, word_t, s->params);
+		}
+		if (s->in != NULL) {
+			s->in = RELOCATE(l, word_t, s->in);
+		}
+		if (s->out != NULL) {
+			s->out = RELOCATE(l, word_t, s->out);
+		}
+		if (s->err != NULL) {
+			s->err = RELOCATE(l, word_t, s->err);
+		}
+		s->up = RELOCATE(l, command_t, s->up);
+		s->aux = NULL;
+	}
+
+	for (i = 0; i < l->commands.count; i++) {
+		command_t * c = NODE(l, commands, command_t, i);
+
+		if (c->up != NULL) {
+			c->up = RELOCATE(l, command_t, c->up);
+		}
+		if (c->cmd1 != NULL) {
+			c->cmd1 = RELOCATE(l, command_t, c->cmd1);
+		}
+		if (c->cmd2 != NULL) {
+			c->cmd2 = RELOCATE(l, command_t, c->cmd2);
+		}
+		if (c->scmd != NULL) {
+			c->scmd = RELOCATE(l, simple_command_t, c->scmd);
+		}
+		c->aux = NULL;
+	}
+}
+
+
+command_t * unpack_parse_tree(void * buffer, size_t size)
+{
+	packed_header_t * h = (packed_header_t *)buffer;
+	packed_layout_t l;
+
+	if (!is_packed_parse_tree(buffer, size) || (h->size != size)) {
+		return NULL;
+	}
+
+	if ((h->pointerSize != sizeof(void *)) || (h->commandSize != sizeof(command_t)) ||
+		(h->simpleSize != sizeof(simple_command_t)) || (h->wordSize != sizeof(word_t))) {
+		return NULL;
+	}
+
+	l.base = (char *)buffer;
+	l.commands.first = HEADER_SIZE;
+	l.commands.count = h->nrCommands;
+	l.commands.nodeSize = sizeof(command_t);
+	l.simples.first = l.commands.first + l.commands.count * sizeof(command_t);
+	l.simples.count = h->nrSimple;
+	l.simples.nodeSize = sizeof(simple_command_t);
+	l.words.first = l.simples.first + l.simples.count * sizeof(simple_command_t);
+	l.words.count = h->nrWords;
+	l.words.nodeSize = sizeof(word_t);
+	l.stringsOffset = l.words.first + l.words.count * sizeof(word_t);
+	l.stringsSize = h->stringsSize;
+
+	/* the counts are 32 bits, so the sums above cannot overflow */
+	if ((l.commands.count == 0) || (l.stringsSize == 0) ||
+		(l.stringsOffset + l.stringsSize > size)) {
+		return NULL;
+	}
+
+	/* every string ends within the table */
+	if (l.base[l.stringsOffset + l.stringsSize - 1] != '\0') {
+		return NULL;
+	}
+
+	if (!validWords(&l) || !validSimple(&l) || !validCommands(&l) || !validWordLists(&l)) {
+		return NULL;
+	}
+
+	relocateTree(&l);
+
+	/* the offsets are gone, the tree cannot be unpacked again */
+	memset(h->magic, 0, PACKED_MAGIC_SIZE);
+
+	return NODE(&l, commands, command_t, 0);
+}